@@ -0,0 +1,177 @@
+// Measures the cost of looking up the calling thread's input buffer, which
+// every log call does before it can write anything. "pthread" is the old
+// lookup through pthread_getspecific; "cached" is what basic_log does now,
+// i.e. a thread-local cache with pthread_getspecific as a fallback. We report
+// nanoseconds per lookup, and the number of retired instructions per lookup
+// if the kernel lets us read the hardware counters.
+//
+// Usage: input_buffer_lookup [iterations]
+#include <reckless/basic_log.hpp>
+#include <reckless/writer.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>      // memset
+#include <cstdint>      // uint64_t
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+class null_writer : public reckless::writer {
+public:
+    Result write(void const*, std::size_t) override
+    {
+        return SUCCESS;
+    }
+};
+
+class probe_log : public reckless::basic_log {
+public:
+    probe_log(reckless::writer* pwriter) : basic_log(pwriter)
+    {
+    }
+
+    reckless::detail::thread_input_buffer* lookup()
+    {
+        return get_input_buffer();
+    }
+};
+
+// Counts instructions retired in user space by the calling thread. If
+// perf_event_open isn't available (e.g. in a container or with
+// perf_event_paranoid set too high), valid() returns false.
+class instruction_counter {
+public:
+    instruction_counter()
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~instruction_counter()
+    {
+        if(fd_ != -1)
+            close(fd_);
+    }
+
+    bool valid() const
+    {
+        return fd_ != -1;
+    }
+
+    void start()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    std::uint64_t stop()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        std::uint64_t count = 0;
+        if(read(fd_, &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+// Keeps the compiler from optimizing the lookups away.
+void* volatile g_sink;
+
+struct result {
+    double ns;
+    double instructions;
+};
+
+template <class Lookup>
+result measure(unsigned iterations, Lookup lookup)
+{
+    instruction_counter counter;
+    // Warm up, and create the input buffer.
+    for(unsigned i=0; i!=1000; ++i)
+        g_sink = lookup();
+
+    if(counter.valid())
+        counter.start();
+    auto start = clock_type::now();
+    for(unsigned i=0; i!=iterations; ++i)
+        g_sink = lookup();
+    auto stop = clock_type::now();
+    std::uint64_t instructions = counter.valid()? counter.stop() : 0;
+
+    result r;
+    r.ns = static_cast<double>(std::chrono::duration_cast<
+        std::chrono::nanoseconds>(stop - start).count()) / iterations;
+    r.instructions = counter.valid()?
+        static_cast<double>(instructions) / iterations : -1.0;
+    return r;
+}
+
+void print(char const* name, result const& r)
+{
+    std::cout << std::setw(10) << std::left << name
+        << std::setw(10) << std::right << std::fixed << std::setprecision(2)
+        << r.ns;
+    if(r.instructions < 0)
+        std::cout << std::setw(14) << "n/a";
+    else
+        std::cout << std::setw(14) << std::setprecision(1) << r.instructions;
+    std::cout << std::endl;
+}
+
+}   // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned iterations = 100000000;
+    if(argc > 1)
+        iterations = static_cast<unsigned>(std::atoi(argv[1]));
+    if(iterations == 0)
+        iterations = 1;
+
+    null_writer writer;
+    probe_log log(&writer);
+
+    // The pthread key that basic_log used to go through on every call. We
+    // store the buffer pointer in a key of our own so that both loops return
+    // the same thing.
+    pthread_key_t key;
+    if(0 != pthread_key_create(&key, nullptr))
+        return 1;
+    pthread_setspecific(key, log.lookup());
+
+    std::cout << std::setw(10) << std::left << "lookup"
+        << std::setw(10) << std::right << "ns/call"
+        << std::setw(14) << "instr/call" << std::endl;
+    print("pthread", measure(iterations, [&]()
+    {
+        return pthread_getspecific(key);
+    }));
+    print("cached", measure(iterations, [&]()
+    {
+        return static_cast<void*>(log.lookup());
+    }));
+
+    pthread_key_delete(key);
+    log.close();
+    return 0;
+}
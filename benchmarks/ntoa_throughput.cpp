@@ -0,0 +1,373 @@
+// Measures the number conversions that the output thread does for %d, %x,
+// %f, %e, %g and the shortest form of a double (a bare %s), and compares them
+// with snprintf and, when built as C++17, with std::to_chars. snprintf has no
+// shortest form, so there we compare with %.17g, which is what you would use
+// to get a string that reads back as the same number. Fixed-point decimals
+// are compared with printing the same number as a double with %.8f. Arrays
+// are timed per element, against calling itoa_base10() for each one. Each conversion writes to an output_buffer like it would in
+// the log. The values are drawn from a few different distributions, since the
+// cost mostly depends on the number of digits. We report nanoseconds per
+// conversion.
+//
+// Usage: ntoa_throughput [iterations]
+#include <reckless/ntoa.hpp>
+#include <reckless/output_buffer.hpp>
+#include <reckless/writer.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#define HAVE_TO_CHARS 1
+#endif
+#endif
+
+namespace {
+
+class null_writer : public reckless::writer {
+public:
+    Result write(void const*, std::size_t) override
+    {
+        return SUCCESS;
+    }
+};
+
+// A power of two, so that we can pick values with a mask.
+std::size_t const VALUE_COUNT = 4096;
+
+template <class T, class Function>
+double nanoseconds_per_call(unsigned iterations, std::vector<T> const& values,
+        Function f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i=0; i!=iterations; ++i)
+        f(values[i & (VALUE_COUNT-1)]);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count()
+        / iterations;
+}
+
+void report(char const* name, double reckless_ns, double snprintf_ns,
+        double to_chars_ns)
+{
+    std::cout << std::left << std::setw(24) << name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(10) << reckless_ns
+        << std::setw(10) << snprintf_ns;
+    if(to_chars_ns >= 0)
+        std::cout << std::setw(10) << to_chars_ns;
+    else
+        std::cout << std::setw(10) << "-";
+    std::cout << std::endl;
+}
+
+// Numbers whose length in digits is evenly distributed, which is closer to
+// what a log sees than evenly distributed values, which nearly all have the
+// maximum number of digits.
+std::vector<std::uint64_t> mixed_length_values(std::mt19937_64& rng,
+        unsigned max_digits)
+{
+    std::vector<std::uint64_t> values(VALUE_COUNT);
+    for(auto& v : values) {
+        unsigned digits = 1 + rng() % max_digits;
+        std::uint64_t limit = 1;
+        for(unsigned i=0; i!=digits; ++i)
+            limit *= 10;
+        v = rng() % limit;
+    }
+    return values;
+}
+
+template <class T>
+std::vector<T> uniform_values(std::mt19937_64& rng, T low, T high)
+{
+    std::uniform_int_distribution<T> distribution(low, high);
+    std::vector<T> values(VALUE_COUNT);
+    for(auto& v : values)
+        v = distribution(rng);
+    return values;
+}
+
+class benchmark {
+public:
+    explicit benchmark(unsigned iterations) :
+        iterations_(iterations),
+        buffer_(&writer_, 64*1024)
+    {
+    }
+
+    // %d, or %08d if zero_pad is set.
+    template <class T>
+    void decimal(char const* name, std::vector<T> const& values, bool zero_pad)
+    {
+        reckless::conversion_specification cs;
+        if(zero_pad) {
+            cs.pad_with_zeroes = true;
+            cs.minimum_field_width = 8;
+        }
+        bool is_signed = std::is_signed<T>::value;
+        char const* format = zero_pad? (is_signed? "%08lld" : "%08llu") :
+            (is_signed? "%lld" : "%llu");
+        double r = nanoseconds_per_call(iterations_, values, [&](T v) {
+            reckless::itoa_base10(&buffer_, v, cs);
+            flush_if_full();
+        });
+        double s = nanoseconds_per_call(iterations_, values, [&](T v) {
+            if(is_signed)
+                write_snprintf(format, static_cast<long long>(v));
+            else
+                write_snprintf(format, static_cast<unsigned long long>(v));
+        });
+        double t = -1;
+#ifdef HAVE_TO_CHARS
+        if(not zero_pad) {
+            t = nanoseconds_per_call(iterations_, values, [&](T v) {
+                char* p = buffer_.reserve(24);
+                buffer_.commit(std::to_chars(p, p + 24, v).ptr - p);
+                flush_if_full();
+            });
+        }
+#endif
+        report(name, r, s, t);
+    }
+
+    template <class T>
+    void hexadecimal(char const* name, std::vector<T> const& values)
+    {
+        reckless::conversion_specification cs;
+        double r = nanoseconds_per_call(iterations_, values, [&](T v) {
+            reckless::itoa_base16(&buffer_, v, cs);
+            flush_if_full();
+        });
+        double s = nanoseconds_per_call(iterations_, values, [&](T v) {
+            write_snprintf("%llx", static_cast<unsigned long long>(v));
+        });
+        double t = -1;
+#ifdef HAVE_TO_CHARS
+        t = nanoseconds_per_call(iterations_, values, [&](T v) {
+            char* p = buffer_.reserve(24);
+            buffer_.commit(std::to_chars(p, p + 24, v, 16).ptr - p);
+            flush_if_full();
+        });
+#endif
+        report(name, r, s, t);
+    }
+
+    // %f, %e or %g with the default precision of six.
+    void floating(char const* name, std::vector<double> const& values,
+            char conversion)
+    {
+        reckless::conversion_specification cs;
+        cs.precision = 6;
+        double r = nanoseconds_per_call(iterations_, values, [&](double v) {
+            if(conversion == 'f')
+                reckless::ftoa_base10_f(&buffer_, v, cs);
+            else if(conversion == 'e')
+                reckless::ftoa_base10_e(&buffer_, v, cs);
+            else
+                reckless::ftoa_base10_g(&buffer_, v, cs);
+            flush_if_full();
+        });
+        char const format[] = {'%', conversion, '\0'};
+        double s = nanoseconds_per_call(iterations_, values, [&](double v) {
+            write_snprintf(format, v);
+        });
+        double t = -1;
+#if defined(HAVE_TO_CHARS) && defined(__cpp_lib_to_chars)
+        std::chars_format chars_format = conversion == 'f'?
+            std::chars_format::fixed : conversion == 'e'?
+            std::chars_format::scientific : std::chars_format::general;
+        t = nanoseconds_per_call(iterations_, values, [&](double v) {
+            char* p = buffer_.reserve(400);
+            buffer_.commit(std::to_chars(p, p + 400, v, chars_format,
+                    6).ptr - p);
+            flush_if_full();
+        });
+#endif
+        report(name, r, s, t);
+    }
+
+    // A reckless::decimal with eight decimals, against the double that the
+    // program would otherwise have converted it to.
+    void scaled(char const* name, std::vector<std::uint64_t> const& values)
+    {
+        reckless::conversion_specification cs;
+        double r = nanoseconds_per_call(iterations_, values, [&](std::uint64_t v) {
+            reckless::itoa_base10_scaled(&buffer_,
+                    static_cast<std::int64_t>(v), 8, cs);
+            flush_if_full();
+        });
+        cs.precision = 8;
+        double f = nanoseconds_per_call(iterations_, values, [&](std::uint64_t v) {
+            reckless::ftoa_base10_f(&buffer_, v*1e-8, cs);
+            flush_if_full();
+        });
+        double s = nanoseconds_per_call(iterations_, values, [&](std::uint64_t v) {
+            write_snprintf("%.8f", v*1e-8);
+        });
+        report(name, r, s, -1);
+        report("  (as double, %.8f)", f, s, -1);
+    }
+
+    // Arrays of 16 numbers separated by ", ", as reckless::elements() logs
+    // them with %d.
+    template <class T>
+    void array(char const* name, std::vector<T> const& values)
+    {
+        std::size_t const ARRAY_SIZE = 16;
+        unsigned arrays = iterations_/ARRAY_SIZE;
+        std::vector<std::size_t> offsets(VALUE_COUNT);
+        for(std::size_t i=0; i!=VALUE_COUNT; ++i)
+            offsets[i] = (i*ARRAY_SIZE) & (VALUE_COUNT-1);
+        reckless::conversion_specification cs;
+        double r = nanoseconds_per_call(arrays, offsets, [&](std::size_t i) {
+            reckless::itoa_base10_array(&buffer_, &values[i], ARRAY_SIZE,
+                    ", ", cs);
+            flush_if_full();
+        });
+        double e = nanoseconds_per_call(arrays, offsets, [&](std::size_t i) {
+            for(std::size_t j=0; j!=ARRAY_SIZE; ++j) {
+                if(j != 0)
+                    buffer_.write(", ", 2);
+                reckless::itoa_base10(&buffer_, values[i + j], cs);
+            }
+            flush_if_full();
+        });
+        bool is_signed = std::is_signed<T>::value;
+        double s = nanoseconds_per_call(arrays, offsets, [&](std::size_t i) {
+            for(std::size_t j=0; j!=ARRAY_SIZE; ++j) {
+                if(is_signed)
+                    write_snprintf(j == 0? "%lld" : ", %lld",
+                            static_cast<long long>(values[i + j]));
+                else
+                    write_snprintf(j == 0? "%llu" : ", %llu",
+                            static_cast<unsigned long long>(values[i + j]));
+            }
+        });
+        double t = -1;
+#ifdef HAVE_TO_CHARS
+        t = nanoseconds_per_call(arrays, offsets, [&](std::size_t i) {
+            char* p = buffer_.reserve(ARRAY_SIZE*24);
+            char* end = p;
+            for(std::size_t j=0; j!=ARRAY_SIZE; ++j) {
+                if(j != 0) {
+                    *end++ = ',';
+                    *end++ = ' ';
+                }
+                end = std::to_chars(end, end + 22, values[i + j]).ptr;
+            }
+            buffer_.commit(end - p);
+            flush_if_full();
+        });
+        t /= ARRAY_SIZE;
+#endif
+        report(name, r/ARRAY_SIZE, s/ARRAY_SIZE, t);
+        report("  (one call each)", e/ARRAY_SIZE, s/ARRAY_SIZE, t);
+    }
+
+    // The shortest digits that read back as the same number.
+    void shortest(char const* name, std::vector<double> const& values)
+    {
+        reckless::conversion_specification cs;
+        double r = nanoseconds_per_call(iterations_, values, [&](double v) {
+            reckless::ftoa_base10_shortest(&buffer_, v, cs);
+            flush_if_full();
+        });
+        double s = nanoseconds_per_call(iterations_, values, [&](double v) {
+            write_snprintf("%.17g", v);
+        });
+        double t = -1;
+#if defined(HAVE_TO_CHARS) && defined(__cpp_lib_to_chars)
+        t = nanoseconds_per_call(iterations_, values, [&](double v) {
+            char* p = buffer_.reserve(32);
+            buffer_.commit(std::to_chars(p, p + 32, v).ptr - p);
+            flush_if_full();
+        });
+#endif
+        report(name, r, s, t);
+    }
+
+private:
+    template <class T>
+    void write_snprintf(char const* format, T v)
+    {
+        char* p = buffer_.reserve(400);
+        buffer_.commit(std::snprintf(p, 400, format, v));
+        flush_if_full();
+    }
+
+    // We don't want to measure the flush, so we do it rarely rather than
+    // letting reserve() do it when the buffer runs full.
+    void flush_if_full()
+    {
+        if(++calls_ % 64 == 0)
+            buffer_.flush();
+    }
+
+    unsigned iterations_;
+    null_writer writer_;
+    reckless::output_buffer buffer_;
+    unsigned calls_ = 0;
+};
+
+}   // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned iterations = argc > 1? std::atoi(argv[1]) : 5000000;
+    std::mt19937_64 rng(1);
+    benchmark b(iterations);
+
+    std::cout << std::left << std::setw(24) << "case" << std::right
+        << std::setw(10) << "reckless" << std::setw(10) << "snprintf"
+        << std::setw(10) << "to_chars" << std::endl;
+
+    auto small = uniform_values<int>(rng, 0, 999);
+    auto negative = uniform_values<int>(rng, -100000, -1);
+    auto uint32 = uniform_values<std::uint32_t>(rng, 0, 0xffffffffu);
+    auto uint64 = uniform_values<std::uint64_t>(rng, 0, ~std::uint64_t(0));
+    auto mixed = mixed_length_values(rng, 19);
+
+    b.decimal("%d 0-999", small, false);
+    b.decimal("%d negative", negative, false);
+    b.decimal("%u uniform 32-bit", uint32, false);
+    b.decimal("%llu uniform 64-bit", uint64, false);
+    b.decimal("%llu 1-19 digits", mixed, false);
+    b.decimal("%08d 0-999", small, true);
+    b.decimal("%08u uniform 32-bit", uint32, true);
+    b.hexadecimal("%x uniform 32-bit", uint32);
+    b.hexadecimal("%llx uniform 64-bit", uint64);
+    b.hexadecimal("%llx 1-19 digits", mixed);
+    b.scaled("decimal 1-16 digits", mixed_length_values(rng, 16));
+    b.array("array %d 0-999", small);
+    b.array("array %llu 1-19 digits", mixed);
+
+    std::vector<double> fractions(VALUE_COUNT);
+    std::vector<double> large(VALUE_COUNT);
+    std::vector<double> wide(VALUE_COUNT);
+    std::uniform_real_distribution<double> fraction_distribution(0, 1);
+    std::uniform_real_distribution<double> large_distribution(0, 1e6);
+    std::uniform_real_distribution<double> exponent_distribution(-30, 30);
+    for(std::size_t i=0; i!=VALUE_COUNT; ++i) {
+        fractions[i] = fraction_distribution(rng);
+        large[i] = large_distribution(rng);
+        wide[i] = std::pow(10.0, exponent_distribution(rng));
+    }
+    b.floating("%f 0-1", fractions, 'f');
+    b.floating("%f 0-1e6", large, 'f');
+    b.floating("%e 1e-30-1e30", wide, 'e');
+    b.floating("%g 1e-30-1e30", wide, 'g');
+    b.shortest("shortest 0-1", fractions);
+    b.shortest("shortest 1e-30-1e30", wide);
+    return 0;
+}
@@ -5,7 +5,7 @@ from getopt import gnu_getopt
 import os.path
 from math import pi, sqrt, exp
 
-ALL_LIBS = ['nop', 'reckless', 'stdio', 'fstream', 'pantheios', 'spdlog']
+ALL_LIBS = ['nop', 'reckless', 'reckless_tsc', 'stdio', 'fstream', 'pantheios', 'spdlog']
 ALL_TESTS = ['periodic_calls', 'call_burst', 'write_files'] #, 'mandelbrot']
 
 THREADED_TESTS = {'call_burst', 'mandelbrot'}
@@ -18,6 +18,7 @@ COLORS = [
     '#e7298a',
     '#66a61e',
     '#e6ab02',
+    '#a6761d',
 ]
 
 def get_default_window(test):
@@ -36,6 +37,7 @@ def pretty_name(name):
             'stdio': 'fprintf (C)',
             'fstream': 'std::fstream (C++)',
             'reckless': 'reckless',
+            'reckless_tsc': 'reckless (TSC timestamps)',
             'periodic_calls': 'periodic calls',
             'call_burst': 'single call burst',
             'write_files': 'heavy disk I/O',
@@ -48,6 +50,7 @@ def lib_color(name):
     color_table = {
             'nop': COLORS[0],
             'reckless': COLORS[3],
+            'reckless_tsc': COLORS[6],
             'spdlog': COLORS[2],
             'stdio': COLORS[1],
             'fstream': COLORS[4],
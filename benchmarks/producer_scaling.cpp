@@ -0,0 +1,110 @@
+// Measures how the cost of a log call scales with the number of producer
+// threads for each of the shared input queue policies in reckless. The output
+// goes to a writer that discards everything, so that what we measure is the
+// hand-over between producers and the output thread rather than disk I/O.
+//
+// Usage: producer_scaling [max_threads [calls_per_thread]]
+#include <reckless/policy_log.hpp>
+#include <reckless/writer.hpp>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+namespace {
+
+class null_writer : public reckless::writer {
+public:
+    Result write(void const*, std::size_t) override
+    {
+        return SUCCESS;
+    }
+};
+
+struct policy_info {
+    reckless::shared_input_queue_policy policy;
+    char const* name;
+};
+
+policy_info const POLICIES[] = {
+    {reckless::shared_input_queue_policy::boost_lockfree, "boost_lockfree"},
+    {reckless::shared_input_queue_policy::mpsc_array, "mpsc_array"},
+    {reckless::shared_input_queue_policy::none, "none"}
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+// Returns the average number of nanoseconds per log call, over all threads.
+double run(reckless::shared_input_queue_policy policy, unsigned thread_count,
+        unsigned calls_per_thread)
+{
+    null_writer writer;
+    reckless::log_options options;
+    options.shared_input_queue = policy;
+    reckless::policy_log<> log(&writer, 0, 0, 0, options);
+
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<double> thread_ns(thread_count);
+    std::vector<std::thread> threads;
+    for(unsigned t=0; t!=thread_count; ++t) {
+        threads.emplace_back([&, t]()
+        {
+            // Make sure the thread's input buffer exists before we start the
+            // clock, and line all threads up so they run concurrently.
+            log.write("thread %u starting", t);
+            ++ready;
+            while(not go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            auto start = clock_type::now();
+            for(unsigned i=0; i!=calls_per_thread; ++i)
+                log.write("thread %u: %u %f", t, i, 3.1415);
+            auto stop = clock_type::now();
+            thread_ns[t] = static_cast<double>(std::chrono::duration_cast<
+                std::chrono::nanoseconds>(stop - start).count());
+        });
+    }
+    while(ready.load() != thread_count)
+        std::this_thread::yield();
+    go.store(true, std::memory_order_release);
+    for(auto& thread : threads)
+        thread.join();
+    log.close();
+
+    double total_ns = 0;
+    for(double ns : thread_ns)
+        total_ns += ns;
+    return total_ns / (static_cast<double>(thread_count)*calls_per_thread);
+}
+
+}   // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned max_threads = std::thread::hardware_concurrency();
+    unsigned calls_per_thread = 1000000;
+    if(argc > 1)
+        max_threads = static_cast<unsigned>(std::atoi(argv[1]));
+    if(argc > 2)
+        calls_per_thread = static_cast<unsigned>(std::atoi(argv[2]));
+    if(max_threads == 0)
+        max_threads = 1;
+
+    std::cout << std::setw(16) << std::left << "policy"
+        << std::setw(8) << std::right << "threads"
+        << std::setw(12) << "ns/call" << std::endl;
+    for(policy_info const& info : POLICIES) {
+        for(unsigned threads=1; threads<=max_threads; threads *= 2) {
+            double ns = run(info.policy, threads, calls_per_thread);
+            std::cout << std::setw(16) << std::left << info.name
+                << std::setw(8) << std::right << threads
+                << std::setw(12) << std::fixed << std::setprecision(1) << ns
+                << std::endl;
+        }
+    }
+    return 0;
+}
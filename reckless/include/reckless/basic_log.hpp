@@ -1,16 +1,30 @@
 #ifndef RECKLESS_BASIC_LOG_HPP
 #define RECKLESS_BASIC_LOG_HPP
 
+#include "reckless/log_options.hpp"
+#include "reckless/log_stats.hpp"
+#include "reckless/latency_histogram.hpp"
+#include "reckless/flush_ticket.hpp"
+#include "reckless/frame_string.hpp"
 #include "reckless/detail/thread_input_buffer.hpp"
+#include "reckless/detail/shared_input_queue.hpp"
 #include "reckless/detail/spsc_event.hpp"
+#include "reckless/detail/latency_recorder.hpp"
+#include "reckless/detail/spill_writer.hpp"
 #include "reckless/detail/branch_hints.hpp" // likely
 #include "reckless/output_buffer.hpp"
 
-#include <boost/lockfree/queue.hpp>
-
 #include <thread>
+#include <algorithm>    // max
 #include <functional>
 #include <tuple>
+#include <atomic>
+#include <chrono>
+#include <cstring>      // memcpy
+#include <exception>    // exception_ptr
+#include <memory>       // unique_ptr
+#include <mutex>
+#include <vector>
 
 #include <pthread.h>    // pthread_key_t
 
@@ -18,6 +32,10 @@ namespace reckless {
 namespace detail {
     template <class Formatter, typename... Args>
     std::size_t formatter_dispatch(output_buffer* poutput, char* pinput);
+
+    // Maximum number of logs that get a fast thread-local lookup of their
+    // input buffer. Any logs beyond that fall back to pthread_getspecific.
+    unsigned const THREAD_INPUT_BUFFER_CACHE_SIZE = 16;
 }
 
 // TODO generic_log better name?
@@ -29,7 +47,8 @@ public:
     basic_log(writer* pwriter, 
             std::size_t output_buffer_max_capacity = 0,
             std::size_t shared_input_queue_size = 0,
-            std::size_t thread_input_buffer_size = 0);
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options());
     virtual ~basic_log();
     
     basic_log(basic_log const&) = delete;
@@ -38,74 +57,352 @@ public:
     virtual void open(writer* pwriter, 
             std::size_t output_buffer_max_capacity = 0,
             std::size_t shared_input_queue_size = 0,
-            std::size_t thread_input_buffer_size = 0);
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options());
     virtual void close();
 
+    // Blocks until everything that was committed to the log before the call,
+    // by any thread, has been passed to the writer.
+    void flush();
+    // Like flush(), but returns right away with a ticket that tells when the
+    // flush is done.
+    flush_ticket flush_async();
+    // Returns an eventfd that becomes readable each time a flush ticket is
+    // done, for use with poll() or epoll. The fd is created on the first
+    // call and belongs to the log; read it to reset it. Returns -1 on systems
+    // that don't have eventfd.
+    int flush_notification_fd();
+
     void panic_flush();
 
+    // Overrides log_options::overflow for the calling thread.
+    void set_thread_overflow_policy(overflow_policy policy)
+    {
+        get_input_buffer()->set_overflow_policy(policy);
+    }
+
+    // Gives the calling thread an input buffer of the given size instead of
+    // the thread_input_buffer_size that was passed to open(). With elastic
+    // buffers (see log_options::max_thread_input_buffer_size) this is also
+    // the size that the buffer shrinks back to after a burst.
+    void set_thread_input_buffer_size(std::size_t size);
+
+    // Sets up the calling thread's input buffer ahead of time, so that the
+    // first log call from the thread doesn't have to. The buffer is allocated
+    // on the thread's NUMA node if log_options::numa_local_input_buffers is
+    // set, and prefaulted regardless of log_options::prefault_buffers. Does
+    // nothing if the thread already has a buffer.
+    void register_thread();
+
+    // Returns a snapshot of the log's counters. This takes a lock that
+    // threads only need when they start, exit or switch input buffers, so it
+    // is fine to call it periodically.
+    log_stats stats();
+
+    // Returns the latency histograms recorded since the log was constructed,
+    // if log_options::measure_latency is set. Otherwise the histograms are
+    // empty.
+    latency_stats latency();
+
 protected:
+    // How willing we are to throw away a frame when the input buffer is full;
+    // see overflow_policy.
+    enum class frame_priority {
+        normal,
+        low
+    };
+
+    // Formats the line that tells the reader how many messages were dropped
+    // due to the overflow policy. Called from the output thread.
+    typedef void dropped_notice_formatter_t(output_buffer* poutput,
+            unsigned long count);
+
     template <class Formatter, typename... Args>
     void write(Args&&... args)
+    {
+        auto pbuffer = get_input_buffer();
+        if(detail::likely(write_frame<Formatter>(pbuffer, frame_priority::normal,
+                    std::forward<Args>(args)...)))
+            commit(pbuffer);
+    }
+
+    // Puts a frame in the input buffer without making it visible to the
+    // output thread. A derived class can use this together with
+    // get_input_buffer() and commit() to write several frames at the cost of
+    // a single TLS lookup and a single push on the shared input queue. The
+    // frames will then be formatted back-to-back in the output, as long as
+    // they all fit in the thread's input buffer at the same time.
+    //
+    // Returns false if the frame was dropped because of the overflow policy.
+    //
+    // The input buffer may be swapped for a larger one if it runs out of
+    // space, in which case pbuffer is updated.
+    template <class Formatter, typename... Args>
+    bool write_frame(detail::thread_input_buffer*& pbuffer,
+            frame_priority priority, Args&&... args)
     {
         using namespace detail;
-        typedef std::tuple<typename std::decay<Args>::type...> args_t;
+        typedef std::tuple<typename frame_argument<
+            typename std::decay<Args>::type>::type...> args_t;
         std::size_t const args_align = alignof(args_t);
         std::size_t const args_offset = (sizeof(formatter_dispatch_function_t*) + args_align-1)/args_align*args_align;
-        std::size_t const frame_size = args_offset + sizeof(args_t);
+        std::size_t const fixed_frame_size = args_offset + sizeof(args_t);
+        // String arguments are copied to the end of the frame (see
+        // frame_string.hpp), unless they are so large that the frame might
+        // not fit in the input buffer.
+        std::size_t inline_size = sum_sizes(frame_argument<
+                typename std::decay<Args>::type>::inline_size(args)...);
+        if(inline_size != 0 and unlikely(fixed_frame_size + inline_size
+                    > max_inline_frame_size(pbuffer)))
+        {
+            inline_size = 0;
+        }
+        std::size_t const frame_size = fixed_frame_size + inline_size;
 
-        auto pbuffer = get_input_buffer();
-        char* pframe = pbuffer->allocate_input_frame(frame_size);
+        std::int64_t timestamp = 0;
+        if(unlikely(measure_latency_))
+            timestamp = latency_timestamp();
+
+        char* pframe = pbuffer->try_allocate_input_frame(frame_size);
+        if(unlikely(pframe == nullptr)) {
+            pframe = allocate_input_frame_slow(pbuffer, frame_size, priority);
+            if(pframe == nullptr)
+                return false;
+        }
         *reinterpret_cast<formatter_dispatch_function_t**>(pframe) =
-            &detail::formatter_dispatch<Formatter, typename std::decay<Args>::type...>;
+            &detail::formatter_dispatch<Formatter, typename frame_argument<
+                typename std::decay<Args>::type>::type...>;
 
         // FIXME exception safety when copy constructing arguments, both here
         // and in the output thread.
-        new (pframe + args_offset) args_t(std::forward<Args>(args)...);
-
-        // TODO ideally queue_commit_extent would be called in a separate
-        // commit() or flush() function, but then we have to call
-        // get_input_buffer() twice which bloats the code at the call site. But
-        // if we make get_input_buffer() protected (i.e. move
-        // thread_input_buffer from the detail namespace) then we can delegate
-        // the call to get_input_buffer to the derived class, which could then
-        // call write multiple times followed by commit() if it wants to
-        // without having to fetch the TLS variable every time.
-        queue_commit_extent({pbuffer, pbuffer->input_end()});
+        char* ptail = inline_size != 0? pframe + fixed_frame_size : nullptr;
+        new (pframe + args_offset) args_t{frame_argument<
+            typename std::decay<Args>::type>::capture(ptail,
+                    std::forward<Args>(args))...};
+        pbuffer->count_enqueued_frame();
+        if(unlikely(timestamp != 0))
+            write_latency_marker(pbuffer, timestamp);
+        return true;
+    }
+
+    // Hands over all frames written so far by this thread to the output
+    // thread. With overflow_policy::drop_newest this doesn't wait if the
+    // shared input queue is full; the frames are then handed over by a later
+    // commit instead.
+    void commit(detail::thread_input_buffer* pbuffer)
+    {
+        commit(pbuffer, pbuffer->get_overflow_policy() != overflow_policy::drop_newest);
+    }
+
+    void set_dropped_notice_formatter(dropped_notice_formatter_t* pformatter)
+    {
+        pdropped_notice_formatter_.store(pformatter, std::memory_order_relaxed);
+    }
+
+    bool is_open()
+    {
+        return output_thread_.joinable();
     }
 
-private:
-    void output_worker();
-    void queue_commit_extent(detail::commit_extent const& ce);
-    char* allocate_input_frame(std::size_t frame_size);
-    void reset_shared_input_queue(std::size_t node_count);
     detail::thread_input_buffer* get_input_buffer()
     {
-        detail::thread_input_buffer* p = static_cast<detail::thread_input_buffer*>(pthread_getspecific(thread_input_buffer_key_));
-        if(detail::likely(p != nullptr)) {
+        // We keep the buffer in a pthread key so that we get a callback when
+        // the thread exits, but pthread_getspecific is an out-of-line call.
+        // So we also cache the pointer in a thread-local array, with a slot
+        // for each log. A log that didn't get a slot has generation 0, which
+        // always finds a null pointer and takes the slow path.
+        thread_input_buffer_cache_entry const& entry =
+            thread_input_buffer_cache_[thread_input_buffer_cache_slot_];
+        detail::thread_input_buffer* p = entry.pbuffer;
+        if(detail::likely(entry.generation == thread_input_buffer_cache_generation_
+                    and p != nullptr and not p->is_shrink_requested()))
+        {
             return p;
         } else {
-            return init_input_buffer();
+            return get_input_buffer_slow();
         }
     }
-    detail::thread_input_buffer* init_input_buffer();
-    void on_panic_flush_done();
-    bool is_open()
+
+private:
+    // Needs to commit a partially written batch when it runs out of space.
+    friend class detail::thread_input_buffer;
+
+    void output_worker(log_options const* poptions);
+    void configure_output_thread(log_options const& options);
+    void wait_for_input(detail::commit_extent& ce);
+    void park_output_worker(unsigned milliseconds);
+    bool commit(detail::thread_input_buffer* pbuffer, bool block)
     {
-        return output_thread_.joinable();
+        if(detail::unlikely(not queue_commit_extent({pbuffer, pbuffer->input_end()}, block)))
+            return false;
+        pbuffer->mark_committed();
+        return true;
+    }
+    bool queue_commit_extent(detail::commit_extent const& ce, bool block = true);
+    void on_input_frame_dropped()
+    {
+        input_frames_dropped_.store(true, std::memory_order_release);
     }
+    void report_dropped_input_frames();
 
-    typedef boost::lockfree::queue<detail::commit_extent, boost::lockfree::fixed_sized<true>> shared_input_queue_t;
+    // With measure_latency, each frame is followed by a marker frame that
+    // holds the time of the log call. The output thread recognizes the
+    // marker by its dispatch function; the function itself is never called.
+    static std::size_t const LATENCY_MARKER_FRAME_SIZE =
+        sizeof(detail::formatter_dispatch_function_t*) + sizeof(std::int64_t);
+    static std::size_t latency_marker_dispatch(output_buffer*, char*);
+    static std::int64_t latency_timestamp();
+    void write_latency_marker(detail::thread_input_buffer* pbuffer,
+            std::int64_t timestamp)
+    {
+        // We don't wait for room just to get a sample.
+        char* pframe = pbuffer->try_allocate_input_frame(LATENCY_MARKER_FRAME_SIZE);
+        if(pframe == nullptr)
+            return;
+        *reinterpret_cast<detail::formatter_dispatch_function_t**>(pframe) =
+            &latency_marker_dispatch;
+        std::memcpy(pframe + sizeof(detail::formatter_dispatch_function_t*),
+                &timestamp, sizeof(timestamp));
+    }
+    void record_format_latency(char* pframe);
+    void record_write_latency();
+    // flush_async() puts a marker frame in the calling thread's input buffer
+    // that holds a reference to the flush request. Like the latency marker,
+    // its dispatch function is never called.
+    static std::size_t const FLUSH_MARKER_FRAME_SIZE =
+        sizeof(detail::formatter_dispatch_function_t*)
+        + sizeof(std::shared_ptr<detail::flush_request>);
+    static std::size_t flush_marker_dispatch(output_buffer*, char*);
+    void on_flush_marker(detail::thread_input_buffer* pbuffer, char* pframe);
+    void complete_flush_requests();
+    char* allocate_input_frame_slow(detail::thread_input_buffer*& pbuffer,
+            std::size_t frame_size, frame_priority priority);
+    detail::thread_input_buffer* get_input_buffer_slow();
+    void set_thread_input_buffer(detail::thread_input_buffer* p);
+    void allocate_thread_input_buffer_cache_slot();
+    void free_thread_input_buffer_cache_slot();
+    detail::thread_input_buffer* create_input_buffer(std::size_t size,
+            bool prefault = false);
+    detail::thread_input_buffer* take_pooled_input_buffer(std::size_t size);
+    void free_input_buffer(detail::thread_input_buffer* pbuffer);
+    void release_input_buffer(detail::thread_input_buffer* pbuffer);
+    void free_all_input_buffers();
+    bool reserve_input_buffer_memory(std::size_t size);
+    void replace_input_buffer(detail::thread_input_buffer* pold,
+            detail::thread_input_buffer* pnew);
+    void sweep_input_buffers(bool check_idle);
+    void maintain_input_buffers();
+    bool elastic_input_buffers() const
+    {
+        return max_thread_input_buffer_size_ > thread_input_buffer_size_;
+    }
+    // Frames with captured strings are kept to half the size that the input
+    // buffer can grow to, so that a single message can't monopolize the
+    // buffer. Strings in larger frames are copied to the heap instead.
+    std::size_t max_inline_frame_size(detail::thread_input_buffer* pbuffer) const
+    {
+        return std::max(pbuffer->size(), max_thread_input_buffer_size_)/2;
+    }
+    static void format_dropped_notice(output_buffer* poutput, unsigned long count);
+    detail::thread_input_buffer* init_input_buffer(std::size_t size,
+            bool prefault = false);
+    static void destroy_input_buffer(void* p);
+    void on_panic_flush_done();
 
     //typedef detail::thread_object<detail::thread_input_buffer, std::size_t, std::size_t> thread_input_buffer_t;
     //thread_input_buffer_t pthread_input_buffer_;
     
-    shared_input_queue_t shared_input_queue_;
+    detail::shared_input_queue shared_input_queue_;
+    idle_policy idle_policy_;
+    unsigned idle_spin_count_;
+    unsigned idle_yield_count_;
+    // Set by the output thread while it is asleep on
+    // shared_input_queue_full_event_, so that producers know to wake it up
+    // after committing.
+    std::atomic<bool> output_worker_parked_;
+    overflow_policy overflow_policy_;
+    // Set when a thread drops a frame, cleared by the output thread when it
+    // has reported the drop.
+    std::atomic<bool> input_frames_dropped_;
+    // Drops by threads that exited before the output thread reported them.
+    std::atomic<unsigned long> orphaned_dropped_count_;
+    std::atomic<dropped_notice_formatter_t*> pdropped_notice_formatter_;
     spsc_event shared_input_queue_full_event_;
     spsc_event shared_input_consumed_event_;
     pthread_key_t thread_input_buffer_key_;
+
+    struct thread_input_buffer_cache_entry {
+        detail::thread_input_buffer* pbuffer;
+        // Slots are reused when logs are destroyed, so each log that gets a
+        // slot also gets a unique generation number. An entry left behind by
+        // an earlier log with the same slot won't match.
+        unsigned long generation;
+    };
+    static __thread thread_input_buffer_cache_entry
+        thread_input_buffer_cache_[detail::THREAD_INPUT_BUFFER_CACHE_SIZE];
+    unsigned thread_input_buffer_cache_slot_;
+    unsigned long thread_input_buffer_cache_generation_;
+
     std::size_t thread_input_buffer_size_;
+    std::size_t max_thread_input_buffer_size_;
+    std::size_t input_buffer_memory_budget_;
+    unsigned input_buffer_shrink_delay_ms_;
+    detail::buffer_memory_options buffer_memory_options_;
+    // Total size of all input buffers, including retired ones that the output
+    // thread hasn't freed yet.
+    std::atomic<std::size_t> input_buffer_memory_;
+    // Set when a thread retires an input buffer, so the output thread knows
+    // to look for buffers to free.
+    std::atomic<bool> input_buffers_retired_;
+    // When the output thread last checked for idle buffers to shrink.
+    std::chrono::steady_clock::time_point last_idle_sweep_;
+    // Drained buffers of the default size, waiting to be handed to new
+    // threads. They still count toward input_buffer_memory_.
+    std::size_t input_buffer_pool_size_;
+    std::mutex input_buffer_pool_mutex_;
+    std::vector<detail::thread_input_buffer*> input_buffer_pool_;
+    // Counters for stats(). Those in thread input buffers are added to
+    // exited_producer_stats_ when the buffers are freed.
+    std::mutex stats_mutex_;
+    producer_stats exited_producer_stats_;
+    std::atomic<std::uint64_t> frames_formatted_;
+    // Output thread time, in steady_clock nanoseconds. The start time is 0
+    // while the thread isn't running, and the idle start time is 0 while it
+    // isn't waiting for input. Time from earlier runs (before the log was
+    // reopened) is in output_thread_run_ns_.
+    std::atomic<std::int64_t> output_thread_start_ns_;
+    std::atomic<std::uint64_t> output_thread_run_ns_;
+    std::atomic<std::int64_t> output_thread_idle_since_ns_;
+    std::atomic<std::uint64_t> output_thread_idle_ns_;
+    // Latency measurement. The histograms are only allocated the first time
+    // the log is opened with measure_latency, since they are fairly large.
+    bool measure_latency_;
+    std::unique_ptr<detail::latency_recorder> penqueue_to_format_latency_;
+    std::unique_ptr<detail::latency_recorder> penqueue_to_write_latency_;
+    // Timestamps of formatted entries that haven't been written yet, and the
+    // number of writer calls when we last checked. Only used by the output
+    // thread.
+    std::vector<std::int64_t> unwritten_timestamps_;
+    std::uint64_t last_write_calls_;
+    // Flush requests that the output thread has seen but not completed yet.
+    // With shared_input_queue_policy::none, a request can't complete until
+    // every buffer that held committed input when the request was seen has
+    // been drained; those buffers are in flush_barrier_buffers_. With a
+    // shared queue, everything committed earlier is ahead of the marker in
+    // the queue, so the barrier is always empty.
+    std::vector<std::shared_ptr<detail::flush_request>> pending_flush_requests_;
+    std::vector<detail::thread_input_buffer*> flush_barrier_buffers_;
+    std::mutex flush_notification_fd_mutex_;
+    std::atomic<int> flush_notification_fd_;
+    // Sits between output_buffer_ and the writer if log_options::spill_file
+    // is set.
+    detail::spill_writer spill_writer_;
     output_buffer output_buffer_;
     std::thread output_thread_;
+    // Signaled by the output thread once it has applied the output thread
+    // settings from log_options, or failed to.
+    spsc_event output_thread_started_event_;
+    std::exception_ptr output_thread_start_error_;
     spsc_event panic_flush_done_event_;
     bool panic_flush_;
 };
@@ -114,7 +411,7 @@ namespace detail {
 template <class Formatter, typename... Args, std::size_t... Indexes>
 void call_formatter(output_buffer* poutput, std::tuple<Args...>& args, index_sequence<Indexes...>)
 {
-    Formatter::format(poutput, std::move(std::get<Indexes>(args))...);
+    Formatter::format(poutput, frame_value(std::get<Indexes>(args))...);
 }
 
 template <class Formatter, typename... Args>
@@ -124,10 +421,12 @@ std::size_t formatter_dispatch(output_buffer* poutput, char* pinput)
     typedef std::tuple<Args...> args_t;
     std::size_t const args_align = alignof(args_t);
     std::size_t const args_offset = (sizeof(formatter_dispatch_function_t*) + args_align-1)/args_align*args_align;
-    std::size_t const frame_size = args_offset + sizeof(args_t);
     args_t& args = *reinterpret_cast<args_t*>(pinput + args_offset);
 
     typename make_index_sequence<sizeof...(Args)>::type indexes;
+    // Strings captured in the frame come after the tuple.
+    std::size_t const frame_size = args_offset + sizeof(args_t)
+        + captured_size(args, indexes);
     call_formatter<Formatter>(poutput, args, indexes);
 
     args.~args_t();
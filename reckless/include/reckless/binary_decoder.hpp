@@ -0,0 +1,93 @@
+#ifndef RECKLESS_BINARY_DECODER_HPP
+#define RECKLESS_BINARY_DECODER_HPP
+
+#include <reckless/output_buffer.hpp>
+
+#include <cstddef>      // size_t
+#include <cstdint>      // uint64_t, int64_t
+#include <stdexcept>    // runtime_error
+#include <string>
+#include <vector>
+
+namespace reckless {
+
+// Thrown by binary_decoder when the input is not a valid binary log.
+class binary_decode_error : public std::runtime_error {
+public:
+    binary_decode_error(char const* what, std::size_t offset) :
+        std::runtime_error(what),
+        offset_(offset)
+    {
+    }
+
+    // Where the bad record starts, relative to the input that was passed to
+    // decode().
+    std::size_t offset() const
+    {
+        return offset_;
+    }
+
+private:
+    std::size_t offset_;
+};
+
+// Turns the output of binary_log back into text, exactly as policy_log with
+// the same header fields would have formatted it. The input can be fed in
+// chunks of any size.
+class binary_decoder {
+public:
+    explicit binary_decoder(output_buffer* poutput);
+
+    // Writes the text for all complete records at the start of the input to
+    // the output buffer, and returns the number of bytes they took up. Pass
+    // the rest of the input again, with more data appended, in the next
+    // call. Throws binary_decode_error if the input is corrupt.
+    std::size_t decode(char const* pinput, std::size_t size);
+
+    // After an error, returns how many bytes to skip to get to the next
+    // stream header, which is where binary_log starts over after it has lost
+    // output. If there is no stream header in the input, returns as many
+    // bytes as can be skipped without missing one that starts at the end.
+    // decode() can then continue from the header.
+    std::size_t find_stream_header(char const* pinput, std::size_t size);
+
+private:
+    struct definition {
+        std::string format;
+        std::string signature;
+    };
+    struct argument {
+        union {
+            std::uint64_t u;
+            std::int64_t i;
+            float f;
+            double d;
+            long double ld;
+        };
+        // For decimals, which keep their mantissa in i.
+        std::uint64_t scale;
+        std::string s;
+    };
+    class reader;
+
+    bool decode_record(reader& r);
+    bool read_stream_header(reader& r);
+    bool read_definition(reader& r);
+    bool read_fields(reader& r);
+    bool read_arguments(reader& r, std::string const& signature);
+    void write_fields();
+    void write_arguments(definition const& def);
+
+    output_buffer* poutput_;
+    bool in_stream_;
+    char separator_;
+    std::string field_codes_;
+    std::vector<definition> definitions_;
+    // Scratch space for the record that is being decoded.
+    std::vector<argument> fields_;
+    std::vector<argument> arguments_;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_BINARY_DECODER_HPP
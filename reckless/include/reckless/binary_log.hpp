@@ -0,0 +1,154 @@
+#ifndef RECKLESS_BINARY_LOG_HPP
+#define RECKLESS_BINARY_LOG_HPP
+
+#include <reckless/basic_log.hpp>
+#include <reckless/policy_log.hpp>          // timestamp_field
+#include <reckless/template_formatter.hpp>
+#include <reckless/detail/binary_encoding.hpp>
+
+#include <stdexcept>    // runtime_error
+#include <string>
+#include <type_traits>  // integral_constant, decay
+#include <utility>      // forward
+
+namespace reckless {
+
+template <char Separator, class... Fields>
+class binary_formatter {
+public:
+    template <typename... Args>
+    static void format(output_buffer* pbuffer, detail::binary_encoder* pencoder,
+        Fields&&... fields, char const* pformat, Args&&... args)
+    {
+        typedef detail::binary_signature<typename std::decay<Args>::type...>
+            signature;
+        pencoder->write_message_id(pbuffer, pformat, signature::value());
+        detail::encode_binary_fields(pbuffer, fields...);
+        encode_arguments(std::integral_constant<bool, signature::preformatted>(),
+                pbuffer, pencoder, pformat, std::forward<Args>(args)...);
+    }
+
+    static void format_dropped_notice(output_buffer* pbuffer,
+            unsigned long count)
+    {
+        detail::write_varint(pbuffer, detail::BINARY_RECORD_DROPPED_NOTICE);
+        detail::encode_binary_fields(pbuffer, Fields()...);
+        detail::write_varint(pbuffer, count);
+    }
+
+private:
+    template <typename... Args>
+    static void encode_arguments(std::false_type, output_buffer* pbuffer,
+            detail::binary_encoder*, char const*, Args&&... args)
+    {
+        detail::encode_binary_arguments(pbuffer, args...);
+    }
+
+    // Some argument has no binary encoding, e.g. a user-defined type with its
+    // own format() function. We don't know how to reconstruct the value in
+    // the decoder, so we format the message as text right away.
+    template <typename... Args>
+    static void encode_arguments(std::true_type, output_buffer* pbuffer,
+            detail::binary_encoder* pencoder, char const* pformat,
+            Args&&... args)
+    {
+        template_formatter::format(pencoder->begin_text(), pformat,
+                std::forward<Args>(args)...);
+        pencoder->end_text(pbuffer);
+    }
+};
+
+// Like policy_log, but the output thread writes a compact binary encoding of
+// each message instead of formatting it as text. Format strings and argument
+// types are written once per call site, and after that a message is just a
+// message id followed by the header fields and the argument values. This
+// saves the output thread most of the formatting work and makes the log file
+// a lot smaller. Use binary_decoder, or the reckless-decode tool that is
+// built on it, to turn the file into the same text that policy_log would have
+// written.
+//
+// Arguments of the built-in integer, character and floating-point types,
+// strings and pointers are encoded in binary. Messages with arguments of any
+// other type are formatted as text by the output thread and stored as such.
+// The header fields must have a binary encoding; timestamp_field and
+// tsc_timestamp_field are supported.
+//
+// Each time the log is opened it writes a stream header, so it is fine to
+// append to an existing file. If the writer fails and output is lost, the log
+// starts a new stream after the gap, so that the decoder can skip ahead to it
+// (see binary_decoder::find_stream_header).
+//
+// The decoder works on copies of string arguments, so "%p" with a char
+// const* argument prints the address of the copy rather than the original.
+template <char FieldSeparator = ' ', class... HeaderFields>
+class binary_log : public basic_log {
+public:
+    binary_log()
+    {
+        set_dropped_notice_formatter(&formatter::format_dropped_notice);
+    }
+
+    binary_log(writer* pwriter,
+            std::size_t output_buffer_max_capacity = 0,
+            std::size_t shared_input_queue_size = 0,
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options())
+    {
+        set_dropped_notice_formatter(&formatter::format_dropped_notice);
+        open(pwriter, output_buffer_max_capacity, shared_input_queue_size,
+                thread_input_buffer_size, options);
+    }
+
+    ~binary_log()
+    {
+        // The output thread uses encoder_, so it has to stop before the
+        // encoder is destroyed.
+        if(is_open())
+            close();
+    }
+
+    // Throws std::runtime_error if the stream header can't be written.
+    void open(writer* pwriter,
+            std::size_t output_buffer_max_capacity = 0,
+            std::size_t shared_input_queue_size = 0,
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options()) override
+    {
+        char const* pfield_codes =
+            detail::binary_field_codes<HeaderFields...>::value;
+        encoder_.reset(FieldSeparator, pfield_codes);
+        std::string header = detail::binary_encoder::stream_header(
+                FieldSeparator, pfield_codes);
+        if(pwriter->write(header.data(), header.size()) != writer::SUCCESS)
+            throw std::runtime_error("unable to write binary log header");
+        basic_log::open(pwriter, output_buffer_max_capacity,
+                shared_input_queue_size, thread_input_buffer_size, options);
+    }
+
+    template <typename... Args>
+    void write(char const* fmt, Args&&... args)
+    {
+        basic_log::write<formatter>(
+                &encoder_,
+                HeaderFields()...,
+                fmt,
+                std::forward<Args>(args)...);
+    }
+    // The dictionary already makes sure that each call site is only parsed
+    // once (by the decoder), so a format_string is just a format string
+    // here.
+    template <typename... Args>
+    void write(format_string fmt, Args&&... args)
+    {
+        write(fmt.c_str(), std::forward<Args>(args)...);
+    }
+
+private:
+    typedef binary_formatter<FieldSeparator, HeaderFields...> formatter;
+
+    detail::binary_encoder encoder_;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_BINARY_LOG_HPP
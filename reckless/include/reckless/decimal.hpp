@@ -0,0 +1,45 @@
+#ifndef RECKLESS_DECIMAL_HPP
+#define RECKLESS_DECIMAL_HPP
+
+#include <cstdint>  // int64_t
+
+namespace reckless {
+
+// A fixed-point number mantissa*10^-scale, for prices, quantities and other
+// values that a program keeps as scaled integers. Logging one of these
+// instead of converting it to double is exact, and much cheaper: the log
+// stores the two integers as they are, and the output thread prints the
+// digits and puts a decimal point in them.
+//
+//     g_log.write("bid %s", reckless::decimal(price_e8, 8));
+//
+// "%s" prints all `scale` decimals, e.g. "-12.50000000". "%f" takes the usual
+// flags, field width and precision; without a precision it also prints all
+// the decimals rather than printf's six. With a lower precision the number
+// is rounded with ties away from zero, e.g. -123.455 with "%.2f" gives
+// "-123.46".
+class decimal {
+public:
+    decimal(std::int64_t mantissa, unsigned scale) :
+        mantissa_(mantissa),
+        scale_(scale)
+    {
+    }
+
+    std::int64_t mantissa() const
+    {
+        return mantissa_;
+    }
+    unsigned scale() const
+    {
+        return scale_;
+    }
+
+private:
+    std::int64_t mantissa_;
+    unsigned scale_;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_DECIMAL_HPP
@@ -0,0 +1,365 @@
+#ifndef RECKLESS_DETAIL_BINARY_ENCODING_HPP
+#define RECKLESS_DETAIL_BINARY_ENCODING_HPP
+
+#include "reckless/output_buffer.hpp"
+#include "reckless/writer.hpp"
+#include "reckless/frame_string.hpp"
+#include "reckless/decimal.hpp"
+#include "reckless/policy_log.hpp"    // timestamp_field
+#include "reckless/detail/branch_hints.hpp" // likely, unlikely
+
+#include <cstddef>  // size_t
+#include <cstdint>  // uint64_t, int64_t, uintptr_t
+#include <cstring>  // memcpy, strlen
+#include <functional>   // hash
+#include <string>
+#include <unordered_map>
+
+namespace reckless {
+namespace detail {
+
+// The binary log format written by binary_log and read by binary_decoder. A
+// stream is a sequence of records, each starting with a varint that says what
+// kind of record it is:
+//
+// * BINARY_RECORD_STREAM_HEADER: the magic bytes "reckless", a varint format
+//   version, the field separator, and a varint count followed by one type
+//   code for each header field. Every time a binary_log is opened it writes a
+//   new header, which also starts a new dictionary.
+// * BINARY_RECORD_DEFINITION: dictionary entry for a call site. A varint
+//   message id, then the format string and the type signature, both as a
+//   varint length followed by the bytes. The signature has one type code per
+//   argument, or is BINARY_PREFORMATTED_SIGNATURE if the message was
+//   formatted as text because some argument type has no binary encoding.
+// * BINARY_RECORD_DROPPED_NOTICE: the header fields followed by a varint
+//   count of dropped messages.
+// * Any larger number is a message id from an earlier definition, followed
+//   by the header fields and then the arguments, or the text as a varint
+//   length plus bytes for a preformatted message.
+//
+// Unsigned integers are varints (7 bits per byte, least significant group
+// first, high bit set on all bytes but the last), and signed integers are
+// zigzag-encoded varints. Floating-point numbers are raw bytes in host byte
+// order. Strings are a varint length followed by the bytes. A decimal is the
+// signed mantissa followed by the unsigned scale.
+enum binary_record_type : std::uint64_t {
+    BINARY_RECORD_STREAM_HEADER = 0,
+    BINARY_RECORD_DEFINITION = 1,
+    BINARY_RECORD_DROPPED_NOTICE = 2,
+    BINARY_RECORD_FIRST_MESSAGE_ID = 3
+};
+
+unsigned const BINARY_FORMAT_VERSION = 1;
+char const BINARY_MAGIC[] = "reckless";
+std::size_t const BINARY_MAGIC_SIZE = sizeof(BINARY_MAGIC) - 1;
+char const BINARY_PREFORMATTED_SIGNATURE[] = "*";
+std::size_t const MAX_VARINT_SIZE = 10;
+// Longest string we write. The decoder treats anything longer as a corrupt
+// length, rather than waiting for more input that will never come.
+std::size_t const MAX_BINARY_STRING_SIZE = 64*1024*1024;
+
+// Type codes for arguments. A type that isn't listed here makes the message
+// preformatted.
+template <class T> struct binary_type_code { static char const value = 0; };
+template <> struct binary_type_code<char> { static char const value = 'c'; };
+template <> struct binary_type_code<signed char> { static char const value = 'b'; };
+template <> struct binary_type_code<unsigned char> { static char const value = 'B'; };
+template <> struct binary_type_code<short> { static char const value = 's'; };
+template <> struct binary_type_code<unsigned short> { static char const value = 'S'; };
+template <> struct binary_type_code<int> { static char const value = 'i'; };
+template <> struct binary_type_code<unsigned int> { static char const value = 'I'; };
+template <> struct binary_type_code<long> { static char const value = 'l'; };
+template <> struct binary_type_code<unsigned long> { static char const value = 'L'; };
+template <> struct binary_type_code<long long> { static char const value = 'q'; };
+template <> struct binary_type_code<unsigned long long> { static char const value = 'Q'; };
+template <> struct binary_type_code<float> { static char const value = 'f'; };
+template <> struct binary_type_code<double> { static char const value = 'd'; };
+template <> struct binary_type_code<long double> { static char const value = 'D'; };
+template <> struct binary_type_code<decimal> { static char const value = 'x'; };
+template <> struct binary_type_code<char const*> { static char const value = 'z'; };
+template <> struct binary_type_code<char*> { static char const value = 'z'; };
+template <> struct binary_type_code<std::string> { static char const value = 'Z'; };
+template <> struct binary_type_code<frame_string> { static char const value = 'Z'; };
+template <> struct binary_type_code<void const*> { static char const value = 'p'; };
+template <> struct binary_type_code<void*> { static char const value = 'p'; };
+
+// Type codes for header fields. Unlike arguments, every header field needs
+// one, since the decoder has to know how to format it.
+template <class Field> struct binary_field_code {
+    static_assert(sizeof(Field) == 0, "header field has no binary encoding");
+};
+template <> struct binary_field_code<timestamp_field> { static char const value = 'T'; };
+// The decoder prints 'N' fields in local time with nine decimals, so other
+// instances of basic_tsc_timestamp_field have no code.
+template <> struct binary_field_code<tsc_timestamp_field> { static char const value = 'N'; };
+
+template <bool... Values> struct all_of;
+template <> struct all_of<> { static bool const value = true; };
+template <bool First, bool... Rest> struct all_of<First, Rest...> {
+    static bool const value = First and all_of<Rest...>::value;
+};
+
+// The type signature of a call site, as a string with one code per argument.
+template <typename... Args>
+struct binary_signature {
+    static bool const preformatted =
+        not all_of<(binary_type_code<Args>::value != 0)...>::value;
+    static char const codes[sizeof...(Args) + 1];
+    static char const* value()
+    {
+        return preformatted? BINARY_PREFORMATTED_SIGNATURE : codes;
+    }
+};
+template <typename... Args>
+char const binary_signature<Args...>::codes[sizeof...(Args) + 1] = {
+    binary_type_code<Args>::value..., '\0'};
+
+template <class... Fields>
+struct binary_field_codes {
+    static char const value[sizeof...(Fields) + 1];
+};
+template <class... Fields>
+char const binary_field_codes<Fields...>::value[sizeof...(Fields) + 1] = {
+    binary_field_code<Fields>::value..., '\0'};
+
+inline void write_varint(output_buffer* pbuffer, std::uint64_t value)
+{
+    char* p = pbuffer->reserve(MAX_VARINT_SIZE);
+    std::size_t n = 0;
+    while(value >= 0x80) {
+        p[n++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = static_cast<char>(value);
+    pbuffer->commit(n);
+}
+
+inline std::uint64_t zigzag_encode(std::int64_t value)
+{
+    return (static_cast<std::uint64_t>(value) << 1)
+        ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+inline std::int64_t zigzag_decode(std::uint64_t value)
+{
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+template <typename T>
+void write_raw(output_buffer* pbuffer, T value)
+{
+    char* p = pbuffer->reserve(sizeof(value));
+    std::memcpy(p, &value, sizeof(value));
+    pbuffer->commit(sizeof(value));
+}
+
+inline void write_binary_string(output_buffer* pbuffer, char const* s,
+        std::size_t size)
+{
+    if(size > MAX_BINARY_STRING_SIZE)
+        size = MAX_BINARY_STRING_SIZE;
+    write_varint(pbuffer, size);
+    pbuffer->write(s, size);
+}
+
+inline void encode_binary_argument(output_buffer* pbuffer, char v)
+{
+    write_varint(pbuffer, static_cast<unsigned char>(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, signed char v)
+{
+    write_varint(pbuffer, zigzag_encode(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, unsigned char v)
+{
+    write_varint(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, short v)
+{
+    write_varint(pbuffer, zigzag_encode(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, unsigned short v)
+{
+    write_varint(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, int v)
+{
+    write_varint(pbuffer, zigzag_encode(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, unsigned int v)
+{
+    write_varint(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, long v)
+{
+    write_varint(pbuffer, zigzag_encode(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, unsigned long v)
+{
+    write_varint(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, long long v)
+{
+    write_varint(pbuffer, zigzag_encode(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, unsigned long long v)
+{
+    write_varint(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, float v)
+{
+    write_raw(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, double v)
+{
+    write_raw(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, long double v)
+{
+    write_raw(pbuffer, v);
+}
+inline void encode_binary_argument(output_buffer* pbuffer, decimal v)
+{
+    write_varint(pbuffer, zigzag_encode(v.mantissa()));
+    write_varint(pbuffer, v.scale());
+}
+inline void encode_binary_argument(output_buffer* pbuffer, char const* v)
+{
+    write_binary_string(pbuffer, v, std::strlen(v));
+}
+inline void encode_binary_argument(output_buffer* pbuffer, std::string const& v)
+{
+    write_binary_string(pbuffer, v.data(), v.size());
+}
+inline void encode_binary_argument(output_buffer* pbuffer, frame_string v)
+{
+    write_binary_string(pbuffer, v.data(), v.size());
+}
+inline void encode_binary_argument(output_buffer* pbuffer, void const* v)
+{
+    write_varint(pbuffer, reinterpret_cast<std::uintptr_t>(v));
+}
+
+inline void encode_binary_arguments(output_buffer*)
+{
+}
+template <typename T, typename... Args>
+void encode_binary_arguments(output_buffer* pbuffer, T const& value,
+        Args const&... args)
+{
+    encode_binary_argument(pbuffer, value);
+    encode_binary_arguments(pbuffer, args...);
+}
+
+inline void encode_binary_field(output_buffer* pbuffer, timestamp_field const& field)
+{
+    write_varint(pbuffer, zigzag_encode(field.time().tv_sec));
+    write_varint(pbuffer, static_cast<std::uint64_t>(field.time().tv_usec));
+}
+// Converted to wall-clock time here rather than in the decoder, since the
+// tick rate is only known on the machine that wrote the log.
+inline void encode_binary_field(output_buffer* pbuffer, tsc_timestamp_field const& field)
+{
+    std::int64_t const NANOSECONDS_PER_SECOND = 1000000000;
+    std::int64_t ns = field.time();
+    std::int64_t seconds = ns/NANOSECONDS_PER_SECOND;
+    std::int64_t nanoseconds = ns%NANOSECONDS_PER_SECOND;
+    if(nanoseconds < 0) {
+        seconds -= 1;
+        nanoseconds += NANOSECONDS_PER_SECOND;
+    }
+    write_varint(pbuffer, zigzag_encode(seconds));
+    write_varint(pbuffer, static_cast<std::uint64_t>(nanoseconds));
+}
+
+inline void encode_binary_fields(output_buffer*)
+{
+}
+template <class Field, class... Fields>
+void encode_binary_fields(output_buffer* pbuffer, Field const& field,
+        Fields const&... fields)
+{
+    encode_binary_field(pbuffer, field);
+    encode_binary_fields(pbuffer, fields...);
+}
+
+// The output thread's side of a binary_log: keeps track of which call sites
+// have been given a message id, and provides scratch space for formatting
+// preformatted messages. Only the output thread may use it while the log is
+// open.
+class binary_encoder {
+public:
+    binary_encoder();
+
+    // Forgets all message ids, for when a new stream starts. The separator
+    // and field codes are repeated in the stream header if we need to start
+    // a new stream after lost output.
+    void reset(char separator, char const* pfield_codes);
+
+    // Writes the message id for the call site, preceded by a definition
+    // record if this is the first time we see it.
+    void write_message_id(output_buffer* pbuffer, char const* pformat,
+            char const* psignature)
+    {
+        // When a write fails, the output buffer throws away what it had, and
+        // that may include definitions or part of a record. The decoder can
+        // only find its way back at a stream header.
+        if(unlikely(pbuffer->write_errors() != write_errors_))
+            restart_stream(pbuffer);
+        auto it = message_ids_.find(call_site{pformat, psignature});
+        if(likely(it != message_ids_.end()))
+            write_varint(pbuffer, it->second);
+        else
+            define_message_id(pbuffer, pformat, psignature);
+    }
+
+    // Start formatting the text of a preformatted message into the returned
+    // buffer, then call end_text() to write it as a string.
+    output_buffer* begin_text()
+    {
+        return &text_buffer_;
+    }
+    void end_text(output_buffer* pbuffer);
+
+    // The record that starts a stream, for writing directly to the writer.
+    static std::string stream_header(char separator, char const* pfield_codes);
+
+private:
+    struct call_site {
+        char const* pformat;
+        char const* psignature;
+        bool operator==(call_site const& other) const
+        {
+            return pformat == other.pformat and psignature == other.psignature;
+        }
+    };
+    struct call_site_hash {
+        std::size_t operator()(call_site const& site) const
+        {
+            std::hash<char const*> hash;
+            return hash(site.pformat) ^ (hash(site.psignature) << 1);
+        }
+    };
+    class string_writer : public writer {
+    public:
+        Result write(void const* pbuffer, std::size_t count) override;
+        std::string text;
+    };
+
+    void define_message_id(output_buffer* pbuffer, char const* pformat,
+            char const* psignature);
+    void restart_stream(output_buffer* pbuffer);
+
+    std::unordered_map<call_site, std::uint64_t, call_site_hash> message_ids_;
+    std::uint64_t next_message_id_;
+    char separator_;
+    char const* pfield_codes_;
+    std::uint64_t write_errors_;
+    string_writer text_writer_;
+    output_buffer text_buffer_;
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_BINARY_ENCODING_HPP
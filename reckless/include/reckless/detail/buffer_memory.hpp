@@ -0,0 +1,83 @@
+#ifndef RECKLESS_DETAIL_BUFFER_MEMORY_HPP
+#define RECKLESS_DETAIL_BUFFER_MEMORY_HPP
+
+#include "reckless/log_options.hpp"
+
+#include <cstddef>  // size_t
+
+namespace reckless {
+namespace detail {
+
+// The settings from log_options that decide how we get memory for the thread
+// input buffers and the output buffer.
+struct buffer_memory_options {
+    buffer_memory_options() :
+        huge_pages(huge_page_policy::none),
+        numa_local(false),
+        lock(false),
+        prefault(false)
+    {
+    }
+
+    explicit buffer_memory_options(log_options const& options) :
+        huge_pages(options.huge_pages),
+        numa_local(options.numa_local_input_buffers),
+        lock(options.lock_buffers),
+        prefault(options.prefault_buffers)
+    {
+    }
+
+    // Plain malloc is fine unless we need control over the pages. For
+    // locking, we need pages of our own; munlock() isn't reference counted,
+    // so freeing a locked malloc block could unlock pages that some other
+    // locked block still lives on.
+    bool use_mmap() const
+    {
+        return huge_pages != huge_page_policy::none or numa_local or lock;
+    }
+
+    huge_page_policy huge_pages;
+    bool numa_local;
+    bool lock;
+    bool prefault;
+};
+
+// A block of memory for a buffer, and what we need to know to give it back.
+struct buffer_memory {
+    buffer_memory() :
+        p(nullptr),
+        size(0),
+        mapped(false),
+        numa_node(-1)
+    {
+    }
+
+    void* p;
+    std::size_t size;   // the actual size, i.e. rounded up to whole pages when mapped
+    bool mapped;
+    int numa_node;      // node of the allocating thread, or -1 if we don't care
+};
+
+// Throws std::bad_alloc on failure. If explicit huge pages are requested but
+// none are available, we fall back to regular pages.
+buffer_memory allocate_buffer_memory(std::size_t size,
+        buffer_memory_options const& options);
+// Locks and/or prefaults the memory as requested. With first-touch NUMA
+// placement this decides which node the pages end up on, so it should be
+// called from the thread that is going to write to the buffer. Failure to lock
+// is not an error; the memory is just left unlocked.
+void prepare_buffer_memory(buffer_memory const& memory,
+        buffer_memory_options const& options);
+// Writes to every page in the block so that it's backed by physical memory.
+// This destroys the contents.
+void prefault_buffer_memory(buffer_memory const& memory);
+void free_buffer_memory(buffer_memory const& memory);
+
+// Returns the NUMA node of the CPU the calling thread runs on, or -1 if we
+// can't tell.
+int current_numa_node();
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_BUFFER_MEMORY_HPP
@@ -0,0 +1,215 @@
+#ifndef RECKLESS_DETAIL_FORMAT_CHECK_HPP
+#define RECKLESS_DETAIL_FORMAT_CHECK_HPP
+
+#include <reckless/frame_string.hpp>
+#include <reckless/decimal.hpp>
+#include <reckless/elements.hpp>
+
+#include <cstddef>  // size_t
+#include <string>
+#include <type_traits>  // decay
+#include <ciso646>
+
+namespace reckless {
+namespace detail {
+
+// Compile-time checking of a format string against the arguments, for
+// RECKLESS_CHECKED_FMT. The rules are the same as those of the format()
+// functions for the built-in types, so a string that passes the check never
+// takes the fallback path in template_formatter. Types that have their own
+// format() functions are assumed to take any specifier.
+//
+// This is all C++11 constexpr, i.e. one return statement per function.
+
+// How each argument type may be formatted:
+// 'i' integer: %d, %x, %X
+// 'c' character: %s, or like an integer
+// 'f' floating point: %f, %e, %g and their uppercase forms, %s
+// 'x' fixed point (reckless::decimal): %f, %F, %s
+// 's' C string: %s, %p
+// 'S' std::string: %s
+// 'p' pointer: %p, %s
+// '?' anything else, which is up to its own format() function.
+template <typename T> struct format_argument_class { static constexpr char value = '?'; };
+template <> struct format_argument_class<bool> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<char> { static constexpr char value = 'c'; };
+template <> struct format_argument_class<signed char> { static constexpr char value = 'c'; };
+template <> struct format_argument_class<unsigned char> { static constexpr char value = 'c'; };
+template <> struct format_argument_class<short> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<unsigned short> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<int> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<unsigned int> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<long> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<unsigned long> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<long long> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<unsigned long long> { static constexpr char value = 'i'; };
+template <> struct format_argument_class<float> { static constexpr char value = 'f'; };
+template <> struct format_argument_class<double> { static constexpr char value = 'f'; };
+template <> struct format_argument_class<long double> { static constexpr char value = 'f'; };
+template <> struct format_argument_class<decimal> { static constexpr char value = 'x'; };
+template <> struct format_argument_class<char const*> { static constexpr char value = 's'; };
+template <> struct format_argument_class<char*> { static constexpr char value = 's'; };
+template <> struct format_argument_class<std::string> { static constexpr char value = 'S'; };
+template <> struct format_argument_class<transient_string> { static constexpr char value = 'S'; };
+template <> struct format_argument_class<frame_string> { static constexpr char value = 'S'; };
+#if __cplusplus >= 201703L
+template <> struct format_argument_class<std::string_view> { static constexpr char value = 'S'; };
+#endif
+template <> struct format_argument_class<void const*> { static constexpr char value = 'p'; };
+template <> struct format_argument_class<void*> { static constexpr char value = 'p'; };
+// Arrays take the specifiers of their elements.
+template <typename T> struct format_argument_class<element_range<T>> : format_argument_class<T> {};
+template <typename T> struct format_argument_class<frame_elements<T>> : format_argument_class<T> {};
+
+template <typename... Args>
+struct format_argument_classes {
+    static constexpr char value[sizeof...(Args) + 1] = {
+        format_argument_class<typename std::decay<Args>::type>::value..., '\0'};
+};
+template <typename... Args>
+constexpr char format_argument_classes<Args...>::value[sizeof...(Args) + 1];
+
+// Only for use in decltype, to get at the argument types in a macro.
+template <typename... Args>
+format_argument_classes<Args...> classify_format_arguments(Args&&...);
+
+// The result of check_format() is the kind of problem, plus the number of
+// the argument it concerns (starting at 1) times four.
+enum format_check_kind : unsigned long {
+    FORMAT_OK,
+    FORMAT_TOO_FEW_ARGUMENTS,
+    FORMAT_TOO_MANY_ARGUMENTS,
+    FORMAT_ARGUMENT_MISMATCH
+};
+
+constexpr unsigned long format_check_result(format_check_kind kind,
+        std::size_t argument)
+{
+    return 4*argument + kind;
+}
+
+// Finds the first '%' in [begin, end) by splitting the range in halves, so
+// that the recursion depth is logarithmic in the length of the string
+// rather than linear; compilers limit constexpr recursion to a few hundred
+// levels.
+constexpr std::size_t find_percent(char const* p, std::size_t begin,
+        std::size_t end);
+constexpr std::size_t first_percent(std::size_t left, std::size_t mid,
+        char const* p, std::size_t end)
+{
+    return left != mid? left : find_percent(p, mid, end);
+}
+constexpr std::size_t find_percent(char const* p, std::size_t begin,
+        std::size_t end)
+{
+    return end - begin <= 1?
+            (begin != end and p[begin] == '%'? begin : end)
+        : first_percent(find_percent(p, begin, begin + (end - begin)/2),
+                begin + (end - begin)/2, p, end);
+}
+
+constexpr std::size_t skip_format_flags(char const* p, std::size_t i)
+{
+    return p[i] == '-' or p[i] == '+' or p[i] == ' ' or p[i] == '#'
+        or p[i] == '0'? skip_format_flags(p, i + 1) : i;
+}
+constexpr std::size_t skip_format_digits(char const* p, std::size_t i)
+{
+    return p[i] >= '0' and p[i] <= '9'? skip_format_digits(p, i + 1) : i;
+}
+constexpr std::size_t skip_format_precision(char const* p, std::size_t i)
+{
+    return p[i] == '.'? skip_format_digits(p, i + 1) : i;
+}
+// Where the conversion character is, given the position right after '%'.
+constexpr std::size_t format_conversion_index(char const* p, std::size_t i)
+{
+    return skip_format_precision(p, skip_format_digits(p,
+                skip_format_flags(p, i)));
+}
+
+constexpr bool is_integer_conversion(char conversion)
+{
+    return conversion == 'd' or conversion == 'x' or conversion == 'X';
+}
+
+constexpr bool is_float_conversion(char conversion)
+{
+    return conversion == 'f' or conversion == 'F' or conversion == 'e'
+        or conversion == 'E' or conversion == 'g' or conversion == 'G';
+}
+
+// A bare specifier is one with the conversion character right after the
+// '%'. The string and character formatters don't take anything else, and
+// neither does %s for a floating-point or fixed-point number.
+constexpr bool format_argument_fits(char argument_class, char conversion,
+        bool bare)
+{
+    return argument_class == 'i'? is_integer_conversion(conversion)
+        : argument_class == 'c'? (bare and conversion == 's')
+            or is_integer_conversion(conversion)
+        : argument_class == 'f'? (bare and conversion == 's')
+            or is_float_conversion(conversion)
+        : argument_class == 'x'? (bare and conversion == 's')
+            or conversion == 'f' or conversion == 'F'
+        : argument_class == 's'? bare and (conversion == 's' or conversion == 'p')
+        : argument_class == 'S'? bare and conversion == 's'
+        : argument_class == 'p'? bare and (conversion == 'p' or conversion == 's')
+        : true;
+}
+
+constexpr unsigned long check_format(char const* p, std::size_t i,
+        std::size_t size, char const* classes, std::size_t argument);
+
+constexpr unsigned long check_format_specifier(char const* p,
+        std::size_t text, std::size_t conversion, std::size_t size,
+        char const* classes, std::size_t argument)
+{
+    return not format_argument_fits(classes[argument], p[conversion],
+            conversion == text)?
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, argument + 1)
+        : check_format(p, p[conversion] == '\0'? conversion : conversion + 1,
+                size, classes, argument + 1);
+}
+
+constexpr unsigned long check_format_at_percent(char const* p,
+        std::size_t percent, std::size_t size, char const* classes,
+        std::size_t argument)
+{
+    return percent == size?
+            (classes[argument] == '\0'? format_check_result(FORMAT_OK, 0)
+             : format_check_result(FORMAT_TOO_MANY_ARGUMENTS, argument + 1))
+        : p[percent + 1] == '%'?
+            check_format(p, percent + 2, size, classes, argument)
+        : classes[argument] == '\0'?
+            format_check_result(FORMAT_TOO_FEW_ARGUMENTS, argument + 1)
+        : check_format_specifier(p, percent + 1,
+                format_conversion_index(p, percent + 1), size, classes,
+                argument);
+}
+
+// Checks the format string p of length size, from position i and argument
+// number argument (counting from 0) onwards. classes is the string from
+// format_argument_classes.
+constexpr unsigned long check_format(char const* p, std::size_t i,
+        std::size_t size, char const* classes, std::size_t argument)
+{
+    return check_format_at_percent(p, find_percent(p, i, size), size,
+            classes, argument);
+}
+
+// Instantiated with the number of the argument that doesn't fit its
+// specifier, so that the compiler's error message points it out. See
+// checked_format_string in format_string.hpp.
+template <unsigned long Argument>
+struct format_argument_mismatch {
+    static_assert(Argument == 0,
+        "format specifier doesn't fit the type of the argument (see the "
+        "template argument of format_argument_mismatch for which one)");
+    static bool const ok = true;
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_FORMAT_CHECK_HPP
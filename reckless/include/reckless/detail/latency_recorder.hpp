@@ -0,0 +1,50 @@
+#ifndef RECKLESS_DETAIL_LATENCY_RECORDER_HPP
+#define RECKLESS_DETAIL_LATENCY_RECORDER_HPP
+
+#include "reckless/latency_histogram.hpp"
+#include "reckless/detail/utility.hpp"    // single_writer_add
+
+#include <atomic>
+#include <cstdint>  // uint64_t
+
+namespace reckless {
+namespace detail {
+
+// A latency_histogram that one thread (the output thread) records into while
+// others take snapshots.
+class latency_recorder {
+public:
+    latency_recorder() :
+        sum_(0)
+    {
+        for(auto& count : counts_)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    void record(std::uint64_t value)
+    {
+        single_writer_add(counts_[latency_histogram::bucket_index(value)],
+                std::uint64_t(1));
+        single_writer_add(sum_, value);
+    }
+
+    void snapshot(latency_histogram* phistogram) const
+    {
+        phistogram->count_ = 0;
+        for(std::size_t i=0; i!=latency_histogram::BUCKET_COUNT; ++i) {
+            std::uint64_t count = counts_[i].load(std::memory_order_relaxed);
+            phistogram->counts_[i] = count;
+            phistogram->count_ += count;
+        }
+        phistogram->sum_ = sum_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> counts_[latency_histogram::BUCKET_COUNT];
+    std::atomic<std::uint64_t> sum_;
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_LATENCY_RECORDER_HPP
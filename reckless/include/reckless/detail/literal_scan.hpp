@@ -0,0 +1,49 @@
+#ifndef RECKLESS_DETAIL_LITERAL_SCAN_HPP
+#define RECKLESS_DETAIL_LITERAL_SCAN_HPP
+
+#include <atomic>
+
+namespace reckless {
+class output_buffer;
+
+namespace detail {
+
+// Ways of finding the end of a literal run in a format string.
+enum format_literal_scanner {
+    // One machine word at a time, as strchrnul does.
+    FORMAT_SCAN_SCALAR,
+    // 16 bytes at a time. Always available on x86-64.
+    FORMAT_SCAN_SSE2,
+    // 32 bytes at a time, if the CPU and the OS support it.
+    FORMAT_SCAN_AVX2
+};
+
+typedef char const* (*format_literal_copier)(output_buffer* pbuffer,
+        char const* pformat);
+
+extern std::atomic<format_literal_copier> g_copy_format_literal;
+
+// Copies the text at pformat to the buffer up to the next '%' or the end of
+// the string, and returns a pointer to the '%' or the NUL character. The
+// scanner is chosen the first time this is called; the SIMD versions copy
+// each block of text as soon as they have looked at it, rather than finding
+// the end first and then copying it all.
+inline char const* copy_format_literal(output_buffer* pbuffer,
+        char const* pformat)
+{
+    return g_copy_format_literal.load(std::memory_order_relaxed)(pbuffer,
+            pformat);
+}
+
+// The fastest scanner that this machine supports.
+format_literal_scanner best_format_literal_scanner();
+// Whether this build and this machine can use the given scanner.
+bool format_literal_scanner_supported(format_literal_scanner scanner);
+// Makes copy_format_literal() use the given scanner, for tests and
+// benchmarks. Returns false, and changes nothing, if it is not supported.
+bool use_format_literal_scanner(format_literal_scanner scanner);
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_LITERAL_SCAN_HPP
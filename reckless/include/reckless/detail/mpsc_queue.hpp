@@ -0,0 +1,142 @@
+#ifndef RECKLESS_DETAIL_MPSC_QUEUE_HPP
+#define RECKLESS_DETAIL_MPSC_QUEUE_HPP
+
+#include "reckless/detail/utility.hpp"    // is_power_of_two
+
+#include <atomic>
+#include <cstddef>  // size_t, ptrdiff_t
+#include <cassert>
+
+namespace reckless {
+namespace detail {
+
+// Bounded multi-producer, single-consumer queue based on Dmitry Vyukov's
+// bounded MPMC queue
+// (http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue).
+// Each cell carries a sequence number that tells producers and the consumer
+// whether the cell is free for the current lap around the ring, so a push is
+// one CAS on the enqueue position plus a release store in the cell. Since we
+// only have one consumer, the dequeue position is a plain integer owned by the
+// consumer.
+//
+// T must be trivially copyable.
+template <class T>
+class mpsc_queue {
+public:
+    mpsc_queue() :
+        pcells_(nullptr),
+        mask_(0),
+        enqueue_pos_(0),
+        dequeue_pos_(0)
+    {
+    }
+
+    ~mpsc_queue()
+    {
+        delete [] pcells_;
+    }
+
+    // Not thread safe. The queue must not be in use by anyone while it is
+    // reset.
+    void reset(std::size_t capacity)
+    {
+        delete [] pcells_;
+        pcells_ = nullptr;
+        mask_ = 0;
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_ = 0;
+        if(capacity == 0)
+            return;
+
+        std::size_t size = 2;
+        while(size < capacity)
+            size *= 2;
+        assert(is_power_of_two(size));
+        pcells_ = new cell[size];
+        for(std::size_t i=0; i!=size; ++i)
+            pcells_[i].sequence.store(i, std::memory_order_relaxed);
+        mask_ = size - 1;
+    }
+
+    bool push(T const& value)
+    {
+        cell* pcell;
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while(true) {
+            pcell = &pcells_[pos & mask_];
+            std::size_t seq = pcell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq)
+                - static_cast<std::ptrdiff_t>(pos);
+            if(diff == 0) {
+                // The cell is free for this lap; try to claim it. On failure
+                // compare_exchange_weak reloads pos for us. The claim is
+                // sequentially consistent so that it pairs with the load in
+                // empty(); see basic_log::park_output_worker(). A locked CAS
+                // is a full barrier on x86 anyway, so this costs nothing
+                // there.
+                if(enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_seq_cst, std::memory_order_relaxed))
+                    break;
+            } else if(diff < 0) {
+                // The consumer hasn't freed the cell from the previous lap,
+                // i.e. the queue is full.
+                return false;
+            } else {
+                // Someone else claimed the cell before us.
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        pcell->value = value;
+        pcell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Must only be called from the consumer thread.
+    bool pop(T& value)
+    {
+        cell* pcell = &pcells_[dequeue_pos_ & mask_];
+        std::size_t seq = pcell->sequence.load(std::memory_order_acquire);
+        if(seq != dequeue_pos_ + 1)
+            return false;
+        value = pcell->value;
+        pcell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    // Must only be called from the consumer thread. A cell that has been
+    // claimed by a producer but not yet filled in counts as non-empty, so
+    // pop() can still fail briefly after empty() returns false.
+    bool empty() const
+    {
+        return enqueue_pos_.load(std::memory_order_seq_cst) == dequeue_pos_;
+    }
+
+private:
+    mpsc_queue(mpsc_queue const&) = delete;
+    mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    // The producers hammer enqueue_pos_ while the consumer owns dequeue_pos_,
+    // so keep them on separate cache lines. We pad by hand instead of using
+    // alignas since operator new doesn't honor extended alignment before
+    // C++17.
+    static std::size_t const CACHE_LINE_SIZE = 64;
+
+    cell* pcells_;
+    std::size_t mask_;
+    char padding1_[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> enqueue_pos_;
+    char padding2_[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+    std::size_t dequeue_pos_;
+    char padding3_[CACHE_LINE_SIZE - sizeof(std::size_t)];
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_MPSC_QUEUE_HPP
@@ -0,0 +1,103 @@
+#ifndef RECKLESS_DETAIL_SHARED_INPUT_QUEUE_HPP
+#define RECKLESS_DETAIL_SHARED_INPUT_QUEUE_HPP
+
+#include "reckless/log_options.hpp"
+#include "reckless/detail/thread_input_buffer.hpp"
+#include "reckless/detail/mpsc_queue.hpp"
+#include "reckless/detail/branch_hints.hpp"   // likely
+
+#include <boost/lockfree/queue.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace reckless {
+namespace detail {
+
+// The queue where application threads post commit extents for the output
+// thread. The backend is picked at runtime according to
+// shared_input_queue_policy; the policy never changes while the log is open,
+// so the switch in push() is perfectly predicted.
+//
+// Regardless of the policy, every thread input buffer that belongs to the log
+// is kept in a registry. With shared_input_queue_policy::none the registry
+// *is* the queue: pop() polls the registered buffers for any that have
+// committed data past their current input position.
+//
+// A successful push() and a call to empty() that follows it are ordered by
+// sequential consistency for every policy, so that the output thread and a
+// producer can't both miss each other when the output thread is about to go
+// to sleep.
+class shared_input_queue {
+public:
+    shared_input_queue();
+
+    // Not thread safe. Must only be called while the log is closed.
+    void reset(shared_input_queue_policy policy, std::size_t capacity);
+
+    shared_input_queue_policy policy() const
+    {
+        return policy_;
+    }
+
+    // A commit extent with pinput_buffer == nullptr tells the output thread to
+    // shut down.
+    bool push(commit_extent const& ce)
+    {
+        switch(policy_) {
+        case shared_input_queue_policy::boost_lockfree:
+            return boost_queue_.push(ce);
+        case shared_input_queue_policy::mpsc_array:
+            return mpsc_queue_.push(ce);
+        case shared_input_queue_policy::none:
+            if(likely(ce.pinput_buffer != nullptr))
+                ce.pinput_buffer->publish_commit_end(ce.pcommit_end);
+            else
+                closing_.store(true, std::memory_order_seq_cst);
+            return true;
+        }
+        return false;
+    }
+
+    // Must only be called from the output thread.
+    bool pop(commit_extent& ce);
+    // Must only be called from the output thread, or when the output thread
+    // is not running.
+    bool empty();
+
+    void register_input_buffer(thread_input_buffer* pbuffer);
+    void unregister_input_buffer(thread_input_buffer* pbuffer);
+
+    // Calls function(pbuffer) for each registered input buffer, with the
+    // registry locked.
+    template <class Function>
+    void for_each_input_buffer(Function function)
+    {
+        std::lock_guard<std::mutex> lk(registry_mutex_);
+        for(thread_input_buffer* pbuffer : registry_)
+            function(pbuffer);
+    }
+
+private:
+    shared_input_queue(shared_input_queue const&) = delete;
+    shared_input_queue& operator=(shared_input_queue const&) = delete;
+
+    typedef boost::lockfree::queue<commit_extent, boost::lockfree::fixed_sized<true>> boost_queue_t;
+
+    bool poll_registry(commit_extent& ce);
+
+    shared_input_queue_policy policy_;
+    boost_queue_t boost_queue_;
+    mpsc_queue<commit_extent> mpsc_queue_;
+
+    std::mutex registry_mutex_;
+    std::vector<thread_input_buffer*> registry_;
+    std::size_t next_registry_index_;
+    std::atomic<bool> closing_;
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_SHARED_INPUT_QUEUE_HPP
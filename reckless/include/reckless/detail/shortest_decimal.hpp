@@ -0,0 +1,33 @@
+#ifndef RECKLESS_DETAIL_SHORTEST_DECIMAL_HPP
+#define RECKLESS_DETAIL_SHORTEST_DECIMAL_HPP
+
+#include <cstdint>  // uint64_t
+
+namespace reckless {
+namespace detail {
+
+// A decimal number mantissa * 10^exponent with as few digits as possible
+// (at most 17) that still reads back as the same binary number.
+struct shortest_decimal {
+    std::uint64_t mantissa;
+    int exponent;
+    // Which side of the binary number the decimal one is on: negative if the
+    // decimal number is smaller, zero if they are exactly equal, positive if
+    // it is larger. When we round the digits further, e.g. for %.2f, this
+    // decides the ties that the shortest digits alone can't.
+    int direction;
+};
+
+// These use Ulf Adams' Ryu algorithm, which finds the shortest digits with
+// 128-bit multiplications by precomputed powers of five instead of the
+// arbitrary-precision arithmetic of the classic algorithms. The value must
+// be finite and nonzero; the sign is ignored.
+shortest_decimal binary64_to_shortest_decimal(double value);
+// The shortest digits for a float, which are often fewer than for the same
+// value as a double (e.g. "0.1" rather than "0.10000000149011612").
+shortest_decimal binary32_to_shortest_decimal(float value);
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_SHORTEST_DECIMAL_HPP
@@ -0,0 +1,149 @@
+#ifndef RECKLESS_DETAIL_SPILL_WRITER_HPP
+#define RECKLESS_DETAIL_SPILL_WRITER_HPP
+
+#include "reckless/writer.hpp"
+#include "reckless/flush_ticket.hpp"
+#include "reckless/detail/spsc_event.hpp"
+
+#include <atomic>
+#include <cstddef>  // size_t
+#include <cstdint>  // uint64_t, int64_t
+#include <memory>   // shared_ptr
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>  // pair
+#include <vector>
+
+namespace reckless {
+namespace detail {
+
+// Puts a memory-mapped file between the output buffer and the real writer
+// (see log_options::spill_file). write() only copies the data into the file,
+// which is used as a ring buffer, and a thread of our own passes it on to the
+// real writer. So when the real writer is slow or fails with
+// ERROR_TRY_LATER, the output thread can keep formatting, and the producers
+// keep writing, until the file is full. The data in the file is written in
+// order once the writer catches up, and calls that fail with
+// ERROR_TRY_LATER are retried until they succeed. The exception is when the
+// log is closed or flushed after a crash: then we only keep retrying until a
+// deadline, so that a writer that never recovers can't hang the program.
+class spill_writer : public writer {
+public:
+    spill_writer();
+    ~spill_writer();
+
+    // Creates the file and starts the thread. Throws std::system_error on
+    // failure.
+    void open(writer* ptarget, std::string const& path, std::size_t capacity,
+            unsigned retry_timeout_ms,
+            std::atomic<int> const* pflush_notification_fd);
+    // Waits until everything in the file has been written, then stops the
+    // thread and deletes the file. Calls limit_retries() first.
+    void close();
+    // From now on, writes that fail with ERROR_TRY_LATER are retried for at
+    // most retry_timeout_ms (counting from the first call). After that, the
+    // data is thrown away like with ERROR_GIVE_UP.
+    void limit_retries();
+    bool is_open() const
+    {
+        return thread_.joinable();
+    }
+
+    // Must only be called from one thread at a time (the output thread).
+    // Waits for room if the file is full. The data is always stored, but if
+    // our thread has thrown away any earlier data since the last call, we
+    // return ERROR_GIVE_UP. That way the loss shows up in
+    // output_buffer::write_errors(), which binary_log relies on to know when
+    // to start a new stream.
+    Result write(void const* pbuffer, std::size_t count) override;
+
+    // Completes the flush requests once everything that was given to write()
+    // so far has been passed to the real writer, and clears the vector.
+    void complete_after_write(
+            std::vector<std::shared_ptr<flush_request>>& requests);
+    // Blocks until everything given to write() so far has been passed to the
+    // real writer, or thrown away. Use limit_retries() first if this must not
+    // block forever.
+    void wait_until_written();
+
+    // Counters for the real writer, for basic_log::stats().
+    std::uint64_t write_calls() const
+    {
+        return write_calls_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t bytes_written() const
+    {
+        return bytes_written_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t write_errors() const
+    {
+        return write_errors_.load(std::memory_order_relaxed);
+    }
+    // Bytes that are waiting in the file right now, and the most there has
+    // ever been.
+    std::uint64_t backlog() const
+    {
+        return write_pos_.load(std::memory_order_relaxed)
+            - read_pos_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t peak_backlog() const
+    {
+        return peak_backlog_.load(std::memory_order_relaxed);
+    }
+    // Number of times write() had to wait because the file was full.
+    std::uint64_t full_stalls() const
+    {
+        return full_stalls_.load(std::memory_order_relaxed);
+    }
+
+private:
+    spill_writer(spill_writer const&) = delete;
+    spill_writer& operator=(spill_writer const&) = delete;
+
+    void run();
+    void complete_flush_requests(std::uint64_t read_pos);
+    void unmap();
+
+    writer* ptarget_;
+    std::string path_;
+    int fd_;
+    char* pbuffer_;
+    std::size_t capacity_;
+    std::atomic<int> const* pflush_notification_fd_;
+
+    // Positions are byte offsets since the file was opened; the data for
+    // position p is at p % capacity_. write() owns write_pos_ and the
+    // thread owns read_pos_.
+    std::atomic<std::uint64_t> write_pos_;
+    std::atomic<std::uint64_t> read_pos_;
+    std::atomic<bool> closing_;
+    unsigned retry_timeout_ms_;
+    // steady_clock time in nanoseconds after which we stop retrying, or 0.
+    std::atomic<std::int64_t> retry_deadline_ns_;
+    spsc_event data_available_event_;
+    spsc_event space_available_event_;
+    spsc_event written_event_;
+
+    std::mutex flush_requests_mutex_;
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<flush_request>>>
+        flush_requests_;
+    std::atomic<bool> has_flush_requests_;
+
+    std::atomic<std::uint64_t> write_calls_;
+    std::atomic<std::uint64_t> bytes_written_;
+    std::atomic<std::uint64_t> write_errors_;
+    // Number of chunks that our thread has thrown away, and the number that
+    // write() has reported so far.
+    std::atomic<std::uint64_t> lost_writes_;
+    std::uint64_t lost_writes_reported_;
+    std::atomic<std::uint64_t> peak_backlog_;
+    std::atomic<std::uint64_t> full_stalls_;
+
+    std::thread thread_;
+};
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_SPILL_WRITER_HPP
@@ -2,94 +2,182 @@
 #define RECKLESS_DETAIL_SPSC_EVENT_HPP
 #include <atomic>
 #include <system_error>
+#include <ciso646>
 
+#include <climits>    // INT_MAX
+
+#include <errno.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#else
 #include <mutex>
 #include <condition_variable>
-//#include <linux/futex.h>
-#include <unistd.h>
-//#include <sys/syscall.h>
-#include <time.h>
-#include <sys/time.h>
+#include <chrono>
+#endif
 
+// Auto-reset event. It is meant for a single waiter and any number of
+// signalers, but basic_log also lets several producers block on
+// shared_input_consumed_event_ when the shared queue is full. To keep that
+// working, a wakeup releases every sleeping thread; only one of them gets to
+// consume the signal and the others go back to sleep. That only holds for
+// wait() without a timeout, though: a timed wait that expires takes back the
+// WAITING state, and then signal() won't wake anyone who is still asleep. So
+// never have several threads wait on the same event if any of them uses a
+// timeout.
+//
+// The event state is a single int that is either UNSIGNALED, SIGNALED or
+// WAITING. Only the waiter ever moves it to WAITING, and it only does so right
+// before it goes to sleep. That means signal() only needs to enter the kernel
+// if the previous state was WAITING; an uncontended signal is a single atomic
+// exchange. Likewise, wait() returns without a syscall when the event is
+// already signaled.
 class spsc_event {
 public:
-    spsc_event() : signal_(0)
+    spsc_event() : state_(UNSIGNALED)
     {
     }
 
     void signal()
     {
-        // TODO possible performance improvement: If we know nobody is waiting,
-        // then we don't need to signal the futex.
-        atomic_exchange_explicit(&signal_, 1, std::memory_order_release);
-        //sys_futex(&signal_, FUTEX_WAKE, 1, nullptr, nullptr, 0);
-		cv.notify_one();
+        int previous = state_.exchange(SIGNALED, std::memory_order_release);
+        if(previous == WAITING)
+            wake();
     }
 
     void wait()
     {
-        int signal = atomic_exchange_explicit(&signal_, 0, std::memory_order_acquire);
-        while(not signal) {
-            //sys_futex(&signal_, FUTEX_WAIT, 0, nullptr, nullptr, 0);
-			std::unique_lock<std::mutex> lk(m);
-			cv.wait(lk);
-            signal = atomic_exchange_explicit(&signal_, 0, std::memory_order_acquire);
-        }
+        while(not try_wait())
+            sleep(nullptr);
     }
 
+    // Returns true if the event was signaled, false on timeout.
     bool wait(unsigned milliseconds)
     {
-        int signal = atomic_exchange_explicit(&signal_, 0, std::memory_order_acquire);
-        if(signal)
+        if(try_wait())
             return true;
-        struct timespec start;
-        if(0 != clock_gettime(CLOCK_MONOTONIC, &start))
-            throw std::system_error(errno, std::system_category());
+        if(milliseconds == 0)
+            return false;
 
-        unsigned elapsed_ms = 0;
-        //struct timespec timeout = {0, 0};
-
-        do {
-            //unsigned remaining_ms = milliseconds - elapsed_ms;
-            //timeout.tv_sec = remaining_ms/1000;
-            //timeout.tv_nsec = static_cast<long>(remaining_ms%1000)*1000000;
-            //sys_futex(&signal_, FUTEX_WAIT, 0, &timeout, nullptr, 0);
-			std::unique_lock<std::mutex> lk(m);
-			cv.wait(lk);
-            signal = atomic_exchange_explicit(&signal_, 0, std::memory_order_acquire);
-            if(signal)
-                return true;
-            
+        struct timespec deadline;
+        get_monotonic_time(&deadline);
+        deadline.tv_sec += milliseconds/1000;
+        deadline.tv_nsec += static_cast<long>(milliseconds%1000)*1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec += 1;
+        }
+
+        while(true) {
             struct timespec now;
-            if(0 != clock_gettime(CLOCK_MONOTONIC, &now))
-                throw std::system_error(errno, std::system_category());
-            
-            elapsed_ms = 1000*static_cast<int>(now.tv_sec - start.tv_sec);
-            elapsed_ms += (now.tv_nsec - start.tv_nsec)/1000000;
-        } while(elapsed_ms < milliseconds);
-        return false;
+            get_monotonic_time(&now);
+            struct timespec timeout;
+            timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+            timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if(timeout.tv_nsec < 0) {
+                timeout.tv_nsec += 1000000000;
+                timeout.tv_sec -= 1;
+            }
+            if(timeout.tv_sec < 0) {
+                // Timed out. We may have registered as waiting, so we need to
+                // take that back. If someone signaled us in the meantime then
+                // we'll consume the signal instead.
+                return state_.exchange(UNSIGNALED, std::memory_order_acquire) == SIGNALED;
+            }
+            sleep(&timeout);
+            if(try_wait())
+                return true;
+        }
     }
 
 private:
-   /* int sys_futex(void *addr1, int op, int val1, struct timespec const *timeout,
-            void *addr2, int val3)
+    enum {
+        UNSIGNALED,
+        SIGNALED,
+        WAITING
+    };
+
+    // Consumes the signal if the event is signaled. Otherwise, registers the
+    // waiter so that the next signal() will wake it up.
+    bool try_wait()
     {
-        return syscall(SYS_futex, addr1, op, val1, timeout, addr2, val3);
-    }*/
+        int state = state_.load(std::memory_order_relaxed);
+        while(true) {
+            if(state == SIGNALED) {
+                if(state_.compare_exchange_weak(state, UNSIGNALED,
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                    return true;
+            } else if(state == UNSIGNALED) {
+                if(state_.compare_exchange_weak(state, WAITING,
+                        std::memory_order_relaxed, std::memory_order_relaxed))
+                    return false;
+            } else {
+                // Already registered as waiting (e.g. after a spurious
+                // wakeup).
+                return false;
+            }
+        }
+    }
 
-    int atomic_exchange_explicit(int* pvalue, int new_value, std::memory_order)
+    static void get_monotonic_time(struct timespec* pts)
     {
-        int res = new_value;
-        asm volatile("xchg %0, %1\n\t"
-                : "+r"(res), "+m"(*pvalue)
-                :
-                : "memory", "cc");
-        return res;
+        if(0 != clock_gettime(CLOCK_MONOTONIC, pts))
+            throw std::system_error(errno, std::system_category());
     }
 
-    int signal_;
-	std::mutex m;
-	std::condition_variable cv;	
+#if defined(__linux__)
+    // Sleeps while the state is WAITING, or until the (relative) timeout
+    // expires. Spurious wakeups are fine since the caller always re-checks
+    // the state.
+    void sleep(struct timespec const* ptimeout)
+    {
+        sys_futex(FUTEX_WAIT_PRIVATE, WAITING, ptimeout);
+    }
+
+    void wake()
+    {
+        sys_futex(FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+    }
+
+    long sys_futex(int op, int value, struct timespec const* ptimeout)
+    {
+        static_assert(sizeof(std::atomic<int>) == sizeof(int),
+            "futex requires std::atomic<int> to have the same layout as int");
+        return syscall(SYS_futex, reinterpret_cast<int*>(&state_), op, value,
+                ptimeout, nullptr, 0);
+    }
+#else
+    void sleep(struct timespec const* ptimeout)
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        if(state_.load(std::memory_order_relaxed) != WAITING)
+            return;
+        if(ptimeout) {
+            auto timeout = std::chrono::seconds(ptimeout->tv_sec)
+                + std::chrono::nanoseconds(ptimeout->tv_nsec);
+            condition_.wait_for(lk, timeout);
+        } else {
+            condition_.wait(lk);
+        }
+    }
+
+    void wake()
+    {
+        // Taking the lock makes sure the waiter is either before its state
+        // check in sleep() or already waiting on the condition variable, so
+        // the notification can't get lost.
+        std::lock_guard<std::mutex> lk(mutex_);
+        condition_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+#endif
+
+    std::atomic<int> state_;
 };
 
 #endif // RECKLESS_DETAIL_SPSC_EVENT_HPP
@@ -1,9 +1,13 @@
 #ifndef RECKLESS_DETAIL_INPUT_HPP
 #define RECKLESS_DETAIL_INPUT_HPP
 
+#include "reckless/log_options.hpp"
+#include "reckless/log_stats.hpp"
 #include "reckless/detail/spsc_event.hpp"
+#include "reckless/detail/buffer_memory.hpp"
 #include "reckless/output_buffer.hpp"
-#include "reckless/detail/utility.hpp"    // is_power_of_two
+#include "reckless/detail/utility.hpp"    // is_power_of_two, single_writer_add
+#include "reckless/detail/branch_hints.hpp" // likely
 
 namespace reckless {
 
@@ -25,25 +29,51 @@ formatter_dispatch_function_t* const WRAPAROUND_MARKER = reinterpret_cast<
 
 class thread_input_buffer {
 public:
-    static thread_input_buffer* create(std::size_t size)
+    // Must be called from the thread that is going to write to the buffer;
+    // see prepare_buffer_memory().
+    static thread_input_buffer* create(basic_log* powner, std::size_t size,
+            overflow_policy policy, buffer_memory_options const& memory_options)
     {
         std::size_t full_size = sizeof(thread_input_buffer) + size - sizeof(formatter_dispatch_function_t*);
-        char* buf = new char[full_size];
+        buffer_memory memory = allocate_buffer_memory(full_size, memory_options);
+        prepare_buffer_memory(memory, memory_options);
         try {
-            return new (buf) thread_input_buffer(size);
+            return new (memory.p) thread_input_buffer(powner, size, policy, memory);
         } catch(...) {
-            delete [] buf;
+            free_buffer_memory(memory);
             throw;
         }
     }
 
     static void destroy(thread_input_buffer* p)
     {
+        buffer_memory memory = p->memory_;
         p->~thread_input_buffer();
-        delete [] static_cast<char*>(static_cast<void*>(p));
+        free_buffer_memory(memory);
+    }
+
+    // Puts a drained buffer back in the state it had when it was created, so
+    // that another thread can use it without a new allocation.
+    static thread_input_buffer* recycle(thread_input_buffer* p,
+            basic_log* powner, overflow_policy policy)
+    {
+        std::size_t size = p->size_;
+        buffer_memory memory = p->memory_;
+        p->~thread_input_buffer();
+        return new (p) thread_input_buffer(powner, size, policy, memory);
+    }
+    // The space that a frame of the given size takes up in an input buffer.
+    // A buffer can only hold frames whose aligned size is smaller than the
+    // buffer.
+    static std::size_t aligned_frame_size(std::size_t size)
+    {
+        return (size + frame_alignment_mask()) & ~frame_alignment_mask();
     }
     // returns pointer to allocated input frame, moves input_end() forward.
     char* allocate_input_frame(std::size_t size);
+    // Same as above, but returns nullptr instead of waiting if there is no
+    // room.
+    char* try_allocate_input_frame(std::size_t size);
     // returns pointer to following input frame
     char* discard_input_frame(std::size_t size);
     char* wraparound();
@@ -55,12 +85,150 @@ public:
     {
         return pinput_end_;
     }
+    // The commit end is only maintained when the log has no shared queue (see
+    // shared_input_queue_policy::none). In that case this is how the thread
+    // tells the output thread how far it may read. Both operations are
+    // sequentially consistent since the output thread relies on them to
+    // decide whether it is safe to go to sleep (see
+    // basic_log::park_output_worker()).
+    char* commit_end() const
+    {
+        return pcommit_end_.load(std::memory_order_seq_cst);
+    }
+    void publish_commit_end(char* pcommit_end)
+    {
+        pcommit_end_.store(pcommit_end, std::memory_order_seq_cst);
+    }
+    // True if frames have been allocated since the last call to
+    // mark_committed(), i.e. the thread is in the middle of a batch.
+    bool has_uncommitted_input() const
+    {
+        return pcommitted_end_ != pinput_end_;
+    }
+    void mark_committed()
+    {
+        pcommitted_end_ = pinput_end_;
+    }
+    basic_log* owner() const
+    {
+        return powner_;
+    }
+    overflow_policy get_overflow_policy() const
+    {
+        return overflow_policy_;
+    }
+    void set_overflow_policy(overflow_policy policy)
+    {
+        overflow_policy_ = policy;
+    }
+    // Number of frames that have been dropped due to the overflow policy.
+    unsigned long dropped_count() const
+    {
+        return dropped_count_.load(std::memory_order_relaxed);
+    }
+    void count_dropped_frame()
+    {
+        single_writer_add(dropped_count_, 1ul);
+    }
+
+    // Counters for basic_log::stats(). Like the drop counter, they are only
+    // written by the thread that owns the buffer.
+    void count_enqueued_frame()
+    {
+        single_writer_add(frames_enqueued_, std::uint64_t(1));
+    }
+    void count_shared_queue_full_stall(std::uint64_t nanoseconds)
+    {
+        single_writer_add(shared_queue_full_stalls_, std::uint64_t(1));
+        single_writer_add(shared_queue_full_stall_ns_, nanoseconds);
+    }
+    // Counts for this buffer only.
+    producer_stats stats() const;
+    // Counts for all buffers that the owning thread has used, i.e. including
+    // the ones this buffer replaced.
+    thread_stats thread_totals() const;
+    // Called when the thread switches from other to this buffer.
+    void inherit_stats(thread_input_buffer const& other)
+    {
+        inherited_stats_ = other.thread_totals();
+    }
+    long thread_id() const
+    {
+        return thread_id_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+    // The NUMA node of the thread that allocated the buffer, if we were asked
+    // to keep track of it; otherwise -1.
+    int numa_node() const
+    {
+        return memory_.numa_node;
+    }
+    // The size this thread's buffer should go back to once a burst is over.
+    std::size_t base_size() const
+    {
+        return base_size_;
+    }
+    void set_base_size(std::size_t size)
+    {
+        base_size_ = size;
+    }
+
+    // When a thread switches to a new input buffer, the old one is retired.
+    // The thread won't write to it again, and the output thread frees it once
+    // it has consumed everything in it. Until then, the new buffer keeps a
+    // pointer to the old one so that the output thread can make sure to
+    // consume the old data first when there is no shared queue to keep them
+    // in order.
+    void retire()
+    {
+        retired_.store(true, std::memory_order_release);
+    }
+    bool is_retired() const
+    {
+        return retired_.load(std::memory_order_acquire);
+    }
+    thread_input_buffer* predecessor() const
+    {
+        return ppredecessor_;
+    }
+    void set_predecessor(thread_input_buffer* p)
+    {
+        ppredecessor_ = p;
+    }
+
+    // Set by the output thread when a buffer that has grown has been idle for
+    // a while. The owning thread then swaps it for one of the base size next
+    // time it writes.
+    void request_shrink()
+    {
+        shrink_requested_.store(true, std::memory_order_relaxed);
+    }
+    bool is_shrink_requested() const
+    {
+        return shrink_requested_.load(std::memory_order_relaxed);
+    }
+    void clear_shrink_request()
+    {
+        shrink_requested_.store(false, std::memory_order_relaxed);
+    }
     void signal_input_consumed();
 
     bool input_consumed_flag;
+    // How many of the dropped frames the output thread has told the world
+    // about. Only accessed under the registry lock in shared_input_queue, or
+    // after the buffer has been unregistered.
+    unsigned long reported_dropped_count;
+    // Where the output thread found input_start() when it last checked whether
+    // the buffer is idle. Only used by the output thread.
+    char* last_swept_input_start;
 
 private:
-    thread_input_buffer(std::size_t size);
+    thread_input_buffer(basic_log* powner, std::size_t size,
+            overflow_policy policy, buffer_memory const& memory);
     ~thread_input_buffer();
     
     char* advance_frame_pointer(char* p, std::size_t distance);
@@ -86,10 +254,27 @@ private:
     }
 
     spsc_event input_consumed_event_;
+    buffer_memory memory_;
+    basic_log* powner_;
+    long thread_id_;
     std::size_t size_;                // number of chars in buffer
+    std::size_t base_size_;
+    overflow_policy overflow_policy_;
+    std::atomic<unsigned long> dropped_count_;  // only written by logger::write
+    std::atomic<std::uint64_t> frames_enqueued_;
+    std::atomic<std::uint64_t> input_buffer_full_stalls_;
+    std::atomic<std::uint64_t> input_buffer_full_stall_ns_;
+    std::atomic<std::uint64_t> shared_queue_full_stalls_;
+    std::atomic<std::uint64_t> shared_queue_full_stall_ns_;
+    producer_stats inherited_stats_;
+    std::atomic<bool> retired_;
+    std::atomic<bool> shrink_requested_;
+    thread_input_buffer* ppredecessor_;  // set by logger::write before registering, cleared by output thread
 
     std::atomic<char*> pinput_start_; // moved forward by output thread, read by logger::write (to determine free space left)
     char* pinput_end_;                // moved forward by logger::write, never read by anyone else
+    char* pcommitted_end_;            // end of the data handed to the output thread, only used by logger::write
+    std::atomic<char*> pcommit_end_;  // moved forward by logger::write, read by output thread (only without shared queue)
     formatter_dispatch_function_t* buffer_start_;
 };
 
@@ -0,0 +1,28 @@
+#ifndef RECKLESS_DETAIL_TIMESTAMP_RENDERER_HPP
+#define RECKLESS_DETAIL_TIMESTAMP_RENDERER_HPP
+
+#include <cstdint>  // int64_t, uint32_t
+#include <cstddef>  // size_t
+
+namespace reckless {
+namespace detail {
+
+// "YYYY-mm-dd HH:MM:SS.nnnnnnnnn"
+std::size_t const MAX_TIMESTAMP_LENGTH = 29;
+
+// Writes `seconds` since the epoch as "YYYY-mm-dd HH:MM:SS" to p, followed by
+// a decimal point and the first `digits` (at most 9) digits of `nanoseconds`
+// if digits is nonzero. Returns a pointer past the last character written;
+// no NUL is added.
+//
+// Breaking the time down with localtime_r and strftime is slow, and
+// localtime_r may take a lock in libc, so each thread keeps the last second
+// that it rendered and reuses the text for as long as the second doesn't
+// change. Most of the time this amounts to a memcpy and a few digits.
+char* render_timestamp(char* p, std::int64_t seconds,
+        std::uint32_t nanoseconds, unsigned digits, bool utc);
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_TIMESTAMP_RENDERER_HPP
@@ -0,0 +1,59 @@
+#ifndef RECKLESS_DETAIL_TSC_CLOCK_HPP
+#define RECKLESS_DETAIL_TSC_CLOCK_HPP
+
+#include "reckless/detail/branch_hints.hpp" // likely
+
+#include <atomic>
+#include <cstdint>  // uint64_t, int64_t
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc
+#define RECKLESS_HAVE_TSC 1
+#endif
+
+namespace reckless {
+class output_buffer;
+
+namespace detail {
+
+// A cheap monotonic clock for timestamping log entries on the producer side.
+// The ticks are read from the CPU's time-stamp counter if it runs at a
+// constant rate and doesn't stop in sleep states (an "invariant" TSC), and
+// are otherwise CLOCK_MONOTONIC_RAW nanoseconds. Only the output thread turns
+// them into wall-clock time, with tsc_clock_to_realtime().
+enum tsc_clock_source {
+    TSC_CLOCK_UNKNOWN,
+    TSC_CLOCK_TSC,
+    TSC_CLOCK_MONOTONIC_RAW
+};
+
+// Set the first time the clock is read, or during static initialization,
+// whichever comes first.
+extern std::atomic<int> g_tsc_clock_source;
+
+std::uint64_t tsc_clock_ticks_slow();
+
+inline std::uint64_t tsc_clock_ticks()
+{
+#ifdef RECKLESS_HAVE_TSC
+    if(likely(g_tsc_clock_source.load(std::memory_order_relaxed) == TSC_CLOCK_TSC))
+        return __rdtsc();
+#endif
+    return tsc_clock_ticks_slow();
+}
+
+// Converts a value from tsc_clock_ticks() to nanoseconds since the epoch.
+// Each thread that calls this keeps its own calibration of the clock against
+// CLOCK_REALTIME, which it refreshes about once per second. That makes up for
+// the clock drifting against the system time, e.g. when NTP adjusts it.
+std::int64_t tsc_clock_to_realtime(std::uint64_t ticks);
+
+// Formats nanoseconds since the epoch as "YYYY-mm-dd HH:MM:SS.nnnnnnnnn",
+// cut down to `digits` decimals, in local time or UTC.
+void format_nanosecond_timestamp(output_buffer* pbuffer, std::int64_t ns,
+        unsigned digits = 9, bool utc = false);
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_DETAIL_TSC_CLOCK_HPP
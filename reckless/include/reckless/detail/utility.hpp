@@ -1,6 +1,7 @@
 #ifndef RECKLESS_DETAIL_UTILITY_HPP
 #define RECKLESS_DETAIL_UTILITY_HPP
 
+#include <atomic>
 #include <cstddef>  // size_t
 #include <cstdint>  // uintptr_t
 
@@ -35,6 +36,33 @@ std::size_t get_page_size() __attribute__ ((const));
 //// cache_line_size instead.
 //std::size_t get_cache_line_size() __attribute__((const));
 void prefetch(void const* ptr, std::size_t size);
+// Kernel id of the calling thread.
+long current_thread_id();
+// Bumps the counter of an eventfd (e.g. basic_log::flush_notification_fd()),
+// which makes it readable. Does nothing if fd is -1.
+void signal_eventfd(int fd);
+
+// Adds to a counter that only the calling thread ever writes to. Other
+// threads may read it, so it needs to be atomic, but with a single writer we
+// don't need a locked read-modify-write.
+template <class T>
+void single_writer_add(std::atomic<T>& counter, T value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+            std::memory_order_relaxed);
+}
+
+// Hint to the CPU that we're in a spin-wait loop.
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
 //
 inline constexpr bool is_power_of_two(std::size_t v)
 {
@@ -0,0 +1,250 @@
+#ifndef RECKLESS_ELEMENTS_HPP
+#define RECKLESS_ELEMENTS_HPP
+
+#include <reckless/frame_string.hpp>    // frame_argument, captured_size, frame_value
+
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>  // uintptr_t
+#include <cstring>  // memcpy
+#include <type_traits>  // is_arithmetic, is_same, remove_cv
+#include <vector>
+#include <ciso646>
+
+namespace reckless {
+
+namespace detail {
+template <typename T>
+struct is_element_type {
+    typedef typename std::remove_cv<T>::type type;
+    static bool const value = std::is_arithmetic<type>::value
+        and not std::is_same<type, bool>::value
+        and not std::is_same<type, char>::value
+        and not std::is_same<type, signed char>::value
+        and not std::is_same<type, unsigned char>::value
+        and not std::is_same<type, wchar_t>::value
+        and not std::is_same<type, char16_t>::value
+        and not std::is_same<type, char32_t>::value;
+};
+}   // namespace detail
+
+// An array of numbers to be logged as one argument. The log copies the
+// elements into the calling thread's input buffer, like it does with
+// strings, so the array may change or go away as soon as write() returns.
+// The format specifier applies to each element, and the elements are
+// separated by `separator`, which is kept as a pointer and must live for the
+// rest of the program like a format string does.
+//
+//     g_log.write("bids %.2f", reckless::elements(prices, levels));
+//     g_log.write("latencies %d", reckless::elements(samples, ", "));
+//
+template <typename T>
+class element_range {
+public:
+    static_assert(detail::is_element_type<T>::value,
+        "elements() takes arrays of integers or floating-point numbers, "
+        "other than bool and the character types");
+
+    element_range(T const* pdata, std::size_t size, char const* separator) :
+        pdata_(pdata),
+        size_(size),
+        separator_(separator)
+    {
+    }
+
+    T const* data() const
+    {
+        return pdata_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    char const* separator() const
+    {
+        return separator_;
+    }
+
+private:
+    T const* pdata_;
+    std::size_t size_;
+    char const* separator_;
+};
+
+template <typename T>
+element_range<T> elements(T const* pdata, std::size_t size,
+        char const* separator = " ")
+{
+    return element_range<T>(pdata, size, separator);
+}
+
+template <typename T, std::size_t N>
+element_range<T> elements(T const (&array)[N], char const* separator = " ")
+{
+    return element_range<T>(array, N, separator);
+}
+
+template <typename T, std::size_t N>
+element_range<T> elements(std::array<T, N> const& array,
+        char const* separator = " ")
+{
+    return element_range<T>(array.data(), N, separator);
+}
+
+template <typename T, class Allocator>
+element_range<T> elements(std::vector<T, Allocator> const& v,
+        char const* separator = " ")
+{
+    return element_range<T>(v.data(), v.size(), separator);
+}
+
+// What a formatter gets in place of an element_range. Like frame_string it
+// refers to the copy in the input buffer, and is only valid for the duration
+// of the call to the formatter.
+template <typename T>
+class frame_elements {
+public:
+    frame_elements(T const* pdata, std::size_t size, char const* separator) :
+        pdata_(pdata),
+        size_(size),
+        separator_(separator)
+    {
+    }
+
+    T const* data() const
+    {
+        return pdata_;
+    }
+    T const* begin() const
+    {
+        return pdata_;
+    }
+    T const* end() const
+    {
+        return pdata_ + size_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    T operator[](std::size_t index) const
+    {
+        return pdata_[index];
+    }
+    char const* separator() const
+    {
+        return separator_;
+    }
+
+private:
+    T const* pdata_;
+    std::size_t size_;
+    char const* separator_;
+};
+
+namespace detail {
+
+// How an element_range is stored in the input frame: the elements follow
+// the argument tuple, or go on the heap if the frame would be too large,
+// just like captured_string. The tail of the frame has no particular
+// alignment, so we leave room to align the elements within it.
+template <typename T>
+class captured_elements {
+public:
+    static std::size_t inline_size(std::size_t size)
+    {
+        return size*sizeof(T) + alignof(T) - 1;
+    }
+
+    // Copies the elements to ptail and moves ptail past the space reserved
+    // for them, or copies them to the heap if ptail is null.
+    captured_elements(char*& ptail, element_range<T> const& range) :
+        size_(range.size()),
+        separator_(range.separator()),
+        heap_(ptail == nullptr)
+    {
+        T* p;
+        if(heap_) {
+            p = new T[size_];
+        } else {
+            auto address = reinterpret_cast<std::uintptr_t>(ptail);
+            address = (address + alignof(T) - 1)/alignof(T)*alignof(T);
+            p = reinterpret_cast<T*>(address);
+            ptail += inline_size(size_);
+        }
+        if(size_ != 0)
+            std::memcpy(p, range.data(), size_*sizeof(T));
+        pdata_ = p;
+    }
+
+    captured_elements(captured_elements&& other) noexcept :
+        pdata_(other.pdata_),
+        size_(other.size_),
+        separator_(other.separator_),
+        heap_(other.heap_)
+    {
+        other.heap_ = false;
+    }
+
+    captured_elements(captured_elements const&) = delete;
+    captured_elements& operator=(captured_elements const&) = delete;
+
+    ~captured_elements()
+    {
+        if(heap_)
+            delete[] pdata_;
+    }
+
+    frame_elements<T> value() const
+    {
+        return frame_elements<T>(pdata_, size_, separator_);
+    }
+    // Number of bytes used after the argument tuple.
+    std::size_t inline_size() const
+    {
+        return heap_? 0 : inline_size(size_);
+    }
+
+private:
+    T const* pdata_;
+    std::size_t size_;
+    char const* separator_;
+    bool heap_;
+};
+
+template <typename T>
+struct frame_argument<element_range<T>> {
+    typedef captured_elements<T> type;
+
+    static std::size_t inline_size(element_range<T> const& range)
+    {
+        return captured_elements<T>::inline_size(range.size());
+    }
+
+    static captured_elements<T> capture(char*& ptail,
+            element_range<T> const& range)
+    {
+        return captured_elements<T>(ptail, range);
+    }
+};
+
+template <typename T>
+std::size_t captured_size(captured_elements<T> const& captured)
+{
+    return captured.inline_size();
+}
+
+template <typename T>
+frame_elements<T> frame_value(captured_elements<T>& captured)
+{
+    return captured.value();
+}
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_ELEMENTS_HPP
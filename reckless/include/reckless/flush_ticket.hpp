@@ -0,0 +1,85 @@
+#ifndef RECKLESS_FLUSH_TICKET_HPP
+#define RECKLESS_FLUSH_TICKET_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>   // shared_ptr
+#include <mutex>
+
+namespace reckless {
+namespace detail {
+
+// Shared between a flush_ticket and the output thread, which completes it.
+// Any number of threads may wait for the same request, with or without a
+// timeout, so unlike most of our waiting this uses a condition variable
+// rather than an spsc_event. Completing a request is rare enough that the
+// mutex doesn't matter.
+struct flush_request {
+    flush_request() : done(false)
+    {
+    }
+
+    void complete()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            done.store(true, std::memory_order_release);
+        }
+        completed.notify_all();
+    }
+
+    std::atomic<bool> done;
+    std::mutex mutex;
+    std::condition_variable completed;
+};
+
+}   // namespace detail
+
+// Returned by basic_log::flush_async(). The ticket is done when everything
+// that was committed to the log before the flush_async() call has been passed
+// to the writer. Tickets can be copied, and the copies may be waited on from
+// different threads.
+class flush_ticket {
+public:
+    // A ticket that is already done.
+    flush_ticket()
+    {
+    }
+
+    explicit flush_ticket(std::shared_ptr<detail::flush_request> prequest) :
+        prequest_(std::move(prequest))
+    {
+    }
+
+    bool done() const
+    {
+        return not prequest_ or prequest_->done.load(std::memory_order_acquire);
+    }
+
+    void wait()
+    {
+        if(done())
+            return;
+        std::unique_lock<std::mutex> lk(prequest_->mutex);
+        prequest_->completed.wait(lk, [this]() { return done(); });
+    }
+
+    // Returns false if the ticket wasn't done within the given time.
+    bool wait(unsigned milliseconds)
+    {
+        if(done())
+            return true;
+        std::unique_lock<std::mutex> lk(prequest_->mutex);
+        return prequest_->completed.wait_for(lk,
+                std::chrono::milliseconds(milliseconds),
+                [this]() { return done(); });
+    }
+
+private:
+    std::shared_ptr<detail::flush_request> prequest_;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_FLUSH_TICKET_HPP
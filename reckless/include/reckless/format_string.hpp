@@ -0,0 +1,165 @@
+#ifndef RECKLESS_FORMAT_STRING_HPP
+#define RECKLESS_FORMAT_STRING_HPP
+
+#include <reckless/ntoa.hpp>  // conversion_specification
+#include <reckless/detail/format_check.hpp>
+
+#include <atomic>
+#include <cstddef>  // size_t
+#include <string>
+#include <vector>
+
+namespace reckless {
+namespace detail {
+
+// A format specifier as parsed by format_plan. The format functions for the
+// built-in types use spec and conversion directly; format functions for
+// other types get ptext like they would without a plan.
+struct format_specifier {
+    // Just past the '%'.
+    char const* ptext;
+    // Just past the conversion character, i.e. where the text after the
+    // specifier starts.
+    char const* pend;
+    conversion_specification spec;
+    char conversion;
+
+    // True if the conversion character comes right after the '%', with no
+    // flags, width or precision in between.
+    bool bare() const
+    {
+        return ptext + 1 == pend;
+    }
+};
+
+// A piece of literal text followed by a specifier. The text has "%%"
+// replaced with "%". The last segment of a plan has no specifier.
+struct format_segment {
+    char const* pliteral;
+    std::size_t literal_size;
+    bool has_specifier;
+    format_specifier specifier;
+};
+
+// A format string split up into segments, so that formatting a message only
+// has to copy the literal text and convert the arguments, instead of
+// scanning for '%' and parsing specifiers each time.
+class format_plan {
+public:
+    explicit format_plan(char const* pformat);
+
+    format_segment const* segments() const
+    {
+        return segments_.data();
+    }
+
+private:
+    std::string literals_;
+    std::vector<format_segment> segments_;
+};
+
+// The static object behind each RECKLESS_FMT call site. It is constant
+// initialized, so the call site pays nothing for it; the plan is built by
+// the output thread the first time it formats a message from the site.
+class format_site {
+public:
+    constexpr explicit format_site(char const* pformat) :
+        pformat_(pformat),
+        pplan_(nullptr)
+    {
+    }
+
+    char const* c_str() const
+    {
+        return pformat_;
+    }
+
+    format_plan const* plan() const
+    {
+        format_plan const* pplan = pplan_.load(std::memory_order_acquire);
+        if(pplan)
+            return pplan;
+        return create_plan();
+    }
+
+private:
+    format_plan const* create_plan() const;
+
+    char const* pformat_;
+    // Plans are never freed, since a call site lives as long as the program.
+    mutable std::atomic<format_plan const*> pplan_;
+};
+
+}   // namespace detail
+
+// A format string that is only parsed once per call site. Create one with
+// RECKLESS_FMT and pass it to the log in place of a plain format string.
+class format_string {
+public:
+    explicit format_string(detail::format_site const* psite) :
+        psite_(psite)
+    {
+    }
+
+    char const* c_str() const
+    {
+        return psite_->c_str();
+    }
+
+    detail::format_plan const* plan() const
+    {
+        return psite_->plan();
+    }
+
+private:
+    detail::format_site const* psite_;
+};
+
+namespace detail {
+// Turns the result of check_format() into compile errors for
+// RECKLESS_CHECKED_FMT.
+template <unsigned long Result>
+format_string checked_format_string(format_string fmt)
+{
+    static_assert(Result % 4 != FORMAT_TOO_FEW_ARGUMENTS,
+        "format string has more specifiers than there are arguments");
+    static_assert(Result % 4 != FORMAT_TOO_MANY_ARGUMENTS,
+        "format string has fewer specifiers than there are arguments");
+    static_assert(format_argument_mismatch<Result % 4 == FORMAT_ARGUMENT_MISMATCH?
+        Result / 4 : 0>::ok, "");
+    return fmt;
+}
+}   // namespace detail
+
+}   // namespace reckless
+
+// Wraps a string literal for use as a format string, e.g.
+//
+//     g_log.write(RECKLESS_FMT("%s: %d items"), name, count);
+//
+// The output thread parses the string the first time the call site is
+// logged, and reuses the result for all later messages from the same call
+// site. The output is exactly the same as with a plain format string.
+#define RECKLESS_FMT(literal) \
+    ([]() -> ::reckless::format_string { \
+        static ::reckless::detail::format_site const site("" literal); \
+        return ::reckless::format_string(&site); \
+    }())
+
+// Like RECKLESS_FMT, but also checks the format string against the arguments
+// at compile time. It takes the arguments too, and expands to the format
+// string followed by the arguments:
+//
+//     g_log.write(RECKLESS_CHECKED_FMT("%s: %d items", name, count));
+//
+// A specifier that the argument type can't be formatted with (e.g. %d for a
+// double, or %s for an int), or a different number of specifiers and
+// arguments, is a compile error. Arguments of types with their own format()
+// functions are not checked. The arguments are only evaluated once.
+#define RECKLESS_CHECKED_FMT(literal, ...) \
+    ::reckless::detail::checked_format_string< \
+        ::reckless::detail::check_format("" literal, 0, sizeof(literal) - 1, \
+            decltype(::reckless::detail::classify_format_arguments( \
+                __VA_ARGS__))::value, 0)>(RECKLESS_FMT(literal)), ##__VA_ARGS__
+
+#endif  // RECKLESS_FORMAT_STRING_HPP
@@ -0,0 +1,278 @@
+#ifndef RECKLESS_FRAME_STRING_HPP
+#define RECKLESS_FRAME_STRING_HPP
+
+#include <cstddef>  // size_t
+#include <cstring>  // strlen, memcpy
+#include <string>
+#include <tuple>
+#include <utility>  // forward, move
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include <ciso646>
+
+#include <reckless/detail/utility.hpp>  // index_sequence
+
+namespace reckless {
+
+// A char const* argument that the log should copy, because the string may
+// change or go away before the output thread gets to it. A plain char const*
+// is passed on as a pointer, which is only safe for string literals and other
+// strings that live for the rest of the program.
+//
+//     g_log.write("opened %s", reckless::transient(path));
+//
+class transient_string {
+public:
+    explicit transient_string(char const* s) :
+        pdata_(s),
+        size_(std::strlen(s))
+    {
+    }
+    transient_string(char const* s, std::size_t size) :
+        pdata_(s),
+        size_(size)
+    {
+    }
+
+    char const* data() const
+    {
+        return pdata_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    char const* pdata_;
+    std::size_t size_;
+};
+
+inline transient_string transient(char const* s)
+{
+    return transient_string(s);
+}
+
+inline transient_string transient(char const* s, std::size_t size)
+{
+    return transient_string(s, size);
+}
+
+// What a formatter gets in place of a std::string, transient_string or
+// std::string_view argument. The log copies the characters into the calling
+// thread's input buffer right after the other arguments, so that writing a
+// string doesn't allocate memory, and frame_string refers to the copy. It is
+// only valid for the duration of the call to the formatter. The characters
+// are followed by a null terminator.
+class frame_string {
+public:
+    frame_string(char const* pdata, std::size_t size) :
+        pdata_(pdata),
+        size_(size)
+    {
+    }
+
+    char const* data() const
+    {
+        return pdata_;
+    }
+    char const* c_str() const
+    {
+        return pdata_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::string str() const
+    {
+        return std::string(pdata_, size_);
+    }
+    // For formatters that were written for std::string arguments.
+    operator std::string() const
+    {
+        return str();
+    }
+
+private:
+    char const* pdata_;
+    std::size_t size_;
+};
+
+namespace detail {
+
+// How a string argument is stored in the input frame. Normally the
+// characters follow the argument tuple. If that would make the frame too
+// large for the input buffer, they go on the heap instead and the output
+// thread frees them.
+class captured_string {
+public:
+    // Copies the string to ptail and moves ptail past the copy, or copies it
+    // to the heap if ptail is null.
+    captured_string(char*& ptail, char const* s, std::size_t size) :
+        size_(size),
+        heap_(ptail == nullptr)
+    {
+        char* p = heap_? new char[size + 1] : ptail;
+        if(size != 0)
+            std::memcpy(p, s, size);
+        p[size] = '\0';
+        pdata_ = p;
+        if(not heap_)
+            ptail += size + 1;
+    }
+
+    captured_string(captured_string&& other) noexcept :
+        pdata_(other.pdata_),
+        size_(other.size_),
+        heap_(other.heap_)
+    {
+        other.heap_ = false;
+    }
+
+    captured_string(captured_string const&) = delete;
+    captured_string& operator=(captured_string const&) = delete;
+
+    ~captured_string()
+    {
+        if(heap_)
+            delete[] pdata_;
+    }
+
+    char const* data() const
+    {
+        return pdata_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    // Number of bytes used after the argument tuple.
+    std::size_t inline_size() const
+    {
+        return heap_? 0 : size_ + 1;
+    }
+
+private:
+    char const* pdata_;
+    std::size_t size_;
+    bool heap_;
+};
+
+// Tells how an argument of type T is stored in the input frame. Most types
+// are stored as they are; strings are captured.
+template <typename T>
+struct frame_argument {
+    typedef T type;
+
+    static std::size_t inline_size(T const&)
+    {
+        return 0;
+    }
+
+    template <typename U>
+    static U&& capture(char*&, U&& value)
+    {
+        return std::forward<U>(value);
+    }
+};
+
+template <>
+struct frame_argument<std::string> {
+    typedef captured_string type;
+
+    static std::size_t inline_size(std::string const& s)
+    {
+        return s.size() + 1;
+    }
+
+    static captured_string capture(char*& ptail, std::string const& s)
+    {
+        return captured_string(ptail, s.data(), s.size());
+    }
+};
+
+template <>
+struct frame_argument<transient_string> {
+    typedef captured_string type;
+
+    static std::size_t inline_size(transient_string const& s)
+    {
+        return s.size() + 1;
+    }
+
+    static captured_string capture(char*& ptail, transient_string const& s)
+    {
+        return captured_string(ptail, s.data(), s.size());
+    }
+};
+
+#if __cplusplus >= 201703L
+template <>
+struct frame_argument<std::string_view> {
+    typedef captured_string type;
+
+    static std::size_t inline_size(std::string_view s)
+    {
+        return s.size() + 1;
+    }
+
+    static captured_string capture(char*& ptail, std::string_view s)
+    {
+        return captured_string(ptail, s.data(), s.size());
+    }
+};
+#endif
+
+inline std::size_t sum_sizes()
+{
+    return 0;
+}
+
+template <typename... Sizes>
+std::size_t sum_sizes(std::size_t first, Sizes... rest)
+{
+    return first + sum_sizes(rest...);
+}
+
+// The output thread's side of things: how many bytes each stored argument
+// took up after the tuple, and what to pass to the formatter.
+template <typename T>
+std::size_t captured_size(T const&)
+{
+    return 0;
+}
+
+inline std::size_t captured_size(captured_string const& s)
+{
+    return s.inline_size();
+}
+
+template <typename... Args, std::size_t... Indexes>
+std::size_t captured_size(std::tuple<Args...> const& args,
+        index_sequence<Indexes...>)
+{
+    return sum_sizes(captured_size(std::get<Indexes>(args))...);
+}
+
+template <typename T>
+T&& frame_value(T& value)
+{
+    return std::move(value);
+}
+
+inline frame_string frame_value(captured_string& s)
+{
+    return frame_string(s.data(), s.size());
+}
+
+}   // namespace detail
+}   // namespace reckless
+
+#endif  // RECKLESS_FRAME_STRING_HPP
@@ -0,0 +1,99 @@
+#ifndef RECKLESS_LATENCY_HISTOGRAM_HPP
+#define RECKLESS_LATENCY_HISTOGRAM_HPP
+
+#include <cstddef>  // size_t
+#include <cstdint>  // uint64_t
+
+namespace reckless {
+namespace detail {
+class latency_recorder;
+}
+
+// Histogram of latencies in nanoseconds, with logarithmic buckets in the style
+// of HdrHistogram. Values below 16 get a bucket each; above that, every power
+// of two is split into 16 buckets, so a value is never off by more than 1/16
+// (about 6%). That covers the full 64-bit range in under a thousand buckets.
+class latency_histogram {
+public:
+    static unsigned const SUB_BUCKET_BITS = 4;
+    static std::size_t const SUB_BUCKET_COUNT = std::size_t(1) << SUB_BUCKET_BITS;
+    static std::size_t const BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1)*SUB_BUCKET_COUNT;
+
+    latency_histogram();
+
+    void record(std::uint64_t value)
+    {
+        ++counts_[bucket_index(value)];
+        ++count_;
+        sum_ += value;
+    }
+
+    std::uint64_t count() const
+    {
+        return count_;
+    }
+    // Smallest and largest recorded values, rounded to the bucket they fall
+    // in (lower and upper bound respectively). 0 if nothing was recorded.
+    std::uint64_t min() const;
+    std::uint64_t max() const;
+    double mean() const
+    {
+        return count_ == 0? 0.0 : static_cast<double>(sum_)/count_;
+    }
+    // The value that the given percentage (0-100) of the samples are at or
+    // below, rounded up to the upper bound of its bucket.
+    std::uint64_t percentile(double percent) const;
+
+    // For turning two cumulative snapshots into the histogram for the time
+    // between them.
+    latency_histogram& operator-=(latency_histogram const& earlier);
+
+    std::uint64_t bucket_sample_count(std::size_t index) const
+    {
+        return counts_[index];
+    }
+    static std::size_t bucket_index(std::uint64_t value)
+    {
+        if(value < SUB_BUCKET_COUNT)
+            return static_cast<std::size_t>(value);
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+        unsigned shift = msb - SUB_BUCKET_BITS;
+        std::size_t sub = static_cast<std::size_t>(value >> shift) & (SUB_BUCKET_COUNT-1);
+        return (shift + 1)*SUB_BUCKET_COUNT + sub;
+    }
+    static std::uint64_t bucket_lower_bound(std::size_t index)
+    {
+        if(index < SUB_BUCKET_COUNT)
+            return index;
+        unsigned shift = static_cast<unsigned>(index/SUB_BUCKET_COUNT - 1);
+        std::uint64_t sub = index % SUB_BUCKET_COUNT;
+        return (SUB_BUCKET_COUNT + sub) << shift;
+    }
+    static std::uint64_t bucket_upper_bound(std::size_t index)
+    {
+        if(index + 1 == BUCKET_COUNT)
+            return ~std::uint64_t(0);
+        return bucket_lower_bound(index + 1) - 1;
+    }
+
+private:
+    friend class detail::latency_recorder;
+
+    std::uint64_t counts_[BUCKET_COUNT];
+    std::uint64_t count_;
+    std::uint64_t sum_;
+};
+
+// Latencies measured by basic_log when log_options::measure_latency is set,
+// from the time a thread calls write() until the background thread
+//
+// * has formatted the entry (enqueue_to_format), and
+// * has passed the formatted entry to writer::write() (enqueue_to_write).
+struct latency_stats {
+    latency_histogram enqueue_to_format;
+    latency_histogram enqueue_to_write;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_LATENCY_HISTOGRAM_HPP
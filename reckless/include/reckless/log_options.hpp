@@ -0,0 +1,197 @@
+#ifndef RECKLESS_LOG_OPTIONS_HPP
+#define RECKLESS_LOG_OPTIONS_HPP
+
+#include <cstddef>  // size_t
+#include <climits>  // INT_MIN
+#include <string>
+#include <vector>
+
+namespace reckless {
+
+// Selects how application threads hand committed log data over to the output
+// thread.
+enum class shared_input_queue_policy {
+    // Fixed-size Boost.Lockfree queue. Every write() does a CAS-based push on
+    // the queue.
+    boost_lockfree,
+    // Bounded array queue using per-cell sequence numbers (Dmitry Vyukov's
+    // design). Producers still share one enqueue counter, but a push touches
+    // only that counter and the cell it claims, and there is no node
+    // allocation or ABA-tagging involved.
+    mpsc_array,
+    // No shared queue at all. Each thread publishes its commit position in its
+    // own input buffer, and the output thread polls a registry of all input
+    // buffers. This removes the shared cache line from the write path
+    // entirely, at the cost of giving up global ordering between threads.
+    none
+};
+
+// Decides what the output thread does when there is no input to process.
+enum class idle_policy {
+    // Sleep with an exponentially growing timeout, up to one second. Threads
+    // that write to the log wake the output thread up when it is asleep, so
+    // the timeout only bounds how long it sleeps when nobody is writing.
+    backoff,
+    // Spin for idle_spin_count rounds, then call sched_yield for
+    // idle_yield_count rounds, then sleep until a writer wakes us up. This
+    // gives low latency for bursts without burning a core when the log is
+    // quiet, so it is a good fit for shared hosts.
+    spin_yield_park,
+    // Never sleep; poll the input queue continuously. This keeps the latency
+    // from write() to the writer as low as it gets, but the output thread
+    // will use 100% of a core. Only use this if the output thread has a core
+    // to itself.
+    busy_poll
+};
+
+// Decides what a thread does when it wants to write to the log but its input
+// buffer is full, or the shared input queue is full.
+enum class overflow_policy {
+    // Wait until the output thread has made room.
+    block,
+    // Throw away the new message instead of waiting.
+    drop_newest,
+    // Throw away the new message if it has low priority (e.g. debug and info
+    // messages in severity_log), otherwise wait.
+    drop_low_priority
+};
+
+// Decides whether buffer memory should be backed by huge pages.
+enum class huge_page_policy {
+    // Regular pages.
+    none,
+    // Ask for transparent huge pages with madvise(MADV_HUGEPAGE). The kernel
+    // only uses them for buffers that span at least one whole huge page.
+    transparent,
+    // Map explicit huge pages with MAP_HUGETLB. This requires that the system
+    // has huge pages reserved (see /proc/sys/vm/nr_hugepages); if there are
+    // none left, we fall back to regular pages. Each buffer is rounded up to
+    // a whole huge page, so this is only sensible for large buffers.
+    hugetlb
+};
+
+// Settings for basic_log::open() besides the buffer sizes. The defaults give
+// the same behavior as opening the log without any options.
+struct log_options {
+    log_options() :
+        shared_input_queue(shared_input_queue_policy::boost_lockfree),
+        idle(idle_policy::backoff),
+        idle_spin_count(4000),
+        idle_yield_count(64),
+        overflow(overflow_policy::block),
+        max_thread_input_buffer_size(0),
+        input_buffer_memory_budget(0),
+        input_buffer_shrink_delay_ms(1000),
+        input_buffer_pool_size(0),
+        huge_pages(huge_page_policy::none),
+        numa_local_input_buffers(false),
+        lock_buffers(false),
+        prefault_buffers(false),
+        output_thread_sched_policy(inherit),
+        output_thread_sched_priority(0),
+        output_thread_nice(inherit),
+        output_thread_name(),
+        measure_latency(false),
+        spill_file_size(64*1024*1024),
+        spill_retry_timeout_ms(5000)
+    {
+    }
+
+    // Leaves a setting as the output thread inherited it from the thread that
+    // called open().
+    static int const inherit = INT_MIN;
+
+    shared_input_queue_policy shared_input_queue;
+    idle_policy idle;
+    // Only used with idle_policy::spin_yield_park.
+    unsigned idle_spin_count;
+    unsigned idle_yield_count;
+    // Default for all threads. Individual threads can override it with
+    // basic_log::set_thread_overflow_policy().
+    overflow_policy overflow;
+
+    // If this is larger than the thread input buffer size, a thread whose
+    // buffer fills up gets a new buffer twice the size, up to this limit,
+    // before the overflow policy kicks in. 0 means that buffers never grow.
+    std::size_t max_thread_input_buffer_size;
+    // Upper limit on the total memory used by all thread input buffers. When
+    // the limit is reached, buffers stop growing. Every thread still gets a
+    // buffer of its base size, even if that goes over the limit. 0 means no
+    // limit.
+    std::size_t input_buffer_memory_budget;
+    // A buffer that has grown is shrunk back to its base size after the
+    // thread has not written anything for at least this long.
+    unsigned input_buffer_shrink_delay_ms;
+
+    // When a thread exits, its input buffer is kept around for reuse by new
+    // threads instead of being freed, as long as there are fewer than this
+    // many buffers waiting. This saves an allocation and page faults for each
+    // new thread in programs that start and stop a lot of threads. Only
+    // buffers of the default size are kept. 0 means buffers are always freed.
+    std::size_t input_buffer_pool_size;
+
+    // The remaining options control how buffers get their memory. Setting
+    // any of the first three makes us allocate buffers with mmap instead of
+    // malloc.
+    huge_page_policy huge_pages;
+    // Make sure each thread's input buffer sits on the NUMA node the thread
+    // runs on. The buffer's pages are placed by the thread itself the first
+    // time it touches them, and buffers from the pool are only handed to
+    // threads on the same node.
+    bool numa_local_input_buffers;
+    // Lock buffers in memory with mlock() so they can't be swapped out. If
+    // that fails (e.g. due to RLIMIT_MEMLOCK), the buffers are used unlocked.
+    bool lock_buffers;
+    // Touch every page of a buffer when it is allocated, so that a thread
+    // doesn't take page faults on its first few log calls.
+    bool prefault_buffers;
+
+    // Settings for the output thread. They are applied when open() starts the
+    // thread, and open() throws std::system_error if any of them fails,
+    // except for the name. The name is only cosmetic, so if it can't be set
+    // the thread just goes without it.
+    //
+    // CPUs that the output thread may run on. Empty means no restriction.
+    std::vector<unsigned> output_thread_cpus;
+    // One of the SCHED_* constants from <sched.h>, e.g. SCHED_FIFO, SCHED_RR
+    // or SCHED_BATCH.
+    int output_thread_sched_policy;
+    // Only meaningful for SCHED_FIFO and SCHED_RR.
+    int output_thread_sched_priority;
+    // Only meaningful for SCHED_OTHER and SCHED_BATCH.
+    int output_thread_nice;
+    // Shown by tools like top and gdb. Truncated to 15 characters. Empty
+    // leaves the thread without a name of its own.
+    std::string output_thread_name;
+
+    // Record how long log entries wait before they are formatted and before
+    // they are handed to the writer; see basic_log::latency(). This costs a
+    // clock read and 16 bytes of input buffer space per log call.
+    bool measure_latency;
+
+    // If set, the output thread no longer calls the writer itself. Instead it
+    // copies formatted output into this file, which is memory mapped and
+    // used as a ring buffer, and a separate thread passes it on to the
+    // writer. When the writer stalls (e.g. on a slow network file system) or
+    // fails with ERROR_TRY_LATER (e.g. when the disk is full), the output is
+    // held in the file until the writer recovers, and the log keeps running
+    // at full speed until spill_file_size bytes are waiting. Failed writes are
+    // retried, so nothing is lost unless the writer gives up with
+    // ERROR_GIVE_UP, or is still failing spill_retry_timeout_ms after the log
+    // starts closing or panic_flush() is called. Lost output counts as a
+    // write error in the output buffer, as it would without a spill file, so
+    // binary_log still starts a new stream after it. Put the file on a local
+    // disk or a tmpfs, not on the device that the writer is stuck on. The
+    // file is created when the log is opened and deleted when it is closed.
+    //
+    // With a spill file, basic_log::flush() waits for the writer rather than
+    // the spill file, but latency_stats::enqueue_to_write only measures the
+    // time until the output reaches the spill file.
+    std::string spill_file;
+    std::size_t spill_file_size;
+    unsigned spill_retry_timeout_ms;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_LOG_OPTIONS_HPP
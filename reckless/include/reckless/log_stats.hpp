@@ -0,0 +1,112 @@
+#ifndef RECKLESS_LOG_STATS_HPP
+#define RECKLESS_LOG_STATS_HPP
+
+#include <cstddef>  // size_t
+#include <cstdint>  // uint64_t
+#include <vector>
+
+namespace reckless {
+
+// Counters kept by the threads that write to the log. All times are in
+// nanoseconds.
+struct producer_stats {
+    producer_stats() :
+        frames_enqueued(0),
+        frames_dropped(0),
+        input_buffer_full_stalls(0),
+        input_buffer_full_stall_ns(0),
+        shared_queue_full_stalls(0),
+        shared_queue_full_stall_ns(0)
+    {
+    }
+
+    producer_stats& operator+=(producer_stats const& other)
+    {
+        frames_enqueued += other.frames_enqueued;
+        frames_dropped += other.frames_dropped;
+        input_buffer_full_stalls += other.input_buffer_full_stalls;
+        input_buffer_full_stall_ns += other.input_buffer_full_stall_ns;
+        shared_queue_full_stalls += other.shared_queue_full_stalls;
+        shared_queue_full_stall_ns += other.shared_queue_full_stall_ns;
+        return *this;
+    }
+
+    std::uint64_t frames_enqueued;
+    // Thrown away because of the overflow policy.
+    std::uint64_t frames_dropped;
+    // Number of times a thread had to wait for the output thread to make room
+    // in its input buffer, and the total time spent waiting.
+    std::uint64_t input_buffer_full_stalls;
+    std::uint64_t input_buffer_full_stall_ns;
+    // Same thing, but for the shared input queue.
+    std::uint64_t shared_queue_full_stalls;
+    std::uint64_t shared_queue_full_stall_ns;
+};
+
+struct thread_stats : producer_stats {
+    thread_stats() :
+        thread_id(0),
+        input_buffer_size(0)
+    {
+    }
+
+    // Kernel thread id, as shown by e.g. top -H.
+    long thread_id;
+    // Current size of the thread's input buffer.
+    std::size_t input_buffer_size;
+};
+
+// A snapshot of the counters returned by basic_log::stats(). The counters
+// start at zero when the log is constructed and keep counting across close()
+// and open(). They are read without stopping anyone, so counters that are
+// updated by different threads may be a few events apart.
+struct log_stats {
+    log_stats() :
+        frames_formatted(0),
+        bytes_formatted(0),
+        writer_write_calls(0),
+        writer_bytes_written(0),
+        writer_errors(0),
+        output_thread_busy_ns(0),
+        output_thread_idle_ns(0),
+        spill_backlog_bytes(0),
+        spill_peak_backlog_bytes(0),
+        spill_full_stalls(0)
+    {
+    }
+
+    // Sum over all threads that have written to the log, including the
+    // ones that have exited.
+    producer_stats producers;
+
+    std::uint64_t frames_formatted;
+    // Bytes handed to writer::write().
+    std::uint64_t bytes_formatted;
+    std::uint64_t writer_write_calls;
+    // Bytes for which writer::write() returned SUCCESS.
+    std::uint64_t writer_bytes_written;
+    // Calls to writer::write() that returned anything else.
+    std::uint64_t writer_errors;
+
+    // Time the output thread has spent working versus waiting for input.
+    std::uint64_t output_thread_busy_ns;
+    std::uint64_t output_thread_idle_ns;
+
+    // Only used with log_options::spill_file. In that case the writer
+    // counters above are for the real writer.
+    //
+    // Output waiting in the spill file right now, and the most there has
+    // been.
+    std::uint64_t spill_backlog_bytes;
+    std::uint64_t spill_peak_backlog_bytes;
+    // Number of times the output thread had to wait because the spill file
+    // was full.
+    std::uint64_t spill_full_stalls;
+
+    // One entry per thread that currently has an input buffer.
+    std::vector<thread_stats> threads;
+};
+
+}   // namespace reckless
+
+#endif  // RECKLESS_LOG_STATS_HPP
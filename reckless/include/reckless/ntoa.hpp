@@ -3,6 +3,8 @@
 #include <reckless/output_buffer.hpp>
 
 #include <limits>
+#include <cstddef>  // size_t
+#include <cstdint>  // int64_t
 
 namespace reckless {
     
@@ -37,6 +39,18 @@ void itoa_base10(output_buffer* pbuffer, unsigned long value, conversion_specifi
 void itoa_base10(output_buffer* pbuffer, long long value, conversion_specification const& cs);
 void itoa_base10(output_buffer* pbuffer, unsigned long long value, conversion_specification const& cs);
 
+// The integers in values, separated by `separator`, each formatted like
+// itoa_base10() does. This is much faster than calling itoa_base10() for
+// each one when cs has no field width or precision.
+void itoa_base10_array(output_buffer* pbuffer, short const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, unsigned short const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, int const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, unsigned int const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, long const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, unsigned long const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, long long const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+void itoa_base10_array(output_buffer* pbuffer, unsigned long long const* values, std::size_t count, char const* separator, conversion_specification const& cs);
+
 void itoa_base16(output_buffer* pbuffer, int value, conversion_specification const& cs);
 void itoa_base16(output_buffer* pbuffer, unsigned int value, conversion_specification const& cs);
 void itoa_base16(output_buffer* pbuffer, long value, conversion_specification const& cs);
@@ -44,8 +58,33 @@ void itoa_base16(output_buffer* pbuffer, unsigned long value, conversion_specifi
 void itoa_base16(output_buffer* pbuffer, long long value, conversion_specification const& cs);
 void itoa_base16(output_buffer* pbuffer, unsigned long long value, conversion_specification const& cs);
 
+// The fixed-point number mantissa*10^-scale (see reckless::decimal) like %f,
+// with `scale` decimals if cs.precision is unspecified. The digits are exact;
+// with fewer decimals than the scale, the number is rounded with ties away
+// from zero, the same as for doubles.
+void itoa_base10_scaled(output_buffer* pbuffer, std::int64_t mantissa, unsigned scale, conversion_specification const& cs);
+
+// %f, %e and %g, or %F, %E and %G with cs.uppercase. Doubles are correctly
+// rounded to up to 15 significant digits, or to as many as their shortest
+// round-trip representation has, and padded with zeroes after that. The one
+// difference from printf is that a number exactly halfway between two
+// outputs is rounded away from zero rather than to even, e.g. 0.125 and
+// -0.125 with %.2f give 0.13 and -0.13. Long
+// doubles are printed as doubles, unless they are out of range for one; then
+// the digits are good to about 17 places.
 void ftoa_base10_f(output_buffer* pbuffer, double value, conversion_specification const& cs);
+void ftoa_base10_f(output_buffer* pbuffer, long double value, conversion_specification const& cs);
+void ftoa_base10_e(output_buffer* pbuffer, double value, conversion_specification const& cs);
+void ftoa_base10_e(output_buffer* pbuffer, long double value, conversion_specification const& cs);
 void ftoa_base10_g(output_buffer* pbuffer, double value, conversion_specification const& cs);
+void ftoa_base10_g(output_buffer* pbuffer, long double value, conversion_specification const& cs);
+
+// The fewest digits that read back as the same value, in fixed or scientific
+// notation, whichever is shorter (like std::to_chars without a format). The
+// precision in cs is ignored.
+void ftoa_base10_shortest(output_buffer* pbuffer, float value, conversion_specification const& cs);
+void ftoa_base10_shortest(output_buffer* pbuffer, double value, conversion_specification const& cs);
+void ftoa_base10_shortest(output_buffer* pbuffer, long double value, conversion_specification const& cs);
 
 }   // namespace reckless
 
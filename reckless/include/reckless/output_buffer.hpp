@@ -2,8 +2,11 @@
 #define RECKLESS_OUTPUT_BUFFER_HPP
 
 #include "detail/branch_hints.hpp"
+#include "detail/buffer_memory.hpp"
 
+#include <atomic>
 #include <cstddef>  // size_t
+#include <cstdint>  // uint64_t
 #include <new>      // bad_alloc
 #include <cstring>  // strlen, memcpy
 
@@ -21,7 +24,13 @@ public:
 
     output_buffer& operator=(output_buffer&& other);
 
-    void reset(writer* pwriter, std::size_t max_capacity);
+    void reset(writer* pwriter, std::size_t max_capacity,
+            detail::buffer_memory_options const& memory_options =
+                detail::buffer_memory_options());
+    // Locks and/or prefaults the buffer according to the options it was
+    // allocated with. Call this from the thread that is going to fill the
+    // buffer.
+    void prepare_memory();
 
     char* reserve(std::size_t size)
     {
@@ -65,14 +74,38 @@ public:
     }
     void flush();
 
+    // Counters for basic_log::stats(). They may be read from any thread.
+    std::uint64_t bytes_flushed() const
+    {
+        return bytes_flushed_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t write_calls() const
+    {
+        return write_calls_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t bytes_written() const
+    {
+        return bytes_written_.load(std::memory_order_relaxed);
+    }
+    std::uint64_t write_errors() const
+    {
+        return write_errors_.load(std::memory_order_relaxed);
+    }
+
 private:
     output_buffer(output_buffer const&) = delete;
     output_buffer& operator=(output_buffer const&) = delete;
 
     writer* pwriter_;
+    detail::buffer_memory_options memory_options_;
+    detail::buffer_memory memory_;
     char* pbuffer_;
     char* pcommit_end_;
     char* pbuffer_end_;
+    std::atomic<std::uint64_t> bytes_flushed_;
+    std::atomic<std::uint64_t> write_calls_;
+    std::atomic<std::uint64_t> bytes_written_;
+    std::atomic<std::uint64_t> write_errors_;
 };
 
 }
@@ -3,14 +3,15 @@
 
 #include <reckless/basic_log.hpp>
 #include <reckless/template_formatter.hpp>
+#include <reckless/detail/tsc_clock.hpp>
+#include <reckless/detail/timestamp_renderer.hpp>
 #include <utility>  // forward
 #include <cstring>  // memset
 #include <cstdlib>  // size_t
 #include <time.h>
+#include <sys/time.h> // gettimeofday
 
 namespace reckless {
-// TODO some way of allocating a specific input buffer size for a thread that
-// needs extra space.
 
 class timestamp_field {
 public:
@@ -19,16 +20,24 @@ public:
         gettimeofday(&tv_, nullptr);
     }
 
+    // For formatting a time that was recorded earlier, e.g. by binary_log.
+    explicit timestamp_field(timeval const& tv) :
+        tv_(tv)
+    {
+    }
+
+    timeval const& time() const
+    {
+        return tv_;
+    }
+
     bool format(output_buffer* pbuffer)
     {
         // "YYYY-mm-dd HH:MM:SS.FFF " -> 24 chars
-        // Need 25 chars since sprintf wants to add a NUL char.
-        char* p = pbuffer->reserve(25);
-        struct tm tm;
-        time_t time = tv_.tv_sec;
-        localtime_r(&time, &tm);
-        strftime(p, 25, "%Y-%m-%d %H:%M:%S.", &tm);
-        sprintf(p+20, "%03u ", static_cast<unsigned>(tv_.tv_usec)/1000u);
+        char* p = pbuffer->reserve(24);
+        p = detail::render_timestamp(p, tv_.tv_sec,
+            static_cast<std::uint32_t>(tv_.tv_usec)*1000u, 3, false);
+        *p = ' ';
         pbuffer->commit(24);
 
         return true;
@@ -38,6 +47,52 @@ private:
     timeval tv_;
 };
 
+// Number of decimals in the seconds of basic_tsc_timestamp_field.
+enum timestamp_precision {
+    TIMESTAMP_MILLISECONDS = 3,
+    TIMESTAMP_MICROSECONDS = 6,
+    TIMESTAMP_NANOSECONDS = 9
+};
+
+enum timestamp_zone {
+    TIMESTAMP_LOCAL_TIME,
+    TIMESTAMP_UTC
+};
+
+// Like timestamp_field but with up to nanosecond resolution, and much cheaper
+// for the thread that writes to the log: the constructor only reads the CPU's
+// time-stamp counter (or CLOCK_MONOTONIC_RAW on machines without a usable
+// one). The output thread converts it to wall-clock time when it formats the
+// field. The format is "YYYY-mm-dd HH:MM:SS.nnnnnnnnn" with as many decimals
+// as Precision asks for.
+template <timestamp_precision Precision = TIMESTAMP_NANOSECONDS,
+    timestamp_zone Zone = TIMESTAMP_LOCAL_TIME>
+class basic_tsc_timestamp_field {
+public:
+    basic_tsc_timestamp_field() :
+        ticks_(detail::tsc_clock_ticks())
+    {
+    }
+
+    // Nanoseconds since the epoch.
+    std::int64_t time() const
+    {
+        return detail::tsc_clock_to_realtime(ticks_);
+    }
+
+    bool format(output_buffer* pbuffer)
+    {
+        detail::format_nanosecond_timestamp(pbuffer, time(), Precision,
+                Zone == TIMESTAMP_UTC);
+        return true;
+    }
+
+private:
+    std::uint64_t ticks_;
+};
+
+typedef basic_tsc_timestamp_field<> tsc_timestamp_field;
+
 class scoped_indent
 {
 public:
@@ -94,9 +149,10 @@ private:
 template <class IndentPolicy, char Separator, class... Fields>
 class policy_formatter {
 public:
-    template <typename... Args>
+    // Format is either char const* or format_string.
+    template <typename Format, typename... Args>
     static void format(output_buffer* pbuffer, Fields&&... fields,
-        IndentPolicy indent, char const* pformat, Args&&... args)
+        IndentPolicy indent, Format pformat, Args&&... args)
     {
         format_fields(pbuffer, fields...);
         indent.apply(pbuffer);
@@ -124,30 +180,116 @@ private:
 template <class IndentPolicy = no_indent, char FieldSeparator = ' ', class... HeaderFields>
 class policy_log : public basic_log {
 public:
+    // Collects several lines and hands them over to the output thread in one
+    // go when the batch is committed or destroyed. The lines show up
+    // back-to-back in the log, without lines from other threads in between,
+    // provided that they fit in the thread's input buffer together. A batch
+    // must only be used by the thread that created it.
+    //
+    // We look up the input buffer on every call rather than hold on to it.
+    // If the thread calls write() on the log while the batch is alive, that
+    // call may switch the thread to a larger buffer, and the old one is freed
+    // as soon as the output thread has drained it. That's safe because the
+    // log commits everything in the old buffer, including what the batch
+    // wrote so far, before it switches.
+    class batch {
+    public:
+        explicit batch(policy_log& log) :
+            plog_(&log)
+        {
+        }
+
+        ~batch()
+        {
+            commit();
+        }
+
+        batch(batch const&) = delete;
+        batch& operator=(batch const&) = delete;
+
+        template <typename... Args>
+        void write(char const* fmt, Args&&... args)
+        {
+            write_line(fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void write(format_string fmt, Args&&... args)
+        {
+            write_line(fmt, std::forward<Args>(args)...);
+        }
+
+        // Hands over the lines written so far. The batch can still be used
+        // afterwards.
+        void commit()
+        {
+            detail::thread_input_buffer* pbuffer = plog_->get_input_buffer();
+            if(pbuffer->has_uncommitted_input())
+                plog_->commit(pbuffer);
+        }
+
+    private:
+        template <typename Format, typename... Args>
+        void write_line(Format fmt, Args&&... args)
+        {
+            detail::thread_input_buffer* pbuffer = plog_->get_input_buffer();
+            plog_->template write_frame<formatter>(pbuffer,
+                    frame_priority::normal,
+                    HeaderFields()...,
+                    IndentPolicy(),
+                    fmt,
+                    std::forward<Args>(args)...);
+        }
+
+        policy_log* plog_;
+    };
+
     policy_log()
     {
+        set_dropped_notice_formatter(&format_dropped_notice);
     }
 
     policy_log(writer* pwriter,
             std::size_t output_buffer_max_capacity = 0,
             std::size_t shared_input_queue_size = 0,
-            std::size_t thread_input_buffer_size = 0) :
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options()) :
         basic_log(pwriter,
                  output_buffer_max_capacity,
                  shared_input_queue_size,
-                 thread_input_buffer_size)
+                 thread_input_buffer_size,
+                 options)
     {
+        set_dropped_notice_formatter(&format_dropped_notice);
     }
 
     template <typename... Args>
     void write(char const* fmt, Args&&... args)
     {
-        basic_log::write<policy_formatter<IndentPolicy, FieldSeparator, HeaderFields...>>(
+        basic_log::write<formatter>(
                 HeaderFields()...,
                 IndentPolicy(),
                 fmt,
                 std::forward<Args>(args)...);
     }
+    // With a format string from RECKLESS_FMT.
+    template <typename... Args>
+    void write(format_string fmt, Args&&... args)
+    {
+        basic_log::write<formatter>(
+                HeaderFields()...,
+                IndentPolicy(),
+                fmt,
+                std::forward<Args>(args)...);
+    }
+
+private:
+    typedef policy_formatter<IndentPolicy, FieldSeparator, HeaderFields...> formatter;
+
+    static void format_dropped_notice(output_buffer* poutput, unsigned long count)
+    {
+        formatter::format(poutput, HeaderFields()..., IndentPolicy(),
+                "%d log messages dropped", count);
+    }
 };
 
 }   // namespace reckless
@@ -36,19 +36,103 @@ namespace detail {
 template <class IndentPolicy, char FieldSeparator, class... HeaderFields>
 class severity_log : public basic_log {
 public:
+    // See policy_log::batch.
+    class batch {
+    public:
+        explicit batch(severity_log& log) :
+            plog_(&log)
+        {
+        }
+
+        ~batch()
+        {
+            commit();
+        }
+
+        batch(batch const&) = delete;
+        batch& operator=(batch const&) = delete;
+
+        template <typename... Args>
+        void debug(char const* fmt, Args&&... args)
+        {
+            write('D', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void debug(format_string fmt, Args&&... args)
+        {
+            write('D', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void info(char const* fmt, Args&&... args)
+        {
+            write('I', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void info(format_string fmt, Args&&... args)
+        {
+            write('I', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void warn(char const* fmt, Args&&... args)
+        {
+            write('W', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void warn(format_string fmt, Args&&... args)
+        {
+            write('W', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void error(char const* fmt, Args&&... args)
+        {
+            write('E', fmt, std::forward<Args>(args)...);
+        }
+        template <typename... Args>
+        void error(format_string fmt, Args&&... args)
+        {
+            write('E', fmt, std::forward<Args>(args)...);
+        }
+
+        void commit()
+        {
+            detail::thread_input_buffer* pbuffer = plog_->get_input_buffer();
+            if(pbuffer->has_uncommitted_input())
+                plog_->commit(pbuffer);
+        }
+
+    private:
+        template <typename Format, typename... Args>
+        void write(char severity, Format fmt, Args&&... args)
+        {
+            detail::thread_input_buffer* pbuffer = plog_->get_input_buffer();
+            plog_->template write_frame<formatter>(pbuffer,
+                    priority(severity),
+                    detail::construct_header_field<HeaderFields>(severity)...,
+                    IndentPolicy(),
+                    fmt,
+                    std::forward<Args>(args)...);
+        }
+
+        severity_log* plog_;
+    };
+
     severity_log()
     {
+        set_dropped_notice_formatter(&format_dropped_notice);
     }
 
     severity_log(writer* pwriter,
             std::size_t output_buffer_max_capacity = 0,
             std::size_t shared_input_queue_size = 0,
-            std::size_t thread_input_buffer_size = 0) :
+            std::size_t thread_input_buffer_size = 0,
+            log_options const& options = log_options()) :
         basic_log(pwriter,
                  output_buffer_max_capacity,
                  shared_input_queue_size,
-                 thread_input_buffer_size)
+                 thread_input_buffer_size,
+                 options)
     {
+        set_dropped_notice_formatter(&format_dropped_notice);
     }
 
     template <typename... Args>
@@ -57,31 +141,72 @@ public:
         write('D', fmt, std::forward<Args>(args)...);
     }
     template <typename... Args>
+    void debug(format_string fmt, Args&&... args)
+    {
+        write('D', fmt, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
     void info(char const* fmt, Args&&... args)
     {
         write('I', fmt, std::forward<Args>(args)...);
     }
     template <typename... Args>
+    void info(format_string fmt, Args&&... args)
+    {
+        write('I', fmt, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
     void warn(char const* fmt, Args&&... args)
     {
         write('W', fmt, std::forward<Args>(args)...);
     }
     template <typename... Args>
+    void warn(format_string fmt, Args&&... args)
+    {
+        write('W', fmt, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
     void error(char const* fmt, Args&&... args)
     {
         write('E', fmt, std::forward<Args>(args)...);
     }
+    template <typename... Args>
+    void error(format_string fmt, Args&&... args)
+    {
+        write('E', fmt, std::forward<Args>(args)...);
+    }
 
 private:
-    template <typename... Args>
-    void write(char severity, char const* fmt, Args&&... args)
+    template <typename Format, typename... Args>
+    void write(char severity, Format fmt, Args&&... args)
     {
-        basic_log::write<policy_formatter<IndentPolicy, FieldSeparator, HeaderFields...>>(
-                detail::construct_header_field<HeaderFields>(severity)...,
+        auto pbuffer = get_input_buffer();
+        if(detail::likely(write_frame<formatter>(pbuffer,
+                    priority(severity),
+                    detail::construct_header_field<HeaderFields>(severity)...,
+                    IndentPolicy(),
+                    fmt,
+                    std::forward<Args>(args)...)))
+            commit(pbuffer);
+    }
+
+    // Debug and info messages are the ones we may throw away with
+    // overflow_policy::drop_low_priority.
+    static frame_priority priority(char severity)
+    {
+        return severity == 'D' or severity == 'I'?
+            frame_priority::low : frame_priority::normal;
+    }
+
+    static void format_dropped_notice(output_buffer* poutput, unsigned long count)
+    {
+        formatter::format(poutput,
+                detail::construct_header_field<HeaderFields>('W')...,
                 IndentPolicy(),
-                fmt,
-                std::forward<Args>(args)...);
+                "%d log messages dropped", count);
     }
+
+    typedef policy_formatter<IndentPolicy, FieldSeparator, HeaderFields...> formatter;
 };
 
 }   // namespace reckless
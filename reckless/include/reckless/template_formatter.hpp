@@ -1,17 +1,83 @@
 #ifndef RECKLESS_TEMPLATE_FORMATTER_HPP
 #define RECKLESS_TEMPLATE_FORMATTER_HPP
 
+#include <reckless/output_buffer.hpp>
+#include <reckless/format_string.hpp>
+#include <reckless/frame_string.hpp>
+#include <reckless/decimal.hpp>
+#include <reckless/elements.hpp>
+
 #include <utility>    // forward
 #include <string>
-#include <type_traits>  // is_convertible
+#include <cstring>    // memcpy
+#include <type_traits>  // is_convertible, decay, integral_constant
 
 namespace reckless {
 
-class output_buffer;
 namespace detail {
     template <typename T>
     char const* invoke_custom_format(output_buffer* pbuffer,
         char const* pformat, T&& v);
+
+    // Formats a value of a built-in type for a specifier that format_plan
+    // has already parsed. Returns false if the value doesn't fit the
+    // specifier, just like format() returns nullptr.
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, char v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, signed char v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned char v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, short v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned short v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, int v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned int v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, long v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned long v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, long long v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned long long v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, float v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, double v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, long double v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, decimal v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, char const* v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, std::string const& v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_string v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, void const* v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<short> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned short> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<int> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned int> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned long> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long long> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned long long> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<float> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<double> v);
+    bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long double> v);
+
+    // Tells whether format_specified() takes the type. Other types go
+    // through their format() function as usual.
+    template <typename T> struct has_specified_format : std::false_type {};
+    template <> struct has_specified_format<char> : std::true_type {};
+    template <> struct has_specified_format<signed char> : std::true_type {};
+    template <> struct has_specified_format<unsigned char> : std::true_type {};
+    template <> struct has_specified_format<short> : std::true_type {};
+    template <> struct has_specified_format<unsigned short> : std::true_type {};
+    template <> struct has_specified_format<int> : std::true_type {};
+    template <> struct has_specified_format<unsigned int> : std::true_type {};
+    template <> struct has_specified_format<long> : std::true_type {};
+    template <> struct has_specified_format<unsigned long> : std::true_type {};
+    template <> struct has_specified_format<long long> : std::true_type {};
+    template <> struct has_specified_format<unsigned long long> : std::true_type {};
+    template <> struct has_specified_format<float> : std::true_type {};
+    template <> struct has_specified_format<double> : std::true_type {};
+    template <> struct has_specified_format<long double> : std::true_type {};
+    template <> struct has_specified_format<decimal> : std::true_type {};
+    template <> struct has_specified_format<char const*> : std::true_type {};
+    template <> struct has_specified_format<char*> : std::true_type {};
+    template <> struct has_specified_format<std::string> : std::true_type {};
+    template <> struct has_specified_format<frame_string> : std::true_type {};
+    template <> struct has_specified_format<void const*> : std::true_type {};
+    template <> struct has_specified_format<void*> : std::true_type {};
+    template <typename T> struct has_specified_format<frame_elements<T>> : std::true_type {};
 }
     
 class template_formatter {
@@ -22,24 +88,103 @@ public:
     static void format(output_buffer* pbuffer, char const* pformat,
             T&& value, Args&&... args)
     {
-        pformat = next_specifier(pbuffer, pformat);
+        pformat = format_argument(pbuffer, pformat, std::forward<T>(value));
         if(not pformat)
             return;
+        return template_formatter::format(pbuffer, pformat,
+                std::forward<Args>(args)...);
+    }
+
+    // Formats the text up to the next format specifier and the value for
+    // that specifier, and returns the rest of the format string. Returns
+    // nullptr if there are no more specifiers, in which case the value is
+    // ignored. This is one step of format(), for code that only knows its
+    // arguments at run time (see binary_decoder). Finish with
+    // format(pbuffer, pformat) to get the text after the last specifier.
+    template <typename T>
+    static char const* format_argument(output_buffer* pbuffer,
+            char const* pformat, T&& value)
+    {
+        pformat = next_specifier(pbuffer, pformat);
+        if(not pformat)
+            return nullptr;
 
         char const* pnext_format = detail::invoke_custom_format(pbuffer,
                 pformat, std::forward<T>(value));
         if(pnext_format)
-            pformat = pnext_format;
-        else
-            append_percent(pbuffer);
-        return template_formatter::format(pbuffer, pformat,
-                std::forward<Args>(args)...);
+            return pnext_format;
+        append_percent(pbuffer);
+        return pformat;
+    }
+
+    // Same output as format(pbuffer, fmt.c_str(), args...), but follows the
+    // plan for the call site instead of parsing the format string.
+    template <typename... Args>
+    static void format(output_buffer* pbuffer, format_string fmt,
+            Args&&... args)
+    {
+        run_plan(pbuffer, fmt.plan()->segments(), std::forward<Args>(args)...);
     }
 
 private:
     static void append_percent(output_buffer* pbuffer);
     static char const* next_specifier(output_buffer* pbuffer,
             char const* pformat);
+
+    static void write_literal(output_buffer* pbuffer,
+            detail::format_segment const* psegment)
+    {
+        char* p = pbuffer->reserve(psegment->literal_size);
+        std::memcpy(p, psegment->pliteral, psegment->literal_size);
+        pbuffer->commit(psegment->literal_size);
+    }
+
+    static void run_plan(output_buffer* pbuffer,
+            detail::format_segment const* psegment);
+
+    template <typename T, typename... Args>
+    static void run_plan(output_buffer* pbuffer,
+            detail::format_segment const* psegment, T&& value,
+            Args&&... args)
+    {
+        write_literal(pbuffer, psegment);
+        if(not psegment->has_specifier)
+            return;
+        detail::format_specifier const& specifier = psegment->specifier;
+        char const* pnext_format = format_specified(pbuffer, specifier,
+                std::forward<T>(value), detail::has_specified_format<
+                    typename std::decay<T>::type>());
+        if(detail::likely(pnext_format == specifier.pend)) {
+            return run_plan(pbuffer, psegment + 1,
+                    std::forward<Args>(args)...);
+        }
+        // The value didn't fit the specifier, or its format() function
+        // read past the end of the specifier. Either way the plan no longer
+        // applies, so we do the rest the slow way.
+        if(not pnext_format) {
+            append_percent(pbuffer);
+            pnext_format = specifier.ptext;
+        }
+        template_formatter::format(pbuffer, pnext_format,
+                std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static char const* format_specified(output_buffer* pbuffer,
+            detail::format_specifier const& specifier, T&& value,
+            std::true_type)
+    {
+        return detail::format_specified(pbuffer, specifier, value)?
+            specifier.pend : nullptr;
+    }
+    template <typename T>
+    static char const* format_specified(output_buffer* pbuffer,
+            detail::format_specifier const& specifier, T&& value,
+            std::false_type)
+    {
+        return detail::invoke_custom_format(pbuffer, specifier.ptext,
+                std::forward<T>(value));
+    }
 };
 
 char const* format(output_buffer* pbuffer, char const* pformat, char v);
@@ -61,12 +206,27 @@ char const* format(output_buffer* pbuffer, char const* pformat, unsigned long lo
 char const* format(output_buffer* pbuffer, char const* pformat, float v);
 char const* format(output_buffer* pbuffer, char const* pformat, double v);
 char const* format(output_buffer* pbuffer, char const* pformat, long double v);
+char const* format(output_buffer* pbuffer, char const* pformat, decimal v);
 
 char const* format(output_buffer* pbuffer, char const* pformat, char const* v);
 char const* format(output_buffer* pbuffer, char const* pformat, std::string const& v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_string v);
 
 char const* format(output_buffer* pbuffer, char const* pformat, void const* p);
 
+// Arrays from reckless::elements(). The specifier applies to each element.
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<short> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned short> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<int> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned int> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned long> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long long> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned long long> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<float> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<double> v);
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long double> v);
+
 namespace detail {
 // TODO can we invoke free format() using argument-dependent lookup without
 // causing infinite recursion on this member function, without this
@@ -1,41 +1,108 @@
 #include <reckless/basic_log.hpp>
 
 #include <vector>
+#include <chrono>
+#include <mutex>
+#include <algorithm>    // max, min, remove_if
+#include <iterator>     // next
 #include <ciso646>
+#include <cstdio>       // sprintf
+
+#include <system_error>
+#include <cerrno>
 
 #include <unistd.h>     // sleep
+#include <sched.h>      // sched_setaffinity, CPU_*
+#include <sys/resource.h>   // setpriority
+#include <sys/syscall.h>    // SYS_gettid
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+__thread reckless::basic_log::thread_input_buffer_cache_entry
+    reckless::basic_log::thread_input_buffer_cache_[
+        reckless::detail::THREAD_INPUT_BUFFER_CACHE_SIZE];
 
 namespace {
-void destroy_thread_input_buffer(void* p)
+std::mutex g_thread_input_buffer_cache_mutex;
+
+std::int64_t steady_clock_ns()
 {
-    using reckless::detail::thread_input_buffer;
-    thread_input_buffer* pbuffer = static_cast<thread_input_buffer*>(p);
-    thread_input_buffer::destroy(pbuffer);
-}
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-// FIXME we need to destroy the pthreads key in dtor
+bool g_thread_input_buffer_cache_slot_used[
+    reckless::detail::THREAD_INPUT_BUFFER_CACHE_SIZE];
+unsigned long g_thread_input_buffer_cache_generation = 0;
+}
 
 reckless::basic_log::basic_log() :
-    shared_input_queue_(0),
+    idle_policy_(idle_policy::backoff),
+    idle_spin_count_(0),
+    idle_yield_count_(0),
+    output_worker_parked_(false),
+    overflow_policy_(overflow_policy::block),
+    input_frames_dropped_(false),
+    orphaned_dropped_count_(0),
+    pdropped_notice_formatter_(&format_dropped_notice),
     thread_input_buffer_size_(0),
+    max_thread_input_buffer_size_(0),
+    input_buffer_memory_budget_(0),
+    input_buffer_shrink_delay_ms_(0),
+    input_buffer_memory_(0),
+    input_buffers_retired_(false),
+    input_buffer_pool_size_(0),
+    frames_formatted_(0),
+    output_thread_start_ns_(0),
+    output_thread_run_ns_(0),
+    output_thread_idle_since_ns_(0),
+    output_thread_idle_ns_(0),
+    measure_latency_(false),
+    last_write_calls_(0),
+    flush_notification_fd_(-1),
     panic_flush_(false)
 {
-    if(0 != pthread_key_create(&thread_input_buffer_key_, &destroy_thread_input_buffer))
+    if(0 != pthread_key_create(&thread_input_buffer_key_, &destroy_input_buffer))
         throw std::bad_alloc();
+    allocate_thread_input_buffer_cache_slot();
 }
 
 reckless::basic_log::basic_log(writer* pwriter, 
         std::size_t output_buffer_max_capacity,
         std::size_t shared_input_queue_size,
-        std::size_t thread_input_buffer_size) :
-    shared_input_queue_(0),
+        std::size_t thread_input_buffer_size,
+        log_options const& options) :
+    idle_policy_(idle_policy::backoff),
+    idle_spin_count_(0),
+    idle_yield_count_(0),
+    output_worker_parked_(false),
+    overflow_policy_(overflow_policy::block),
+    input_frames_dropped_(false),
+    orphaned_dropped_count_(0),
+    pdropped_notice_formatter_(&format_dropped_notice),
     thread_input_buffer_size_(0),
+    max_thread_input_buffer_size_(0),
+    input_buffer_memory_budget_(0),
+    input_buffer_shrink_delay_ms_(0),
+    input_buffer_memory_(0),
+    input_buffers_retired_(false),
+    input_buffer_pool_size_(0),
+    frames_formatted_(0),
+    output_thread_start_ns_(0),
+    output_thread_run_ns_(0),
+    output_thread_idle_since_ns_(0),
+    output_thread_idle_ns_(0),
+    measure_latency_(false),
+    last_write_calls_(0),
+    flush_notification_fd_(-1),
     panic_flush_(false)
 {
-    if(0 != pthread_key_create(&thread_input_buffer_key_, &destroy_thread_input_buffer))
+    if(0 != pthread_key_create(&thread_input_buffer_key_, &destroy_input_buffer))
         throw std::bad_alloc();
-    open(pwriter, output_buffer_max_capacity, shared_input_queue_size, thread_input_buffer_size);
+    allocate_thread_input_buffer_cache_slot();
+    open(pwriter, output_buffer_max_capacity, shared_input_queue_size,
+            thread_input_buffer_size, options);
 }
 
 reckless::basic_log::~basic_log()
@@ -44,12 +111,67 @@ reckless::basic_log::~basic_log()
         return;
     if(is_open())
         close();
+    free_all_input_buffers();
+    // Threads that are still running won't call destroy_input_buffer() for
+    // this log when they exit, since the key is gone. That's what we want,
+    // since we just freed their buffers.
+    pthread_key_delete(thread_input_buffer_key_);
+    free_thread_input_buffer_cache_slot();
+    int fd = flush_notification_fd_.load(std::memory_order_relaxed);
+    if(fd != -1)
+        ::close(fd);
+}
+
+void reckless::basic_log::allocate_thread_input_buffer_cache_slot()
+{
+    // Slot 0 with generation 0 is what we use if we run out of slots. No cache
+    // entry ever gets generation 0 with a non-null pointer, so that always
+    // sends us to the slow path.
+    thread_input_buffer_cache_slot_ = 0;
+    thread_input_buffer_cache_generation_ = 0;
+    std::lock_guard<std::mutex> lk(g_thread_input_buffer_cache_mutex);
+    for(unsigned slot=0; slot!=detail::THREAD_INPUT_BUFFER_CACHE_SIZE; ++slot) {
+        if(not g_thread_input_buffer_cache_slot_used[slot]) {
+            g_thread_input_buffer_cache_slot_used[slot] = true;
+            thread_input_buffer_cache_slot_ = slot;
+            thread_input_buffer_cache_generation_ = ++g_thread_input_buffer_cache_generation;
+            return;
+        }
+    }
+}
+
+void reckless::basic_log::free_thread_input_buffer_cache_slot()
+{
+    if(thread_input_buffer_cache_generation_ == 0)
+        return;
+    std::lock_guard<std::mutex> lk(g_thread_input_buffer_cache_mutex);
+    g_thread_input_buffer_cache_slot_used[thread_input_buffer_cache_slot_] = false;
+}
+
+// Points the calling thread at a new input buffer, both in the pthread key
+// (so we get called when the thread exits) and in the thread-local cache.
+void reckless::basic_log::set_thread_input_buffer(detail::thread_input_buffer* p)
+{
+    int result = pthread_setspecific(thread_input_buffer_key_, p);
+    if(detail::unlikely(result != 0)) {
+        if(result == ENOMEM)
+            throw std::bad_alloc();
+        else
+            throw std::system_error(result, std::system_category());
+    }
+    if(thread_input_buffer_cache_generation_ != 0) {
+        thread_input_buffer_cache_entry& entry =
+            thread_input_buffer_cache_[thread_input_buffer_cache_slot_];
+        entry.pbuffer = p;
+        entry.generation = thread_input_buffer_cache_generation_;
+    }
 }
 
 void reckless::basic_log::open(writer* pwriter, 
         std::size_t output_buffer_max_capacity,
         std::size_t shared_input_queue_size,
-        std::size_t thread_input_buffer_size)
+        std::size_t thread_input_buffer_size,
+        log_options const& options)
 {
     // The typical disk block size these days is 4 KiB (see
     // https://en.wikipedia.org/wiki/Advanced_Format). We'll make it twice
@@ -70,21 +192,79 @@ void reckless::basic_log::open(writer* pwriter,
         if(thread_input_buffer_size == 0)
             thread_input_buffer_size = ASSUMED_DISK_SECTOR_SIZE;
     }
-    reset_shared_input_queue(shared_input_queue_size);
+    shared_input_queue_.reset(options.shared_input_queue, shared_input_queue_size);
+    idle_policy_ = options.idle;
+    idle_spin_count_ = options.idle_spin_count;
+    idle_yield_count_ = options.idle_yield_count;
+    output_worker_parked_.store(false, std::memory_order_relaxed);
+    overflow_policy_ = options.overflow;
     thread_input_buffer_size_ = thread_input_buffer_size;
-    output_buffer_ = output_buffer(pwriter, output_buffer_max_capacity);
-    output_thread_ = std::thread(std::mem_fn(&basic_log::output_worker), this);
+    max_thread_input_buffer_size_ = std::max(options.max_thread_input_buffer_size,
+            thread_input_buffer_size);
+    input_buffer_memory_budget_ = options.input_buffer_memory_budget;
+    input_buffer_shrink_delay_ms_ = options.input_buffer_shrink_delay_ms;
+    input_buffer_pool_size_ = options.input_buffer_pool_size;
+    buffer_memory_options_ = detail::buffer_memory_options(options);
+    measure_latency_ = options.measure_latency;
+    if(measure_latency_ and not penqueue_to_format_latency_) {
+        penqueue_to_format_latency_.reset(new detail::latency_recorder());
+        penqueue_to_write_latency_.reset(new detail::latency_recorder());
+    }
+    {
+        // Get rid of pooled buffers that are no longer of the right size.
+        std::lock_guard<std::mutex> lk(input_buffer_pool_mutex_);
+        auto it = std::remove_if(input_buffer_pool_.begin(), input_buffer_pool_.end(),
+            [this](detail::thread_input_buffer* pbuffer)
+            {
+                if(pbuffer->size() == thread_input_buffer_size_)
+                    return false;
+                free_input_buffer(pbuffer);
+                return true;
+            });
+        input_buffer_pool_.erase(it, input_buffer_pool_.end());
+    }
+    writer* poutput_writer = pwriter;
+    if(not options.spill_file.empty()) {
+        spill_writer_.open(pwriter, options.spill_file, options.spill_file_size,
+                options.spill_retry_timeout_ms, &flush_notification_fd_);
+        poutput_writer = &spill_writer_;
+    }
+    output_buffer_.reset(poutput_writer, output_buffer_max_capacity,
+            buffer_memory_options_);
+    // The output thread applies the thread settings itself, and we wait for
+    // it to tell us how it went. That also means it's safe for it to look at
+    // the options through a pointer.
+    output_thread_start_error_ = nullptr;
+    output_thread_ = std::thread(std::mem_fn(&basic_log::output_worker), this,
+            &options);
+    output_thread_started_event_.wait();
+    if(output_thread_start_error_) {
+        output_thread_.join();
+        if(spill_writer_.is_open())
+            spill_writer_.close();
+        std::rethrow_exception(output_thread_start_error_);
+    }
 }
 
 void reckless::basic_log::close()
 {
     using namespace detail;
     assert(is_open());
-    // FIXME always signal a buffer full event, so we don't have to wait 1
-    // second before the thread exits.
+    // If the writer keeps failing with ERROR_TRY_LATER, the output thread
+    // could otherwise be stuck forever waiting for room in the spill file.
+    if(spill_writer_.is_open())
+        spill_writer_.limit_retries();
+    // queue_commit_extent wakes up the output thread if it's asleep, so this
+    // doesn't have to wait for the idle timeout.
     queue_commit_extent({nullptr, nullptr});
     output_thread_.join();
     assert(shared_input_queue_.empty());
+    // The output thread is gone, so we'll have to free any buffers that were
+    // retired since it last looked.
+    sweep_input_buffers(false);
+    // This waits for the writer to catch up with the spill file.
+    if(spill_writer_.is_open())
+        spill_writer_.close();
     // FIXME reverse everything that open() does, including getting rid of the
     // buffers etc.
 }
@@ -96,17 +276,31 @@ void reckless::basic_log::panic_flush()
     panic_flush_done_event_.wait();
 }
 
-void reckless::basic_log::output_worker()
+void reckless::basic_log::output_worker(log_options const* poptions)
 {
     // TODO if possible we should call signal_input_consumed() whenever the
     // output buffer is flushed, so threads aren't kept waiting indefinitely if
     // the queue never clears up.
     using namespace detail;
+    try {
+        configure_output_thread(*poptions);
+    } catch(...) {
+        output_thread_start_error_ = std::current_exception();
+        output_thread_started_event_.signal();
+        return;
+    }
+    output_thread_start_ns_.store(steady_clock_ns());
+    // poptions points into open()'s stack frame, so it's off limits from here
+    // on.
+    output_thread_started_event_.signal();
+    // Now that we're on the thread that fills the output buffer, and on the
+    // CPUs it was asked to run on, we can lock and prefault it.
+    output_buffer_.prepare_memory();
     std::vector<thread_input_buffer*> touched_input_buffers;
     touched_input_buffers.reserve(std::max(8u, 2*std::thread::hardware_concurrency()));
+    last_idle_sweep_ = std::chrono::steady_clock::now();
     while(true) {
         commit_extent ce;
-        unsigned wait_time_ms = 0;
         if(not shared_input_queue_.pop(ce)) {
             if(unlikely(panic_flush_)) {
                 on_panic_flush_done();
@@ -117,20 +311,42 @@ void reckless::basic_log::output_worker()
                 for(thread_input_buffer* pbuffer : touched_input_buffers)
                     pbuffer->input_consumed_flag = false;
                 touched_input_buffers.clear();
+                if(unlikely(input_frames_dropped_.load(std::memory_order_relaxed)))
+                    report_dropped_input_frames();
+                // Retired buffers can only be freed here, after we're done
+                // with touched_input_buffers.
+                maintain_input_buffers();
                 if(not output_buffer_.empty())
                     output_buffer_.flush();
-                while(not shared_input_queue_.pop(ce)) {
-                    shared_input_queue_full_event_.wait(wait_time_ms);
-                    wait_time_ms += std::max(1u, wait_time_ms/4);
-                    wait_time_ms = std::min(wait_time_ms, 1000u);
+                if(not unwritten_timestamps_.empty())
+                    record_write_latency();
+                // We've caught up with every thread, so all flushes are done.
+                if(unlikely(not pending_flush_requests_.empty())) {
+                    flush_barrier_buffers_.clear();
+                    complete_flush_requests();
                 }
+                wait_for_input(ce);
             }
         }
             
         if(not ce.pinput_buffer) {
             if(unlikely(panic_flush_))
                 on_panic_flush_done();
+            // Threads that exited before close() leave their buffers retired
+            // for us, and there may be drops in them that we haven't
+            // reported.
+            sweep_input_buffers(false);
+            if(unlikely(input_frames_dropped_.load(std::memory_order_relaxed)))
+                report_dropped_input_frames();
             output_buffer_.flush();
+            if(not unwritten_timestamps_.empty())
+                record_write_latency();
+            flush_barrier_buffers_.clear();
+            complete_flush_requests();
+            std::int64_t start = output_thread_start_ns_.load();
+            output_thread_run_ns_.fetch_add(
+                static_cast<std::uint64_t>(steady_clock_ns() - start));
+            output_thread_start_ns_.store(0);
             return;
         }
 
@@ -141,7 +357,22 @@ void reckless::basic_log::output_worker()
                 pinput_start = ce.pinput_buffer->wraparound();
                 pdispatch = *reinterpret_cast<formatter_dispatch_function_t**>(pinput_start);
             }
-            auto frame_size = (*pdispatch)(&output_buffer_, pinput_start);
+            std::size_t frame_size;
+            if(unlikely(pdispatch == &latency_marker_dispatch)) {
+                record_format_latency(pinput_start);
+                frame_size = LATENCY_MARKER_FRAME_SIZE;
+            } else if(unlikely(pdispatch == &flush_marker_dispatch)) {
+                on_flush_marker(ce.pinput_buffer, pinput_start);
+                frame_size = FLUSH_MARKER_FRAME_SIZE;
+            } else {
+                frame_size = (*pdispatch)(&output_buffer_, pinput_start);
+                single_writer_add(frames_formatted_, std::uint64_t(1));
+                // Formatting may have filled up the output buffer and
+                // flushed it, which writes everything formatted before this
+                // frame.
+                if(unlikely(not unwritten_timestamps_.empty()))
+                    record_write_latency();
+            }
             pinput_start = ce.pinput_buffer->discard_input_frame(frame_size);
             if(likely(!panic_flush_)) {
                 // If we're in panic-flush mode then we don't try to touch the
@@ -152,10 +383,156 @@ void reckless::basic_log::output_worker()
                 }
             }
         }
+
+        if(unlikely(not pending_flush_requests_.empty())) {
+            auto it = std::find(flush_barrier_buffers_.begin(),
+                    flush_barrier_buffers_.end(), ce.pinput_buffer);
+            if(it != flush_barrier_buffers_.end())
+                flush_barrier_buffers_.erase(it);
+            if(flush_barrier_buffers_.empty())
+                complete_flush_requests();
+        }
     }
 }
 
-void reckless::basic_log::queue_commit_extent(detail::commit_extent const& ce)
+// Applies the log_options settings for the output thread. Must be called on
+// the output thread.
+void reckless::basic_log::configure_output_thread(log_options const& options)
+{
+    // Same approach as rdtscp_cpuid_clock::bind_cpu in performance_log.
+    if(not options.output_thread_cpus.empty()) {
+        unsigned cpu_count = *std::max_element(options.output_thread_cpus.begin(),
+                options.output_thread_cpus.end()) + 1;
+        auto const size = CPU_ALLOC_SIZE(cpu_count);
+        cpu_set_t* pcpuset = CPU_ALLOC(cpu_count);
+        if(not pcpuset)
+            throw std::bad_alloc();
+        CPU_ZERO_S(size, pcpuset);
+        for(unsigned cpu : options.output_thread_cpus)
+            CPU_SET_S(cpu, size, pcpuset);
+        int res = pthread_setaffinity_np(pthread_self(), size, pcpuset);
+        CPU_FREE(pcpuset);
+        if(res != 0)
+            throw std::system_error(res, std::system_category());
+    }
+
+    if(options.output_thread_sched_policy != log_options::inherit) {
+        sched_param param;
+        param.sched_priority = options.output_thread_sched_priority;
+        int res = pthread_setschedparam(pthread_self(),
+                options.output_thread_sched_policy, &param);
+        if(res != 0)
+            throw std::system_error(res, std::system_category());
+    }
+
+    // On Linux the nice value is per thread, even though POSIX says it
+    // should be per process.
+    if(options.output_thread_nice != log_options::inherit) {
+        id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+        if(0 != setpriority(PRIO_PROCESS, tid, options.output_thread_nice))
+            throw std::system_error(errno, std::system_category());
+    }
+
+    if(not options.output_thread_name.empty()) {
+        // The kernel limit is 16 bytes including the terminator. Unlike the
+        // settings above, the name doesn't change how the thread behaves, so
+        // it's not worth refusing to open the log over. We ignore failure.
+        std::string name = options.output_thread_name.substr(0, 15);
+        pthread_setname_np(pthread_self(), name.c_str());
+    }
+}
+
+// Called by the output thread when it's idle. Frees retired input buffers, and
+// every input_buffer_shrink_delay_ms looks for grown buffers that haven't been
+// used since last time.
+void reckless::basic_log::maintain_input_buffers()
+{
+    bool check_idle = false;
+    if(elastic_input_buffers()) {
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_idle_sweep_ >= std::chrono::milliseconds(
+                    input_buffer_shrink_delay_ms_))
+        {
+            check_idle = true;
+            last_idle_sweep_ = now;
+        }
+    }
+    if(check_idle or detail::unlikely(input_buffers_retired_.load(std::memory_order_relaxed)))
+        sweep_input_buffers(check_idle);
+}
+
+// Called by the output thread when the input queue has run dry. Spins, yields
+// or sleeps according to the idle policy until there is something to pop.
+void reckless::basic_log::wait_for_input(detail::commit_extent& ce)
+{
+    using namespace detail;
+    unsigned wait_time_ms = 0;
+    unsigned round = 0;
+    std::int64_t idle_since = steady_clock_ns();
+    output_thread_idle_since_ns_.store(idle_since);
+    while(not shared_input_queue_.pop(ce)) {
+        if(unlikely(panic_flush_))
+            on_panic_flush_done();
+        switch(idle_policy_) {
+        case idle_policy::busy_poll:
+            cpu_relax();
+            break;
+        case idle_policy::spin_yield_park:
+            if(round < idle_spin_count_) {
+                cpu_relax();
+                ++round;
+            } else if(round - idle_spin_count_ < idle_yield_count_) {
+                std::this_thread::yield();
+                ++round;
+            } else {
+                // With elastic buffers we need to wake up now and then to
+                // look for buffers to shrink.
+                park_output_worker(elastic_input_buffers()?
+                        std::max(1u, input_buffer_shrink_delay_ms_) : 0);
+                maintain_input_buffers();
+            }
+            break;
+        case idle_policy::backoff:
+            // The first round is just a retry.
+            if(wait_time_ms != 0) {
+                park_output_worker(wait_time_ms);
+                maintain_input_buffers();
+            }
+            wait_time_ms += std::max(1u, wait_time_ms/4);
+            wait_time_ms = std::min(wait_time_ms, 1000u);
+            break;
+        }
+    }
+    single_writer_add(output_thread_idle_ns_,
+            static_cast<std::uint64_t>(steady_clock_ns() - idle_since));
+    output_thread_idle_since_ns_.store(0);
+}
+
+// Puts the output thread to sleep until a producer commits something, or
+// until the timeout expires. A timeout of zero means no timeout.
+//
+// This is a Dekker-style handshake with queue_commit_extent(): we set the
+// parked flag and then check the queue, while a producer pushes to the queue
+// and then checks the flag. All four operations are sequentially consistent,
+// so at least one side will see the other's write; either we find the new
+// input and don't sleep, or the producer sees the flag and signals us. That
+// keeps the producer's side down to a plain load in the common case when the
+// output thread is awake.
+void reckless::basic_log::park_output_worker(unsigned milliseconds)
+{
+    output_worker_parked_.store(true, std::memory_order_seq_cst);
+    if(shared_input_queue_.empty()) {
+        if(milliseconds == 0)
+            shared_input_queue_full_event_.wait();
+        else
+            shared_input_queue_full_event_.wait(milliseconds);
+    }
+    output_worker_parked_.store(false, std::memory_order_relaxed);
+}
+
+// Returns false if the queue is full and block is false.
+bool reckless::basic_log::queue_commit_extent(detail::commit_extent const& ce,
+        bool block)
 {
     using namespace detail;
     if(unlikely(panic_flush_))
@@ -172,44 +549,605 @@ void reckless::basic_log::queue_commit_extent(detail::commit_extent const& ce)
             sleep(3600);
     }
     if(unlikely(not shared_input_queue_.push(ce))) {
+        if(not block) {
+            shared_input_queue_full_event_.signal();
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
         do {
             shared_input_queue_full_event_.signal();
             shared_input_consumed_event_.wait();
         } while(not shared_input_queue_.push(ce));
+        if(ce.pinput_buffer) {
+            auto stall = std::chrono::steady_clock::now() - start;
+            ce.pinput_buffer->count_shared_queue_full_stall(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(stall).count()));
+        }
+    }
+    if(unlikely(output_worker_parked_.load(std::memory_order_seq_cst)))
+        shared_input_queue_full_event_.signal();
+    return true;
+}
+
+reckless::detail::thread_input_buffer* reckless::basic_log::init_input_buffer(
+        std::size_t size, bool prefault)
+{
+    auto p = create_input_buffer(size, prefault);
+    try {
+        set_thread_input_buffer(p);
+        shared_input_queue_.register_input_buffer(p);
+        return p;
+    } catch(...) {
+        set_thread_input_buffer(nullptr);
+        free_input_buffer(p);
+        throw;
+    }
+}
+
+reckless::detail::thread_input_buffer* reckless::basic_log::get_input_buffer_slow()
+{
+    using namespace detail;
+    auto p = static_cast<thread_input_buffer*>(pthread_getspecific(thread_input_buffer_key_));
+    if(p == nullptr)
+        return init_input_buffer(thread_input_buffer_size_);
+    if(not p->is_shrink_requested()) {
+        // Either we don't have a cache slot, or this is the first time the
+        // thread looks up the buffer since its cache entry was taken over by
+        // another log.
+        set_thread_input_buffer(p);
+        return p;
+    }
+
+    // The output thread thinks we've been idle long enough to give back the
+    // memory we grabbed during the last burst.
+    p->clear_shrink_request();
+    if(p->has_uncommitted_input() or p->size() <= p->base_size())
+        return p;
+    thread_input_buffer* pnew;
+    try {
+        pnew = create_input_buffer(p->base_size());
+    } catch(std::bad_alloc const&) {
+        // No big deal, we'll just keep the big one.
+        return p;
+    }
+    replace_input_buffer(p, pnew);
+    return pnew;
+}
+
+void reckless::basic_log::register_thread()
+{
+    if(pthread_getspecific(thread_input_buffer_key_) == nullptr)
+        init_input_buffer(thread_input_buffer_size_, true);
+}
+
+void reckless::basic_log::set_thread_input_buffer_size(std::size_t size)
+{
+    using namespace detail;
+    auto p = static_cast<thread_input_buffer*>(pthread_getspecific(thread_input_buffer_key_));
+    if(p == nullptr) {
+        p = init_input_buffer(size);
+        p->set_base_size(size);
+        return;
     }
+    if(p->has_uncommitted_input())
+        commit(p, true);
+    auto pnew = create_input_buffer(size);
+    pnew->set_base_size(size);
+    replace_input_buffer(p, pnew);
 }
 
-void reckless::basic_log::reset_shared_input_queue(std::size_t node_count)
+// Called by write_frame() when the input buffer is full. Grows the buffer if
+// that's allowed, otherwise waits for room or drops the frame depending on the
+// overflow policy.
+char* reckless::basic_log::allocate_input_frame_slow(
+        detail::thread_input_buffer*& pbuffer, std::size_t frame_size,
+        frame_priority priority)
 {
-    // boost's lockfree queue has no move constructor and provides no reserve()
-    // function when you use fixed_sized policy. So we'll just explicitly
-    // destroy the current queue and create a new one with the desired size. We
-    // are guaranteed that the queue is empty since close() clears it.
-    shared_input_queue_.~shared_input_queue_t();
-    // TODO how do we handle an exception here?
-    new (&shared_input_queue_) shared_input_queue_t(node_count);
+    using namespace detail;
+    overflow_policy policy = pbuffer->get_overflow_policy();
+
+    std::size_t size = pbuffer->size();
+    if(size < max_thread_input_buffer_size_) {
+        // A buffer can only hold frames that are smaller than the buffer,
+        // after the frame has been padded for alignment.
+        std::size_t const aligned_frame_size =
+            thread_input_buffer::aligned_frame_size(frame_size);
+        std::size_t new_size = std::min(2*size, max_thread_input_buffer_size_);
+        while(new_size <= aligned_frame_size and new_size < max_thread_input_buffer_size_)
+            new_size = std::min(2*new_size, max_thread_input_buffer_size_);
+        // Everything written to the old buffer must be committed before we
+        // switch, or it would end up after the data in the new one. If that
+        // isn't possible without blocking then we can't grow.
+        bool block = policy != overflow_policy::drop_newest;
+        if(new_size > aligned_frame_size
+                and (not pbuffer->has_uncommitted_input() or commit(pbuffer, block))
+                and reserve_input_buffer_memory(new_size))
+        {
+            thread_input_buffer* pnew = nullptr;
+            try {
+                pnew = thread_input_buffer::create(this, new_size, policy,
+                        buffer_memory_options_);
+            } catch(std::bad_alloc const&) {
+                input_buffer_memory_.fetch_sub(new_size, std::memory_order_relaxed);
+            }
+            if(pnew) {
+                pnew->set_base_size(pbuffer->base_size());
+                replace_input_buffer(pbuffer, pnew);
+                pbuffer = pnew;
+                char* pframe = pnew->try_allocate_input_frame(frame_size);
+                assert(pframe);
+                return pframe;
+            }
+        }
+    }
+
+    if(policy == overflow_policy::block
+            or (policy == overflow_policy::drop_low_priority
+                and priority != frame_priority::low))
+    {
+        return pbuffer->allocate_input_frame(frame_size);
+    }
+
+    char* pframe = pbuffer->try_allocate_input_frame(frame_size);
+    if(pframe)
+        return pframe;
+    pbuffer->count_dropped_frame();
+    on_input_frame_dropped();
+    // If the buffer is clogged with frames that we couldn't commit earlier
+    // because the shared queue was full, then nothing will ever make room
+    // unless we commit them. So try again, without blocking.
+    if(pbuffer->has_uncommitted_input())
+        commit(pbuffer, false);
+    return nullptr;
 }
 
-reckless::detail::thread_input_buffer* reckless::basic_log::init_input_buffer()
+reckless::detail::thread_input_buffer* reckless::basic_log::create_input_buffer(
+        std::size_t size, bool prefault)
 {
-    auto p = detail::thread_input_buffer::create(thread_input_buffer_size_);
+    using detail::thread_input_buffer;
+    if(size == thread_input_buffer_size_) {
+        thread_input_buffer* p = take_pooled_input_buffer(size);
+        if(p)
+            return thread_input_buffer::recycle(p, this, overflow_policy_);
+    }
+
+    // The base buffer doesn't count against the budget; a thread must always
+    // be able to log. But it does count toward the total, so that other
+    // threads can't grow their buffers as much.
+    input_buffer_memory_.fetch_add(size, std::memory_order_relaxed);
     try {
-        int result = pthread_setspecific(thread_input_buffer_key_, p);
-        if(detail::likely(result == 0))
+        detail::buffer_memory_options memory_options(buffer_memory_options_);
+        memory_options.prefault = memory_options.prefault or prefault;
+        return thread_input_buffer::create(this, size, overflow_policy_,
+                memory_options);
+    } catch(...) {
+        input_buffer_memory_.fetch_sub(size, std::memory_order_relaxed);
+        throw;
+    }
+}
+
+void reckless::basic_log::free_input_buffer(detail::thread_input_buffer* pbuffer)
+{
+    input_buffer_memory_.fetch_sub(pbuffer->size(), std::memory_order_relaxed);
+    detail::thread_input_buffer::destroy(pbuffer);
+}
+
+// Returns a buffer from the pool that suits the calling thread, or nullptr if
+// there isn't one.
+reckless::detail::thread_input_buffer* reckless::basic_log::take_pooled_input_buffer(
+        std::size_t size)
+{
+    using detail::thread_input_buffer;
+    int numa_node = -1;
+    if(buffer_memory_options_.numa_local)
+        numa_node = detail::current_numa_node();
+    std::lock_guard<std::mutex> lk(input_buffer_pool_mutex_);
+    // Most recently pooled first, since those are most likely to be in the
+    // cache.
+    for(auto it = input_buffer_pool_.rbegin(); it != input_buffer_pool_.rend(); ++it) {
+        thread_input_buffer* p = *it;
+        if(p->size() == size and (numa_node == -1 or p->numa_node() == numa_node)) {
+            input_buffer_pool_.erase(std::next(it).base());
             return p;
-        else if(result == ENOMEM)
-            throw std::bad_alloc();
-        else
-            throw std::system_error(result, std::system_category());
+        }
+    }
+    return nullptr;
+}
+
+// Hands a drained buffer that no thread is using back to the pool, or frees it
+// if the pool is full or the buffer isn't of the default size.
+void reckless::basic_log::release_input_buffer(detail::thread_input_buffer* pbuffer)
+{
+    if(pbuffer->size() == thread_input_buffer_size_) {
+        std::lock_guard<std::mutex> lk(input_buffer_pool_mutex_);
+        if(input_buffer_pool_.size() < input_buffer_pool_size_) {
+            input_buffer_pool_.push_back(pbuffer);
+            return;
+        }
+    }
+    free_input_buffer(pbuffer);
+}
+
+// Frees every input buffer that belongs to the log, including those that
+// threads are still using. Only for the destructor.
+void reckless::basic_log::free_all_input_buffers()
+{
+    using detail::thread_input_buffer;
+    std::vector<thread_input_buffer*> buffers;
+    shared_input_queue_.for_each_input_buffer([&buffers](thread_input_buffer* pbuffer)
+    {
+        buffers.push_back(pbuffer);
+    });
+    for(thread_input_buffer* pbuffer : buffers) {
+        shared_input_queue_.unregister_input_buffer(pbuffer);
+        free_input_buffer(pbuffer);
+    }
+    for(thread_input_buffer* pbuffer : input_buffer_pool_)
+        free_input_buffer(pbuffer);
+    input_buffer_pool_.clear();
+}
+
+bool reckless::basic_log::reserve_input_buffer_memory(std::size_t size)
+{
+    if(input_buffer_memory_budget_ == 0) {
+        input_buffer_memory_.fetch_add(size, std::memory_order_relaxed);
+        return true;
+    }
+    std::size_t current = input_buffer_memory_.load(std::memory_order_relaxed);
+    do {
+        if(current + size > input_buffer_memory_budget_)
+            return false;
+    } while(not input_buffer_memory_.compare_exchange_weak(current, current + size,
+                std::memory_order_relaxed));
+    return true;
+}
+
+// Makes pnew the calling thread's input buffer and retires pold. Everything
+// in pold must already be committed.
+void reckless::basic_log::replace_input_buffer(detail::thread_input_buffer* pold,
+        detail::thread_input_buffer* pnew)
+{
+    assert(not pold->has_uncommitted_input());
+    pnew->set_overflow_policy(pold->get_overflow_policy());
+    // With a shared queue, the data in the old buffer is already queued ahead
+    // of anything we put in the new one. Without one, the output thread uses
+    // this to keep them in order.
+    pnew->set_predecessor(pold);
+    pnew->inherit_stats(*pold);
+    try {
+        set_thread_input_buffer(pnew);
     } catch(...) {
-        detail::thread_input_buffer::destroy(p);
+        free_input_buffer(pnew);
         throw;
     }
+    shared_input_queue_.register_input_buffer(pnew);
+    pold->retire();
+    input_buffers_retired_.store(true, std::memory_order_relaxed);
+}
+
+// Frees retired input buffers that the output thread is done with, and if
+// check_idle is true, asks threads whose buffers have grown but have not been
+// used since the last check to shrink them. Must only be called from the
+// output thread, or when the output thread isn't running.
+void reckless::basic_log::sweep_input_buffers(bool check_idle)
+{
+    using detail::thread_input_buffer;
+    input_buffers_retired_.store(false, std::memory_order_relaxed);
+    std::vector<thread_input_buffer*> drained;
+    bool retired_remaining = false;
+    shared_input_queue_.for_each_input_buffer([&](thread_input_buffer* pbuffer)
+    {
+        if(pbuffer->is_retired()) {
+            if(pbuffer->input_start() == pbuffer->input_end())
+                drained.push_back(pbuffer);
+            else
+                retired_remaining = true;
+        } else if(check_idle and pbuffer->size() > pbuffer->base_size()) {
+            char* pinput_start = pbuffer->input_start();
+            if(pinput_start == pbuffer->last_swept_input_start)
+                pbuffer->request_shrink();
+            pbuffer->last_swept_input_start = pinput_start;
+        }
+    });
+    if(retired_remaining)
+        input_buffers_retired_.store(true, std::memory_order_relaxed);
+    if(drained.empty())
+        return;
+
+    {
+        // The buffer's counters have to move to exited_producer_stats_ in
+        // one step, or stats() could count them twice or not at all.
+        std::lock_guard<std::mutex> lk(stats_mutex_);
+        for(thread_input_buffer* pbuffer : drained) {
+            shared_input_queue_.unregister_input_buffer(pbuffer);
+            exited_producer_stats_ += pbuffer->stats();
+        }
+    }
+    shared_input_queue_.for_each_input_buffer([&](thread_input_buffer* pbuffer)
+    {
+        if(std::find(drained.begin(), drained.end(), pbuffer->predecessor()) != drained.end())
+            pbuffer->set_predecessor(nullptr);
+    });
+    unsigned long unreported = 0;
+    for(thread_input_buffer* pbuffer : drained) {
+        unreported += pbuffer->dropped_count() - pbuffer->reported_dropped_count;
+        release_input_buffer(pbuffer);
+    }
+    if(unreported != 0) {
+        orphaned_dropped_count_.fetch_add(unreported, std::memory_order_relaxed);
+        on_input_frame_dropped();
+    }
+}
+
+void reckless::basic_log::destroy_input_buffer(void* p)
+{
+    using detail::thread_input_buffer;
+    thread_input_buffer* pbuffer = static_cast<thread_input_buffer*>(p);
+    basic_log* plog = pbuffer->owner();
+    // The pthread key is already cleared at this point, so clear the cache
+    // entry too.
+    if(plog->thread_input_buffer_cache_generation_ != 0)
+        thread_input_buffer_cache_[plog->thread_input_buffer_cache_slot_].pbuffer = nullptr;
+    // Anything left uncommitted because the shared queue was full needs to
+    // go out before we let go of the buffer.
+    if(pbuffer->has_uncommitted_input())
+        plog->commit(pbuffer, true);
+    // We don't wait for the output thread to drain the buffer, since that
+    // would hold up the thread for no good reason. Instead we retire the
+    // buffer just as when a thread switches buffers. The output thread puts
+    // it in the pool (or frees it) once it's empty, and takes care of
+    // reporting any drops that haven't been reported yet.
+    pbuffer->retire();
+    plog->input_buffers_retired_.store(true, std::memory_order_relaxed);
+}
+
+reckless::log_stats reckless::basic_log::stats()
+{
+    using detail::thread_input_buffer;
+    log_stats s;
+    {
+        std::lock_guard<std::mutex> lk(stats_mutex_);
+        s.producers = exited_producer_stats_;
+        shared_input_queue_.for_each_input_buffer([&s](thread_input_buffer* pbuffer)
+        {
+            s.producers += pbuffer->stats();
+            // Retired buffers belong to threads that have exited or moved on
+            // to a new buffer (which includes the old buffer's counts).
+            if(not pbuffer->is_retired())
+                s.threads.push_back(pbuffer->thread_totals());
+        });
+    }
+
+    s.frames_formatted = frames_formatted_.load(std::memory_order_relaxed);
+    s.bytes_formatted = output_buffer_.bytes_flushed();
+    if(spill_writer_.is_open()) {
+        s.writer_write_calls = spill_writer_.write_calls();
+        s.writer_bytes_written = spill_writer_.bytes_written();
+        s.writer_errors = spill_writer_.write_errors();
+    } else {
+        s.writer_write_calls = output_buffer_.write_calls();
+        s.writer_bytes_written = output_buffer_.bytes_written();
+        s.writer_errors = output_buffer_.write_errors();
+    }
+    s.spill_backlog_bytes = spill_writer_.backlog();
+    s.spill_peak_backlog_bytes = spill_writer_.peak_backlog();
+    s.spill_full_stalls = spill_writer_.full_stalls();
+
+    // The output thread updates the time counters in more than one step, so
+    // read them until we get a consistent view.
+    std::int64_t start, idle_since, now;
+    std::uint64_t run, idle;
+    do {
+        start = output_thread_start_ns_.load();
+        idle_since = output_thread_idle_since_ns_.load();
+        run = output_thread_run_ns_.load();
+        idle = output_thread_idle_ns_.load();
+        now = steady_clock_ns();
+    } while(start != output_thread_start_ns_.load()
+            or idle_since != output_thread_idle_since_ns_.load());
+    if(start != 0)
+        run += static_cast<std::uint64_t>(now - start);
+    if(idle_since != 0)
+        idle += static_cast<std::uint64_t>(now - idle_since);
+    s.output_thread_idle_ns = idle;
+    s.output_thread_busy_ns = run > idle? run - idle : 0;
+    return s;
+}
+
+void reckless::basic_log::flush()
+{
+    flush_async().wait();
+}
+
+reckless::flush_ticket reckless::basic_log::flush_async()
+{
+    using namespace detail;
+    if(not is_open())
+        return flush_ticket();
+    auto prequest = std::make_shared<flush_request>();
+    thread_input_buffer* pbuffer = get_input_buffer();
+    // The flush covers frames that this thread couldn't commit earlier
+    // because of the overflow policy, too. And since it can't be dropped, we
+    // wait for room regardless of the policy.
+    if(pbuffer->has_uncommitted_input())
+        commit(pbuffer, true);
+    char* pframe = pbuffer->allocate_input_frame(FLUSH_MARKER_FRAME_SIZE);
+    *reinterpret_cast<formatter_dispatch_function_t**>(pframe) =
+        &flush_marker_dispatch;
+    new (pframe + sizeof(formatter_dispatch_function_t*))
+        std::shared_ptr<flush_request>(prequest);
+    commit(pbuffer, true);
+    return flush_ticket(std::move(prequest));
+}
+
+int reckless::basic_log::flush_notification_fd()
+{
+#if defined(__linux__)
+    int fd = flush_notification_fd_.load(std::memory_order_acquire);
+    if(fd != -1)
+        return fd;
+    std::lock_guard<std::mutex> lk(flush_notification_fd_mutex_);
+    fd = flush_notification_fd_.load(std::memory_order_relaxed);
+    if(fd == -1) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(fd == -1)
+            throw std::system_error(errno, std::system_category());
+        flush_notification_fd_.store(fd, std::memory_order_release);
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+std::size_t reckless::basic_log::flush_marker_dispatch(output_buffer*, char*)
+{
+    // The output thread checks for this function instead of calling it.
+    assert(false);
+    return FLUSH_MARKER_FRAME_SIZE;
+}
+
+// Called by the output thread when it reaches a flush marker. Everything
+// that pbuffer's thread committed before the marker has been formatted by
+// now, and with a shared queue so has everything that other threads
+// committed. Without one, we have to wait until we've drained whatever the
+// other threads had committed at this point.
+void reckless::basic_log::on_flush_marker(detail::thread_input_buffer* pbuffer,
+        char* pframe)
+{
+    using namespace detail;
+    typedef std::shared_ptr<flush_request> request_ptr;
+    auto prequest = reinterpret_cast<request_ptr*>(
+            pframe + sizeof(formatter_dispatch_function_t*));
+    pending_flush_requests_.push_back(std::move(*prequest));
+    prequest->~request_ptr();
+
+    if(shared_input_queue_.policy() != shared_input_queue_policy::none)
+        return;
+    shared_input_queue_.for_each_input_buffer([this, pbuffer](thread_input_buffer* p)
+    {
+        if(p == pbuffer or p->commit_end() == p->input_start())
+            return;
+        if(std::find(flush_barrier_buffers_.begin(), flush_barrier_buffers_.end(), p)
+                == flush_barrier_buffers_.end())
+        {
+            flush_barrier_buffers_.push_back(p);
+        }
+    });
+}
+
+void reckless::basic_log::complete_flush_requests()
+{
+    if(pending_flush_requests_.empty())
+        return;
+    if(not output_buffer_.empty())
+        output_buffer_.flush();
+    if(not unwritten_timestamps_.empty())
+        record_write_latency();
+    if(spill_writer_.is_open()) {
+        // The output only made it to the spill file so far. The spill
+        // writer's thread takes it from here.
+        spill_writer_.complete_after_write(pending_flush_requests_);
+        return;
+    }
+    for(auto& prequest : pending_flush_requests_)
+        prequest->complete();
+    pending_flush_requests_.clear();
+    detail::signal_eventfd(flush_notification_fd_.load(std::memory_order_acquire));
+}
+
+reckless::latency_stats reckless::basic_log::latency()
+{
+    latency_stats s;
+    if(penqueue_to_format_latency_) {
+        penqueue_to_format_latency_->snapshot(&s.enqueue_to_format);
+        penqueue_to_write_latency_->snapshot(&s.enqueue_to_write);
+    }
+    return s;
+}
+
+std::size_t reckless::basic_log::latency_marker_dispatch(output_buffer*, char*)
+{
+    // The output thread checks for this function instead of calling it.
+    assert(false);
+    return LATENCY_MARKER_FRAME_SIZE;
+}
+
+std::int64_t reckless::basic_log::latency_timestamp()
+{
+    return steady_clock_ns();
+}
+
+// Called by the output thread when it reaches a latency marker, i.e. right
+// after the frame that the marker belongs to has been formatted.
+void reckless::basic_log::record_format_latency(char* pframe)
+{
+    std::int64_t timestamp;
+    std::memcpy(&timestamp, pframe + sizeof(detail::formatter_dispatch_function_t*),
+            sizeof(timestamp));
+    std::int64_t now = steady_clock_ns();
+    penqueue_to_format_latency_->record(
+            static_cast<std::uint64_t>(std::max(now - timestamp, std::int64_t(0))));
+    // The entry sits in the output buffer until the next flush, so it's
+    // the next writer call that completes it.
+    if(unwritten_timestamps_.empty())
+        last_write_calls_ = output_buffer_.write_calls();
+    unwritten_timestamps_.push_back(timestamp);
+}
+
+// Records the enqueue-to-write latency for all formatted entries if the
+// output buffer has been written since they were formatted.
+void reckless::basic_log::record_write_latency()
+{
+    std::uint64_t write_calls = output_buffer_.write_calls();
+    if(write_calls == last_write_calls_)
+        return;
+    std::int64_t now = steady_clock_ns();
+    for(std::int64_t timestamp : unwritten_timestamps_) {
+        penqueue_to_write_latency_->record(
+            static_cast<std::uint64_t>(std::max(now - timestamp, std::int64_t(0))));
+    }
+    unwritten_timestamps_.clear();
+    last_write_calls_ = write_calls;
+}
+
+// Called by the output thread when it has caught up with the input, if any
+// thread has dropped frames since the last time. Writes a line saying how many
+// frames were lost so that it's visible in the log.
+void reckless::basic_log::report_dropped_input_frames()
+{
+    using detail::thread_input_buffer;
+    // Clear the flag before we read the counters. If a thread drops another
+    // frame after this then it sets the flag again, and we'll catch it next
+    // time.
+    input_frames_dropped_.exchange(false, std::memory_order_acquire);
+    unsigned long count = orphaned_dropped_count_.exchange(0, std::memory_order_relaxed);
+    shared_input_queue_.for_each_input_buffer([&count](thread_input_buffer* pbuffer)
+    {
+        unsigned long dropped = pbuffer->dropped_count();
+        count += dropped - pbuffer->reported_dropped_count;
+        pbuffer->reported_dropped_count = dropped;
+    });
+    if(count != 0)
+        (*pdropped_notice_formatter_.load(std::memory_order_relaxed))(&output_buffer_, count);
+}
+
+void reckless::basic_log::format_dropped_notice(output_buffer* poutput,
+        unsigned long count)
+{
+    // Enough for a 64-bit count plus the text.
+    char* p = poutput->reserve(64);
+    int n = std::sprintf(p, "%lu log messages dropped\n", count);
+    poutput->commit(static_cast<std::size_t>(n));
 }
 
 void reckless::basic_log::on_panic_flush_done()
 {
+    if(spill_writer_.is_open())
+        spill_writer_.limit_retries();
     output_buffer_.flush();
+    if(spill_writer_.is_open())
+        spill_writer_.wait_until_written();
     panic_flush_done_event_.signal();
     // Sleep and wait for death.
     while(true)
@@ -217,3 +1155,732 @@ void reckless::basic_log::on_panic_flush_done()
         sleep(3600);
     }
 }
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+#include <reckless/policy_log.hpp>
+#include <reckless/severity_log.hpp>
+
+#include <condition_variable>
+#include <cstdio>   // fopen, fgets
+#include <memory>   // unique_ptr
+#include <sstream>  // istringstream
+#include <string>
+
+#include <dirent.h>  // opendir
+
+namespace reckless {
+namespace {
+
+class memory_writer : public writer {
+public:
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        text_.append(static_cast<char const*>(pbuffer), count);
+        return SUCCESS;
+    }
+
+    std::string text()
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return text_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::string text_;
+};
+
+// Holds up the output thread until the gate is opened, so that input piles up
+// in the meantime.
+class gated_writer : public memory_writer {
+public:
+    gated_writer() : open_(false)
+    {
+    }
+
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        std::unique_lock<std::mutex> lk(gate_mutex_);
+        gate_condition_.wait(lk, [this] { return open_; });
+        lk.unlock();
+        return memory_writer::write(pbuffer, count);
+    }
+
+    void open_gate()
+    {
+        std::lock_guard<std::mutex> lk(gate_mutex_);
+        open_ = true;
+        gate_condition_.notify_all();
+    }
+
+private:
+    std::mutex gate_mutex_;
+    std::condition_variable gate_condition_;
+    bool open_;
+};
+
+typedef policy_log<> test_log;
+
+// Each of `threads` threads writes `count` lines "<thread> <sequence>".
+void write_from_threads(test_log& log, unsigned threads, unsigned count)
+{
+    std::vector<std::thread> workers;
+    for(unsigned t=0; t!=threads; ++t) {
+        workers.emplace_back([&log, t, count]()
+        {
+            for(unsigned i=0; i!=count; ++i)
+                log.write("%d %d", t, i);
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+// True if the output has every line from write_from_threads() exactly once,
+// with each thread's lines in the order they were written.
+bool lines_in_order(std::string const& text, unsigned threads, unsigned count)
+{
+    std::vector<unsigned> next(threads, 0);
+    std::istringstream istr(text);
+    unsigned t, i;
+    while(istr >> t >> i) {
+        if(t >= threads or i != next[t])
+            return false;
+        ++next[t];
+    }
+    if(not istr.eof())
+        return false;
+    for(unsigned n : next) {
+        if(n != count)
+            return false;
+    }
+    return true;
+}
+
+void test_shared_input_queue_policies()
+{
+    shared_input_queue_policy const policies[] = {
+        shared_input_queue_policy::boost_lockfree,
+        shared_input_queue_policy::mpsc_array,
+        shared_input_queue_policy::none
+    };
+    for(shared_input_queue_policy policy : policies) {
+        memory_writer writer;
+        log_options options;
+        options.shared_input_queue = policy;
+        // A tiny shared queue and input buffers, so that threads keep
+        // running into full queues and full buffers.
+        test_log log(&writer, 0, 4, 256, options);
+        write_from_threads(log, 4, 20000);
+        log.close();
+        TEST(lines_in_order(writer.text(), 4, 20000));
+    }
+}
+
+// After the output thread has gone idle, a single write must wake it up. With
+// spin_yield_park and no elastic buffers it sleeps without a timeout, so a
+// missed wakeup would leave the line unwritten for good.
+void test_idle_policies()
+{
+    idle_policy const policies[] = {
+        idle_policy::backoff,
+        idle_policy::spin_yield_park,
+        idle_policy::busy_poll
+    };
+    for(idle_policy policy : policies) {
+        memory_writer writer;
+        log_options options;
+        options.idle = policy;
+        options.idle_spin_count = 100;
+        options.idle_yield_count = 10;
+        test_log log(&writer, 0, 0, 0, options);
+        std::string expected;
+        for(unsigned i=0; i!=5; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            log.write("%d", i);
+            expected += std::to_string(i) + '\n';
+            auto deadline = std::chrono::steady_clock::now()
+                + std::chrono::seconds(5);
+            while(writer.text() != expected
+                    and std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            TEST(writer.text() == expected);
+        }
+    }
+}
+
+// Goes through the output line by line. Lines that start with `prefix` are
+// expected to end with a sequence number that is higher than that of the
+// previous such line; those are counted in `lines`. The counts from the
+// "messages dropped" notices are added up in `dropped`. Other lines are
+// ignored. Returns false if the sequence numbers are out of order.
+bool count_lines_and_drops(std::string const& text, std::string const& prefix,
+        unsigned& lines, unsigned long& dropped)
+{
+    std::string const NOTICE = " log messages dropped";
+    lines = 0;
+    dropped = 0;
+    long last = -1;
+    std::istringstream istr(text);
+    std::string line;
+    while(std::getline(istr, line)) {
+        if(line.size() > NOTICE.size() and line.compare(
+                    line.size() - NOTICE.size(), NOTICE.size(), NOTICE) == 0)
+        {
+            line.resize(line.size() - NOTICE.size());
+            dropped += std::stoul(line.substr(line.rfind(' ') + 1));
+        } else if(line.compare(0, prefix.size(), prefix) == 0) {
+            long sequence = std::stol(line.substr(prefix.size()));
+            if(sequence <= last)
+                return false;
+            last = sequence;
+            ++lines;
+        }
+    }
+    return true;
+}
+
+// Every message that is thrown away by the overflow policy must be accounted
+// for in a "messages dropped" notice, and nothing else may go missing.
+void test_drop_notice_counts()
+{
+    unsigned const COUNT = 10000;
+    gated_writer writer;
+    log_options options;
+    options.overflow = overflow_policy::drop_newest;
+    {
+        test_log log(&writer, 0, 0, 256, options);
+        for(unsigned i=0; i!=COUNT; ++i)
+            log.write("%d", i);
+        writer.open_gate();
+    }
+    unsigned lines;
+    unsigned long dropped;
+    TEST(count_lines_and_drops(writer.text(), "", lines, dropped));
+    TEST(dropped != 0);
+    TEST(lines + dropped == COUNT);
+}
+
+// With drop_low_priority, debug and info messages are thrown away when the
+// buffer is full, but warnings and errors wait for room.
+void test_drop_low_priority_counts()
+{
+    typedef severity_log<no_indent, ' ', severity_field> log_t;
+    unsigned const COUNT = 5000;
+    gated_writer writer;
+    log_options options;
+    options.overflow = overflow_policy::drop_low_priority;
+    {
+        log_t log(&writer, 0, 0, 256, options);
+        std::thread opener([&writer]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            writer.open_gate();
+        });
+        for(unsigned i=0; i!=COUNT; ++i) {
+            log.debug("%d", i);
+            log.error("%d", i);
+        }
+        opener.join();
+    }
+    unsigned debug_lines, error_lines;
+    unsigned long dropped;
+    TEST(count_lines_and_drops(writer.text(), "D ", debug_lines, dropped));
+    TEST(dropped != 0);
+    TEST(debug_lines + dropped == COUNT);
+    TEST(count_lines_and_drops(writer.text(), "E ", error_lines, dropped));
+    TEST(error_lines == COUNT);
+}
+
+// The thread fills up its buffer while the output thread is stuck in the
+// writer, still holding on to the buffer's contents. The thread has to move
+// on to larger buffers without losing or reordering anything, and then go
+// back to its base size once it has been idle for a while.
+void test_growth_while_output_thread_holds_buffer()
+{
+    shared_input_queue_policy const policies[] = {
+        shared_input_queue_policy::boost_lockfree,
+        shared_input_queue_policy::none
+    };
+    for(shared_input_queue_policy policy : policies) {
+        gated_writer writer;
+        log_options options;
+        options.shared_input_queue = policy;
+        options.max_thread_input_buffer_size = 16*1024;
+        options.input_buffer_shrink_delay_ms = 20;
+        // Make the shared queue large enough that the input buffer is what
+        // fills up first.
+        test_log log(&writer, 0, 16*1024, 256, options);
+        // The buffer can't hold all of this even at its largest, so the
+        // thread ends up waiting for the writer.
+        std::thread opener([&writer]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            writer.open_gate();
+        });
+        unsigned const COUNT = 5000;
+        unsigned i = 0;
+        for(; i!=COUNT; ++i)
+            log.write("0 %d", i);
+        opener.join();
+        log_stats s = log.stats();
+        TEST(s.threads.size() == 1);
+        TEST(s.threads[0].input_buffer_size == 16*1024);
+        TEST(s.producers.input_buffer_full_stalls != 0);
+
+        auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::seconds(5);
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            log.write("0 %d", i++);
+            s = log.stats();
+        } while(s.threads[0].input_buffer_size != 256
+                and std::chrono::steady_clock::now() < deadline);
+        TEST(s.threads[0].input_buffer_size == 256);
+        log.close();
+        TEST(lines_in_order(writer.text(), 1, i));
+    }
+}
+
+// A log that is created after another one was destroyed gets its cache slot,
+// and a thread that still has the old log's buffer in that slot must not
+// pick it up. More logs than there are cache slots must also work.
+void test_thread_input_buffer_cache_reuse()
+{
+    std::size_t const LOG_COUNT = detail::THREAD_INPUT_BUFFER_CACHE_SIZE + 4;
+    std::vector<std::unique_ptr<memory_writer>> writers;
+    std::vector<std::unique_ptr<test_log>> logs;
+    for(std::size_t i=0; i!=LOG_COUNT; ++i) {
+        writers.emplace_back(new memory_writer());
+        logs.emplace_back(new test_log(writers[i].get()));
+    }
+    // Each round, a second thread that outlives the logs writes to every
+    // log, and so does the main thread. Then we replace every other log, so
+    // that the new logs take over the slots of the ones we destroyed, along
+    // with generations' worth of stale cache entries in both threads.
+    std::mutex mutex;
+    std::condition_variable condition;
+    unsigned requested_round = 0;
+    unsigned finished_round = 0;
+    std::thread worker([&]()
+    {
+        for(unsigned round=1; round<=3; ++round) {
+            std::unique_lock<std::mutex> lk(mutex);
+            condition.wait(lk, [&] { return requested_round == round; });
+            for(std::size_t i=0; i!=LOG_COUNT; ++i)
+                logs[i]->write("1 %d", round);
+            finished_round = round;
+            condition.notify_all();
+        }
+    });
+    for(unsigned round=1; round<=3; ++round) {
+        for(std::size_t i=0; i!=LOG_COUNT; ++i)
+            logs[i]->write("0 %d", round);
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            requested_round = round;
+            condition.notify_all();
+            condition.wait(lk, [&] { return finished_round == round; });
+        }
+        for(std::size_t i=0; i!=LOG_COUNT; ++i) {
+            std::string expected = "0 " + std::to_string(round) + "\n"
+                + "1 " + std::to_string(round) + "\n";
+            logs[i]->close();
+            TEST(writers[i]->text() == expected);
+        }
+        for(std::size_t i=0; i!=LOG_COUNT; ++i) {
+            if(i % 2 == 0) {
+                logs[i].reset();
+                writers[i].reset(new memory_writer());
+                logs[i].reset(new test_log(writers[i].get()));
+            } else {
+                writers[i].reset(new memory_writer());
+                logs[i]->open(writers[i].get());
+            }
+        }
+    }
+    worker.join();
+}
+
+// Threads come and go, and new threads get the buffers of the old ones from
+// the pool. A recycled buffer must start out empty, with the counters of the
+// new thread only.
+void test_input_buffer_recycling()
+{
+    memory_writer writer;
+    log_options options;
+    options.input_buffer_pool_size = 2;
+    test_log log(&writer, 0, 0, 0, options);
+    unsigned const ROUNDS = 20;
+    unsigned const COUNT = 100;
+    std::atomic<unsigned> bad_stats(0);
+    for(unsigned round=0; round!=ROUNDS; ++round) {
+        std::thread t([&log, &bad_stats, round, COUNT]()
+        {
+            for(unsigned i=0; i!=COUNT; ++i)
+                log.write("%d %d", round, i);
+            long id = detail::current_thread_id();
+            unsigned found = 0;
+            for(thread_stats const& ts : log.stats().threads) {
+                if(ts.thread_id == id) {
+                    ++found;
+                    if(ts.frames_enqueued != COUNT or ts.frames_dropped != 0)
+                        bad_stats.fetch_add(1);
+                }
+            }
+            if(found != 1)
+                bad_stats.fetch_add(1);
+        });
+        t.join();
+        // Give the output thread a chance to put the buffer in the pool.
+        log.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    TEST(bad_stats.load() == 0);
+    log_stats s = log.stats();
+    TEST(s.producers.frames_enqueued == ROUNDS*COUNT);
+    log.close();
+    TEST(lines_in_order(writer.text(), ROUNDS, COUNT));
+
+    // The same thing with several threads coming and going at once.
+    memory_writer writer2;
+    log.open(&writer2, 0, 0, 0, options);
+    std::vector<std::thread> churners;
+    for(unsigned c=0; c!=4; ++c) {
+        churners.emplace_back([&log, c]()
+        {
+            for(unsigned round=0; round!=50; ++round) {
+                std::thread t([&log, c, round]()
+                {
+                    for(unsigned i=0; i!=20; ++i)
+                        log.write("%d %d", c, round*20 + i);
+                });
+                t.join();
+            }
+        });
+    }
+    for(std::thread& t : churners)
+        t.join();
+    log.close();
+    TEST(lines_in_order(writer2.text(), 4, 50*20));
+}
+
+// register_thread() gives the thread a buffer of the default size up front,
+// with whatever memory options the log has, and leaves an existing buffer
+// alone.
+void test_register_thread()
+{
+    log_options plain;
+    log_options mapped;
+    mapped.huge_pages = huge_page_policy::transparent;
+    mapped.numa_local_input_buffers = true;
+    mapped.lock_buffers = true;
+    log_options const* option_sets[] = {&plain, &mapped};
+    for(log_options const* poptions : option_sets) {
+        memory_writer writer;
+        test_log log(&writer, 0, 0, 4096, *poptions);
+        std::atomic<unsigned> failures(0);
+        auto find_own_stats = [&log](thread_stats& result)
+        {
+            long id = detail::current_thread_id();
+            for(thread_stats const& ts : log.stats().threads) {
+                if(ts.thread_id == id) {
+                    result = ts;
+                    return true;
+                }
+            }
+            return false;
+        };
+        std::thread t([&]()
+        {
+            thread_stats ts;
+            if(find_own_stats(ts))
+                failures.fetch_add(1);
+            log.register_thread();
+            if(not find_own_stats(ts) or ts.input_buffer_size != 4096
+                    or ts.frames_enqueued != 0)
+                failures.fetch_add(1);
+            log.register_thread();
+            log.write("%d %d", 0, 0);
+            if(not find_own_stats(ts) or ts.frames_enqueued != 1
+                    or log.stats().threads.size() != 1)
+                failures.fetch_add(1);
+        });
+        t.join();
+
+        // A thread that has already picked its own buffer size keeps it.
+        std::thread t2([&]()
+        {
+            log.set_thread_input_buffer_size(8192);
+            log.register_thread();
+            thread_stats ts;
+            if(not find_own_stats(ts) or ts.input_buffer_size != 8192)
+                failures.fetch_add(1);
+            log.write("%d %d", 1, 0);
+        });
+        t2.join();
+        log.close();
+        TEST(failures.load() == 0);
+        TEST(lines_in_order(writer.text(), 2, 1));
+    }
+}
+
+// Output thread settings that can't be applied make open() throw, and leave
+// the log closed so that it can be opened again. The name is best-effort.
+void test_output_thread_options()
+{
+    class log_t : public test_log {
+    public:
+        using test_log::is_open;
+    };
+    memory_writer writer;
+    log_t log;
+    log_options bad_cpus;
+    // No such CPU, so the affinity mask ends up empty.
+    bad_cpus.output_thread_cpus.push_back(100000);
+    log_options bad_policy;
+    bad_policy.output_thread_sched_policy = 12345;
+    log_options bad_priority;
+    bad_priority.output_thread_sched_policy = SCHED_OTHER;
+    bad_priority.output_thread_sched_priority = 99;
+    log_options const* bad_options[] = {&bad_cpus, &bad_policy, &bad_priority};
+    for(log_options const* poptions : bad_options) {
+        bool thrown = false;
+        try {
+            log.open(&writer, 0, 0, 0, *poptions);
+        } catch(std::system_error const&) {
+            thrown = true;
+        }
+        TEST(thrown);
+        TEST(not log.is_open());
+    }
+
+    // Longer than the kernel allows; it gets cut short instead of failing.
+    log_options named;
+    named.output_thread_name = "reckless-test-output-thread";
+    log.open(&writer, 0, 0, 0, named);
+    TEST(log.is_open());
+    bool found = false;
+    DIR* pdir = opendir("/proc/self/task");
+    TEST(pdir != nullptr);
+    while(dirent* pentry = readdir(pdir)) {
+        std::string path = std::string("/proc/self/task/") + pentry->d_name
+            + "/comm";
+        FILE* file = std::fopen(path.c_str(), "r");
+        if(not file)
+            continue;
+        char name[32] = {};
+        if(std::fgets(name, sizeof(name), file))
+            found = found or std::string(name) == "reckless-test-o\n";
+        std::fclose(file);
+    }
+    closedir(pdir);
+    TEST(found);
+    log.write("%d %d", 0, 0);
+    log.close();
+    TEST(lines_in_order(writer.text(), 1, 1));
+}
+
+class failing_writer : public writer {
+public:
+    Result write(void const*, std::size_t) override
+    {
+        return ERROR_GIVE_UP;
+    }
+};
+
+void test_stats_counters()
+{
+    unsigned const COUNT = 2000;
+    // A tiny shared queue and then a tiny input buffer, with the writer
+    // holding up the output thread for a while, so that the thread has to
+    // wait for each of them in turn.
+    for(int queue_full=1; queue_full>=0; --queue_full) {
+        gated_writer writer;
+        test_log log(&writer, 0, queue_full? 4 : 16*1024,
+                queue_full? 64*1024 : 256);
+        std::thread opener([&writer]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            writer.open_gate();
+        });
+        for(unsigned i=0; i!=COUNT; ++i)
+            log.write("0 %d", i);
+        opener.join();
+        log_stats s = log.stats();
+        TEST(s.threads.size() == 1);
+        TEST(s.threads[0].thread_id == detail::current_thread_id());
+        TEST(s.threads[0].frames_enqueued == COUNT);
+        log.close();
+
+        // The counters survive close().
+        s = log.stats();
+        std::string text = writer.text();
+        TEST(s.producers.frames_enqueued == COUNT);
+        TEST(s.producers.frames_dropped == 0);
+        if(queue_full) {
+            TEST(s.producers.shared_queue_full_stalls != 0);
+            TEST(s.producers.shared_queue_full_stall_ns != 0);
+        } else {
+            TEST(s.producers.input_buffer_full_stalls != 0);
+            TEST(s.producers.input_buffer_full_stall_ns != 0);
+        }
+        TEST(s.frames_formatted == COUNT);
+        TEST(s.bytes_formatted == text.size());
+        TEST(s.writer_bytes_written == text.size());
+        TEST(s.writer_write_calls != 0);
+        TEST(s.writer_errors == 0);
+        TEST(s.output_thread_busy_ns != 0);
+        TEST(s.output_thread_idle_ns != 0);
+        TEST(lines_in_order(text, 1, COUNT));
+    }
+
+    // Writes that fail are counted as errors, and their bytes as formatted
+    // but not written.
+    failing_writer writer;
+    test_log log(&writer);
+    for(unsigned i=0; i!=10; ++i) {
+        log.write("0 %d", i);
+        log.flush();
+    }
+    log_stats s = log.stats();
+    TEST(s.frames_formatted == 10);
+    TEST(s.bytes_formatted != 0);
+    TEST(s.writer_bytes_written == 0);
+    TEST(s.writer_write_calls != 0);
+    TEST(s.writer_errors == s.writer_write_calls);
+}
+
+void test_flush_tickets()
+{
+    gated_writer writer;
+    test_log log(&writer);
+    // Nothing has been written, so there is nothing to wait for.
+    TEST(log.flush_async().wait(5000));
+
+    int fd = log.flush_notification_fd();
+    TEST(fd != -1);
+    log.write("0 %d", 0);
+    flush_ticket ticket = log.flush_async();
+    TEST(not ticket.wait(20));
+    TEST(not ticket.done());
+    // Copies of the ticket can be waited on from several threads.
+    std::atomic<unsigned> completed(0);
+    std::vector<std::thread> waiters;
+    for(unsigned i=0; i!=3; ++i) {
+        waiters.emplace_back([ticket, i, &completed]() mutable
+        {
+            if(i % 2 == 0)
+                ticket.wait();
+            else if(not ticket.wait(10000))
+                return;
+            completed.fetch_add(1);
+        });
+    }
+    writer.open_gate();
+    TEST(ticket.wait(10000));
+    TEST(ticket.done());
+    TEST(writer.text() == "0 0\n");
+    for(std::thread& t : waiters)
+        t.join();
+    TEST(completed.load() == 3);
+    std::uint64_t count = 0;
+    TEST(read(fd, &count, sizeof(count)) == sizeof(count));
+    TEST(count != 0);
+
+    // A flush covers what other threads committed before it, not just the
+    // calling thread.
+    std::thread t([&log]()
+    {
+        for(unsigned i=1; i!=1000; ++i)
+            log.write("0 %d", i);
+    });
+    t.join();
+    std::thread flusher([&log]() { log.flush(); });
+    flusher.join();
+    TEST(lines_in_order(writer.text(), 1, 1000));
+}
+
+class stuck_writer : public writer {
+public:
+    Result write(void const*, std::size_t) override
+    {
+        return ERROR_TRY_LATER;
+    }
+};
+
+void test_spill_close_with_stuck_writer()
+{
+    // A writer that never recovers, e.g. on a full disk, and more output than
+    // the spill file holds, so the output thread is stuck waiting for room
+    // in the file. close() must still return once the retry timeout is up.
+    typedef std::chrono::steady_clock clock;
+    log_options options;
+    options.spill_file = "/tmp/reckless_spill_log_test_" + std::to_string(getpid());
+    options.spill_file_size = 4096;
+    options.spill_retry_timeout_ms = 100;
+    stuck_writer writer;
+    test_log log(&writer, 0, 0, 0, options);
+    std::string padding(40, 'x');
+    for(unsigned i=0; i!=200; ++i)
+        log.write("0 %d %s", i, padding);
+    auto start = clock::now();
+    log.close();
+    TEST(clock::now() - start < std::chrono::seconds(3));
+    TEST(access(options.spill_file.c_str(), F_OK) != 0);
+}
+
+void test_flush_ticket_timeout_while_waited()
+{
+    // One copy of a ticket times out while another thread is asleep waiting
+    // for a copy without a timeout. The sleeping thread must still wake up
+    // when the request completes.
+    auto prequest = std::make_shared<detail::flush_request>();
+    flush_ticket untimed(prequest);
+    flush_ticket timed(prequest);
+    std::atomic<bool> woken(false);
+    std::thread waiter([&]()
+    {
+        untimed.wait();
+        woken.store(true);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST(not timed.wait(50));
+    TEST(not woken.load());
+    prequest->complete();
+    for(unsigned i=0; i!=500 and not woken.load(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // Don't leave a joinable thread behind if the test fails.
+    bool was_woken = woken.load();
+    if(was_woken)
+        waiter.join();
+    else
+        waiter.detach();
+    TEST(was_woken);
+    TEST(timed.wait(0));
+}
+
+}   // anonymous namespace
+
+unit_test::suite<> basic_log_tests = {
+    TESTCASE(test_shared_input_queue_policies),
+    TESTCASE(test_idle_policies),
+    TESTCASE(test_drop_notice_counts),
+    TESTCASE(test_drop_low_priority_counts),
+    TESTCASE(test_growth_while_output_thread_holds_buffer),
+    TESTCASE(test_thread_input_buffer_cache_reuse),
+    TESTCASE(test_input_buffer_recycling),
+    TESTCASE(test_register_thread),
+    TESTCASE(test_output_thread_options),
+    TESTCASE(test_stats_counters),
+    TESTCASE(test_flush_tickets),
+    TESTCASE(test_spill_close_with_stuck_writer),
+    TESTCASE(test_flush_ticket_timeout_while_waited)
+};
+
+}   // namespace reckless
+#endif  // UNIT_TEST
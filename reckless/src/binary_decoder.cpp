@@ -0,0 +1,749 @@
+#include <reckless/binary_decoder.hpp>
+#include <reckless/template_formatter.hpp>
+#include <reckless/policy_log.hpp>    // timestamp_field
+#include <reckless/detail/binary_encoding.hpp>
+
+#include <algorithm>    // search
+#include <cstring>      // memcpy, strchr
+#include <ciso646>
+
+#include <sys/time.h>   // timeval
+
+namespace {
+using namespace reckless::detail;
+
+bool is_argument_code(char c)
+{
+    return c != '\0' and std::strchr("cbBsSiIlLqQfdDxzZp", c) != nullptr;
+}
+
+bool is_field_code(char c)
+{
+    return c == 'T' or c == 'N';
+}
+
+std::int64_t const MICROSECONDS_PER_SECOND = 1000000;
+std::int64_t const NANOSECONDS_PER_SECOND = 1000000000;
+
+void write_newline(reckless::output_buffer* poutput)
+{
+    char* p = poutput->reserve(1);
+    *p = '\n';
+    poutput->commit(1);
+}
+}
+
+// Reads values from one record. The read functions return false if the input
+// ends before the value does, which means that the record is incomplete, and
+// throw if the value can't be right.
+class reckless::binary_decoder::reader {
+public:
+    reader(char const* pbegin, char const* pend) :
+        pbegin_(pbegin),
+        pend_(pend),
+        p_(pbegin),
+        precord_(pbegin)
+    {
+    }
+
+    void start_record()
+    {
+        precord_ = p_;
+    }
+    std::size_t record_offset() const
+    {
+        return static_cast<std::size_t>(precord_ - pbegin_);
+    }
+
+    [[noreturn]] void corrupt(char const* what) const
+    {
+        throw binary_decode_error(what, record_offset());
+    }
+
+    bool varint(std::uint64_t& value)
+    {
+        value = 0;
+        for(unsigned shift = 0; shift != 7*MAX_VARINT_SIZE; shift += 7) {
+            if(p_ == pend_)
+                return false;
+            unsigned char byte = static_cast<unsigned char>(*p_++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if(not (byte & 0x80))
+                return true;
+        }
+        corrupt("varint too long");
+    }
+
+    bool zigzag(std::int64_t& value)
+    {
+        std::uint64_t u;
+        if(not varint(u))
+            return false;
+        value = zigzag_decode(u);
+        return true;
+    }
+
+    bool bytes(void* pdest, std::size_t count)
+    {
+        if(static_cast<std::size_t>(pend_ - p_) < count)
+            return false;
+        std::memcpy(pdest, p_, count);
+        p_ += count;
+        return true;
+    }
+
+    bool string(std::string& s)
+    {
+        std::uint64_t size;
+        if(not varint(size))
+            return false;
+        if(size > MAX_BINARY_STRING_SIZE)
+            corrupt("string too long");
+        if(static_cast<std::uint64_t>(pend_ - p_) < size)
+            return false;
+        s.assign(p_, static_cast<std::size_t>(size));
+        p_ += size;
+        return true;
+    }
+
+private:
+    char const* pbegin_;
+    char const* pend_;
+    char const* p_;
+    char const* precord_;
+};
+
+reckless::binary_decoder::binary_decoder(output_buffer* poutput) :
+    poutput_(poutput),
+    in_stream_(false),
+    separator_(' ')
+{
+}
+
+std::size_t reckless::binary_decoder::decode(char const* pinput,
+        std::size_t size)
+{
+    reader r(pinput, pinput + size);
+    while(true) {
+        r.start_record();
+        if(not decode_record(r))
+            return r.record_offset();
+    }
+}
+
+std::size_t reckless::binary_decoder::find_stream_header(char const* pinput,
+        std::size_t size)
+{
+    in_stream_ = false;
+    char const pattern[] = {static_cast<char>(BINARY_RECORD_STREAM_HEADER),
+        'r', 'e', 'c', 'k', 'l', 'e', 's', 's'};
+    static_assert(sizeof(pattern) == 1 + BINARY_MAGIC_SIZE,
+            "pattern must match the magic");
+    // Start one byte in so that we always make progress, even if the bad
+    // record was a header.
+    if(size <= sizeof(pattern))
+        return size == 0? 0 : 1;
+    char const* pend = pinput + size;
+    char const* p = std::search(pinput + 1, pend, pattern,
+            pattern + sizeof(pattern));
+    if(p != pend)
+        return static_cast<std::size_t>(p - pinput);
+    return size - (sizeof(pattern) - 1);
+}
+
+bool reckless::binary_decoder::decode_record(reader& r)
+{
+    std::uint64_t type;
+    if(not r.varint(type))
+        return false;
+    if(type == BINARY_RECORD_STREAM_HEADER)
+        return read_stream_header(r);
+    if(not in_stream_)
+        r.corrupt("missing stream header");
+    if(type == BINARY_RECORD_DEFINITION)
+        return read_definition(r);
+
+    if(type == BINARY_RECORD_DROPPED_NOTICE) {
+        std::uint64_t count;
+        if(not read_fields(r) or not r.varint(count))
+            return false;
+        write_fields();
+        template_formatter::format(poutput_, "%d log messages dropped",
+                static_cast<unsigned long>(count));
+        write_newline(poutput_);
+        return true;
+    }
+
+    std::uint64_t index = type - BINARY_RECORD_FIRST_MESSAGE_ID;
+    if(index >= definitions_.size())
+        r.corrupt("undefined message id");
+    definition const& def = definitions_[index];
+    if(not read_fields(r))
+        return false;
+    if(def.signature == BINARY_PREFORMATTED_SIGNATURE) {
+        arguments_.resize(1);
+        if(not r.string(arguments_[0].s))
+            return false;
+        write_fields();
+        poutput_->write(arguments_[0].s.data(), arguments_[0].s.size());
+    } else {
+        if(not read_arguments(r, def.signature))
+            return false;
+        write_fields();
+        write_arguments(def);
+    }
+    write_newline(poutput_);
+    return true;
+}
+
+bool reckless::binary_decoder::read_stream_header(reader& r)
+{
+    char magic[BINARY_MAGIC_SIZE];
+    if(not r.bytes(magic, sizeof(magic)))
+        return false;
+    if(0 != std::memcmp(magic, BINARY_MAGIC, sizeof(magic)))
+        r.corrupt("not a reckless binary log");
+    std::uint64_t version;
+    char separator;
+    std::string field_codes;
+    if(not r.varint(version))
+        return false;
+    if(version != BINARY_FORMAT_VERSION)
+        r.corrupt("unsupported binary log version");
+    std::uint64_t field_count;
+    if(not r.bytes(&separator, 1) or not r.varint(field_count))
+        return false;
+    field_codes.resize(static_cast<std::size_t>(std::min(field_count,
+                    std::uint64_t(255))));
+    if(field_count != field_codes.size())
+        r.corrupt("too many header fields");
+    if(not r.bytes(&field_codes[0], field_codes.size()))
+        return false;
+    for(char c : field_codes) {
+        if(not is_field_code(c))
+            r.corrupt("unknown header field type");
+    }
+
+    in_stream_ = true;
+    separator_ = separator;
+    field_codes_ = std::move(field_codes);
+    definitions_.clear();
+    return true;
+}
+
+bool reckless::binary_decoder::read_definition(reader& r)
+{
+    std::uint64_t id;
+    definition def;
+    if(not r.varint(id) or not r.string(def.format) or not r.string(def.signature))
+        return false;
+    // binary_log hands out ids in order, so anything else means we're
+    // reading garbage.
+    if(id != BINARY_RECORD_FIRST_MESSAGE_ID + definitions_.size())
+        r.corrupt("unexpected message id in definition");
+    if(def.signature != BINARY_PREFORMATTED_SIGNATURE) {
+        for(char c : def.signature) {
+            if(not is_argument_code(c))
+                r.corrupt("unknown argument type");
+        }
+    }
+    if(def.format.find('\0') != std::string::npos)
+        r.corrupt("format string contains NUL");
+    definitions_.push_back(std::move(def));
+    return true;
+}
+
+bool reckless::binary_decoder::read_fields(reader& r)
+{
+    fields_.resize(field_codes_.size());
+    for(std::size_t i=0; i!=field_codes_.size(); ++i) {
+        // Both field types are timestamps, as seconds plus a fraction in
+        // microseconds ('T') or nanoseconds ('N').
+        std::int64_t const units_per_second = field_codes_[i] == 'T'?
+            MICROSECONDS_PER_SECOND : NANOSECONDS_PER_SECOND;
+        std::int64_t seconds;
+        std::uint64_t fraction;
+        if(not r.zigzag(seconds) or not r.varint(fraction))
+            return false;
+        if(fraction >= static_cast<std::uint64_t>(units_per_second))
+            r.corrupt("bad timestamp");
+        fields_[i].i = seconds*units_per_second
+            + static_cast<std::int64_t>(fraction);
+    }
+    return true;
+}
+
+bool reckless::binary_decoder::read_arguments(reader& r,
+        std::string const& signature)
+{
+    arguments_.resize(signature.size());
+    for(std::size_t i=0; i!=signature.size(); ++i) {
+        argument& arg = arguments_[i];
+        bool complete;
+        switch(signature[i]) {
+        case 'b': case 's': case 'i': case 'l': case 'q':
+            complete = r.zigzag(arg.i);
+            break;
+        case 'c': case 'B': case 'S': case 'I': case 'L': case 'Q': case 'p':
+            complete = r.varint(arg.u);
+            break;
+        case 'f':
+            complete = r.bytes(&arg.f, sizeof(arg.f));
+            break;
+        case 'd':
+            complete = r.bytes(&arg.d, sizeof(arg.d));
+            break;
+        case 'D':
+            complete = r.bytes(&arg.ld, sizeof(arg.ld));
+            break;
+        case 'x':
+            complete = r.zigzag(arg.i) and r.varint(arg.scale);
+            break;
+        default:    // 'z', 'Z'
+            complete = r.string(arg.s);
+            break;
+        }
+        if(not complete)
+            return false;
+    }
+    return true;
+}
+
+void reckless::binary_decoder::write_fields()
+{
+    for(std::size_t i=0; i!=fields_.size(); ++i) {
+        argument const& field = fields_[i];
+        if(field_codes_[i] == 'N') {
+            detail::format_nanosecond_timestamp(poutput_, field.i);
+        } else {
+            std::int64_t seconds = field.i / MICROSECONDS_PER_SECOND;
+            std::int64_t microseconds = field.i % MICROSECONDS_PER_SECOND;
+            if(microseconds < 0) {
+                seconds -= 1;
+                microseconds += MICROSECONDS_PER_SECOND;
+            }
+            timeval tv;
+            tv.tv_sec = static_cast<time_t>(seconds);
+            tv.tv_usec = static_cast<suseconds_t>(microseconds);
+            timestamp_field(tv).format(poutput_);
+        }
+        char* p = poutput_->reserve(1);
+        *p = separator_;
+        poutput_->commit(1);
+    }
+}
+
+void reckless::binary_decoder::write_arguments(definition const& def)
+{
+    // This is template_formatter::format() unrolled, with each argument
+    // converted back to the type it had in the program.
+    char const* pformat = def.format.c_str();
+    for(std::size_t i=0; pformat and i!=def.signature.size(); ++i) {
+        argument const& arg = arguments_[i];
+        output_buffer* p = poutput_;
+        switch(def.signature[i]) {
+        case 'c':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<char>(arg.u));
+            break;
+        case 'b':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<signed char>(arg.i));
+            break;
+        case 'B':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<unsigned char>(arg.u));
+            break;
+        case 's':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<short>(arg.i));
+            break;
+        case 'S':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<unsigned short>(arg.u));
+            break;
+        case 'i':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<int>(arg.i));
+            break;
+        case 'I':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<unsigned int>(arg.u));
+            break;
+        case 'l':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<long>(arg.i));
+            break;
+        case 'L':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<unsigned long>(arg.u));
+            break;
+        case 'q':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<long long>(arg.i));
+            break;
+        case 'Q':
+            pformat = template_formatter::format_argument(p, pformat, static_cast<unsigned long long>(arg.u));
+            break;
+        case 'f':
+            pformat = template_formatter::format_argument(p, pformat, arg.f);
+            break;
+        case 'd':
+            pformat = template_formatter::format_argument(p, pformat, arg.d);
+            break;
+        case 'D':
+            pformat = template_formatter::format_argument(p, pformat, arg.ld);
+            break;
+        case 'x':
+            pformat = template_formatter::format_argument(p, pformat,
+                    decimal(arg.i, static_cast<unsigned>(arg.scale)));
+            break;
+        case 'z':
+            pformat = template_formatter::format_argument(p, pformat, arg.s.c_str());
+            break;
+        case 'Z':
+            pformat = template_formatter::format_argument(p, pformat, arg.s);
+            break;
+        case 'p':
+            pformat = template_formatter::format_argument(p, pformat,
+                    reinterpret_cast<void const*>(static_cast<std::uintptr_t>(arg.u)));
+            break;
+        }
+    }
+    if(pformat)
+        template_formatter::format(poutput_, pformat);
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+#include <reckless/binary_log.hpp>
+#include <climits>  // LONG_MIN etc.
+#include <unistd.h>  // getpid
+
+namespace reckless {
+namespace detail {
+
+struct unencodable {
+    int value;
+};
+
+char const* format(output_buffer* pbuffer, char const* pformat, unencodable v)
+{
+    if(*pformat != 's')
+        return nullptr;
+    template_formatter::format(pbuffer, "<%d>", v.value);
+    return pformat + 1;
+}
+
+typedef policy_formatter<no_indent, '|', timestamp_field> text_formatter_t;
+typedef binary_formatter<'|', timestamp_field> binary_formatter_t;
+
+timeval test_time(long seconds, long microseconds)
+{
+    timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = microseconds;
+    return tv;
+}
+
+// Formats each message both ways, and makes sure the decoder turns the binary
+// version into the same text.
+class round_trip {
+public:
+    round_trip() :
+        text_(&text_writer_, 4096),
+        binary_(&binary_writer_, 4096)
+    {
+        char const* pfield_codes = binary_field_codes<timestamp_field>::value;
+        encoder_.reset('|', pfield_codes);
+        std::string header = binary_encoder::stream_header('|', pfield_codes);
+        binary_writer_.write(header.data(), header.size());
+    }
+
+    template <typename... Args>
+    void write(timeval const& tv, char const* pformat, Args... args)
+    {
+        text_formatter_t::format(&text_, timestamp_field(tv), no_indent(),
+                pformat, args...);
+        binary_formatter_t::format(&binary_, &encoder_, timestamp_field(tv),
+                pformat, args...);
+    }
+
+    void write_dropped_notice(unsigned long count)
+    {
+        text_formatter_t::format(&text_, timestamp_field(), no_indent(),
+                "%d log messages dropped", count);
+        binary_formatter_t::format_dropped_notice(&binary_, count);
+    }
+
+    std::string const& text()
+    {
+        text_.flush();
+        return text_writer_.str();
+    }
+    std::string const& binary()
+    {
+        binary_.flush();
+        return binary_writer_.str();
+    }
+
+private:
+    unit_test::string_writer text_writer_;
+    unit_test::string_writer binary_writer_;
+    output_buffer text_;
+    output_buffer binary_;
+    binary_encoder encoder_;
+};
+
+std::string decode_all(std::string const& input, std::size_t chunk_size)
+{
+    unit_test::string_writer writer;
+    output_buffer output(&writer, 4096);
+    binary_decoder decoder(&output);
+    std::string pending;
+    for(std::size_t pos=0; pos < input.size(); pos += chunk_size) {
+        pending.append(input, pos, chunk_size);
+        std::size_t consumed = decoder.decode(pending.data(), pending.size());
+        pending.erase(0, consumed);
+    }
+    TEST(pending.empty());
+    output.flush();
+    return writer.str();
+}
+
+// Like reckless-decode: skips to the next stream header after each error.
+std::string decode_skipping_errors(std::string const& input, unsigned& errors)
+{
+    unit_test::string_writer w;
+    output_buffer output(&w, 4096);
+    binary_decoder decoder(&output);
+    std::size_t pos = 0;
+    errors = 0;
+    while(pos != input.size()) {
+        try {
+            std::size_t consumed = decoder.decode(input.data() + pos,
+                    input.size() - pos);
+            TEST(consumed != 0 or pos == input.size());
+            pos += consumed;
+            if(consumed == 0)
+                break;
+        } catch(binary_decode_error const& e) {
+            ++errors;
+            pos += e.offset();
+            pos += decoder.find_stream_header(input.data() + pos,
+                    input.size() - pos);
+        }
+    }
+    TEST(pos == input.size());
+    output.flush();
+    return w.str();
+}
+
+void write_test_messages(round_trip& rt)
+{
+    timeval tv = test_time(1500000000, 123456);
+    std::string s("std::string");
+    int x = 17;
+    rt.write(tv, "no arguments");
+    rt.write(tv, "int %d, negative %d, unsigned %u", 42, -42, 42u);
+    rt.write(tv, "long %d %d, long long %d %d", LONG_MIN, ULONG_MAX,
+            LLONG_MIN, ULLONG_MAX);
+    rt.write(tv, "short %d %d, char %c%c%c", static_cast<short>(-3),
+            static_cast<unsigned short>(65535), 'a',
+            static_cast<signed char>('b'), static_cast<unsigned char>('c'));
+    rt.write(tv, "hex %x %#X, padded %08d %-5d|", 0xbeef, 255u, 123, -7);
+    rt.write(tv, "float %f, double %.3f %g, long double %f", 1.5f, 3.14159,
+            1e-5, static_cast<long double>(2.25));
+    rt.write(tv, "strings %s %s", "literal", s);
+    rt.write(tv, "pointer %p", static_cast<void const*>(&x));
+    rt.write(tv, "100%% literal percent");
+    rt.write(tv, "too few %d %d", 1);
+    rt.write(tv, "too many %d", 1, 2);
+    rt.write(tv, "shortest %s, scientific %e %G", 0.1, 1234.5, 1e-20f);
+    rt.write(tv, "decimal %s %.2f", decimal(-1250000000, 8), decimal(12345, 3));
+    // Arrays have no binary encoding, so this one is preformatted.
+    int levels[] = {3, -1, 4};
+    rt.write(tv, "array [%d]", frame_elements<int>(levels, 3, ", "));
+    rt.write(tv, "mismatch %d", 3.5);
+    rt.write(tv, "custom %s next to %d", unencodable{5}, 6);
+    // The same call sites again, now with dictionary entries.
+    rt.write(test_time(-1, 999999), "no arguments");
+    rt.write(tv, "int %d, negative %d, unsigned %u", 0, 0, 0u);
+    rt.write(tv, "custom %s next to %d", unencodable{-5}, -6);
+    rt.write_dropped_notice(12);
+}
+
+void test_binary_round_trip()
+{
+    round_trip rt;
+    write_test_messages(rt);
+    std::string decoded = decode_all(rt.binary(), rt.binary().size());
+    // The dropped notice has the current time in the text version; we only
+    // compare what comes after it.
+    std::string const& text = rt.text();
+    std::size_t text_last = text.rfind('\n', text.size() - 2) + 1;
+    std::size_t decoded_last = decoded.rfind('\n', decoded.size() - 2) + 1;
+    TEST(decoded.substr(0, decoded_last) == text.substr(0, text_last));
+    TEST(decoded.substr(decoded_last + 24) == text.substr(text_last + 24));
+    TEST(decoded.substr(decoded_last + 24) == "|12 log messages dropped\n");
+    TEST(rt.binary().size() < text.size());
+}
+
+void test_binary_chunked()
+{
+    round_trip rt;
+    write_test_messages(rt);
+    std::string whole = decode_all(rt.binary(), rt.binary().size());
+    TEST(decode_all(rt.binary(), 1) == whole);
+    TEST(decode_all(rt.binary(), 7) == whole);
+}
+
+void test_binary_varint()
+{
+    std::uint64_t const values[] = {0, 1, 127, 128, 300, 16383, 16384,
+        0xffffffffu, ~std::uint64_t(0)};
+    for(std::uint64_t v : values) {
+        unit_test::string_writer w;
+        output_buffer buffer(&w, 64);
+        write_varint(&buffer, v);
+        buffer.flush();
+        std::size_t expected_size = 1;
+        for(std::uint64_t rest = v >> 7; rest != 0; rest >>= 7)
+            ++expected_size;
+        TEST(w.str().size() == expected_size);
+    }
+    std::int64_t const signed_values[] = {0, -1, 1, -64, 64, INT64_MIN,
+        INT64_MAX};
+    for(std::int64_t v : signed_values)
+        TEST(zigzag_decode(zigzag_encode(v)) == v);
+    TEST(zigzag_encode(-1) == 1);
+    TEST(zigzag_encode(1) == 2);
+}
+
+void test_binary_corrupt()
+{
+    round_trip rt;
+    write_test_messages(rt);
+    std::string const& binary = rt.binary();
+    std::string whole = decode_all(binary, binary.size());
+
+    // No stream header.
+    {
+        unit_test::string_writer w;
+        output_buffer output(&w, 4096);
+        binary_decoder decoder(&output);
+        bool thrown = false;
+        try {
+            decoder.decode("\x03\x00", 2);
+        } catch(binary_decode_error const& e) {
+            thrown = true;
+            TEST(e.offset() == 0);
+        }
+        TEST(thrown);
+    }
+
+    // A definition whose format string claims to be 2^50 bytes long. We
+    // must not take that as an incomplete record and wait for the rest.
+    {
+        std::string header = binary_encoder::stream_header('|', "");
+        unit_test::string_writer record_writer;
+        output_buffer record(&record_writer, 64);
+        write_varint(&record, BINARY_RECORD_DEFINITION);
+        write_varint(&record, BINARY_RECORD_FIRST_MESSAGE_ID);
+        write_varint(&record, std::uint64_t(1) << 50);
+        record.flush();
+        std::string input = header + record_writer.str() + "xyz";
+
+        unit_test::string_writer w;
+        output_buffer output(&w, 4096);
+        binary_decoder decoder(&output);
+        bool thrown = false;
+        try {
+            decoder.decode(input.data(), input.size());
+        } catch(binary_decode_error const& e) {
+            thrown = true;
+            TEST(e.offset() == header.size());
+        }
+        TEST(thrown);
+    }
+
+    // Garbage followed by a new stream: the decoder finds its way back.
+    unsigned errors;
+    TEST(decode_skipping_errors(binary + "\x7f\x7f\x7f" + binary, errors)
+            == whole + whole);
+    TEST(errors == 1);
+}
+
+// Throws away the second call, i.e. the first one after the stream header
+// that binary_log::open() writes itself.
+class drop_second_writer : public unit_test::string_writer {
+public:
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        if(++calls_ == 2)
+            return ERROR_GIVE_UP;
+        return unit_test::string_writer::write(pbuffer, count);
+    }
+
+private:
+    unsigned calls_ = 0;
+};
+
+// When the spill thread loses output, the log must still notice and start a
+// new stream, or nothing after the loss can be decoded.
+void test_binary_spill_lost_output()
+{
+    drop_second_writer writer;
+    log_options options;
+    options.spill_file = "/tmp/reckless_binary_spill_test_"
+        + std::to_string(getpid());
+    binary_log<'|'> log(&writer, 0, 0, 0, options);
+    log.write("first %d", 1);
+    log.flush();
+    log.write("second %d", 2);
+    log.flush();
+    log.write("third %d", 3);
+    log.close();
+    // Depending on when the output thread notices the loss, the new stream
+    // starts with the second or the third message.
+    unsigned errors;
+    std::string decoded = decode_skipping_errors(writer.str(), errors);
+    TEST((decoded == "second 2\nthird 3\n" and errors == 0)
+            or (decoded == "third 3\n" and errors == 1));
+}
+
+// tsc_timestamp_field is converted to wall-clock time when the message is
+// encoded, and comes out of the decoder as it would from policy_log.
+void test_binary_tsc_timestamp()
+{
+    typedef binary_formatter<'|', tsc_timestamp_field, timestamp_field>
+        formatter_t;
+    char const* pfield_codes =
+        binary_field_codes<tsc_timestamp_field, timestamp_field>::value;
+    TEST(std::string(pfield_codes) == "NT");
+
+    unit_test::string_writer text_writer;
+    output_buffer text(&text_writer, 4096);
+    unit_test::string_writer binary_writer;
+    output_buffer binary(&binary_writer, 4096);
+    binary_encoder encoder;
+    encoder.reset('|', pfield_codes);
+    std::string header = binary_encoder::stream_header('|', pfield_codes);
+    binary_writer.write(header.data(), header.size());
+    tsc_timestamp_field field;
+    timeval tv = test_time(1500000000, 123456);
+    policy_formatter<no_indent, '|', tsc_timestamp_field, timestamp_field>::format(
+        &text, tsc_timestamp_field(field), timestamp_field(tv), no_indent(),
+        "tsc %d", 1);
+    formatter_t::format(&binary, &encoder, tsc_timestamp_field(field),
+            timestamp_field(tv), "tsc %d", 1);
+    text.flush();
+    binary.flush();
+    TEST(decode_all(binary_writer.str(), binary_writer.str().size()) ==
+            text_writer.str());
+    // "YYYY-mm-dd HH:MM:SS.nnnnnnnnn|"
+    TEST(text_writer.str().size() > 30 and text_writer.str()[29] == '|');
+}
+
+unit_test::suite<> binary_log_tests = {
+    TESTCASE(test_binary_round_trip),
+    TESTCASE(test_binary_chunked),
+    TESTCASE(test_binary_varint),
+    TESTCASE(test_binary_corrupt),
+    TESTCASE(test_binary_spill_lost_output),
+    TESTCASE(test_binary_tsc_timestamp)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
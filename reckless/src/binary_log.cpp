@@ -0,0 +1,86 @@
+#include <reckless/detail/binary_encoding.hpp>
+
+#include <cstring>  // strlen
+#include <ciso646>
+
+namespace {
+// Means that we haven't looked at the output buffer's error count yet.
+std::uint64_t const UNKNOWN_WRITE_ERRORS = ~std::uint64_t(0);
+// The text of preformatted messages is built up in a std::string, so the
+// scratch buffer only needs to be large enough for the longest single
+// reserve() call made by a format() function.
+std::size_t const TEXT_BUFFER_SIZE = 4096;
+}
+
+reckless::detail::binary_encoder::binary_encoder() :
+    next_message_id_(BINARY_RECORD_FIRST_MESSAGE_ID),
+    separator_(' '),
+    pfield_codes_(""),
+    write_errors_(UNKNOWN_WRITE_ERRORS),
+    text_buffer_(&text_writer_, TEXT_BUFFER_SIZE)
+{
+}
+
+void reckless::detail::binary_encoder::reset(char separator,
+        char const* pfield_codes)
+{
+    message_ids_.clear();
+    next_message_id_ = BINARY_RECORD_FIRST_MESSAGE_ID;
+    separator_ = separator;
+    pfield_codes_ = pfield_codes;
+    write_errors_ = UNKNOWN_WRITE_ERRORS;
+}
+
+void reckless::detail::binary_encoder::end_text(output_buffer* pbuffer)
+{
+    text_buffer_.flush();
+    write_binary_string(pbuffer, text_writer_.text.data(),
+            text_writer_.text.size());
+    text_writer_.text.clear();
+}
+
+std::string reckless::detail::binary_encoder::stream_header(char separator,
+        char const* pfield_codes)
+{
+    std::string header;
+    header += static_cast<char>(BINARY_RECORD_STREAM_HEADER);
+    header.append(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+    header += static_cast<char>(BINARY_FORMAT_VERSION);
+    header += separator;
+    // There are never enough fields for the count to need a second byte.
+    std::size_t field_count = std::strlen(pfield_codes);
+    header += static_cast<char>(field_count);
+    header.append(pfield_codes, field_count);
+    return header;
+}
+
+void reckless::detail::binary_encoder::define_message_id(
+        output_buffer* pbuffer, char const* pformat, char const* psignature)
+{
+    std::uint64_t id = next_message_id_++;
+    message_ids_.emplace(call_site{pformat, psignature}, id);
+    write_varint(pbuffer, BINARY_RECORD_DEFINITION);
+    write_varint(pbuffer, id);
+    write_binary_string(pbuffer, pformat, std::strlen(pformat));
+    write_binary_string(pbuffer, psignature, std::strlen(psignature));
+    write_varint(pbuffer, id);
+}
+
+void reckless::detail::binary_encoder::restart_stream(output_buffer* pbuffer)
+{
+    bool lost_output = write_errors_ != UNKNOWN_WRITE_ERRORS;
+    write_errors_ = pbuffer->write_errors();
+    if(not lost_output)
+        return;
+    message_ids_.clear();
+    next_message_id_ = BINARY_RECORD_FIRST_MESSAGE_ID;
+    std::string header = stream_header(separator_, pfield_codes_);
+    pbuffer->write(header.data(), header.size());
+}
+
+auto reckless::detail::binary_encoder::string_writer::write(
+        void const* pbuffer, std::size_t count) -> Result
+{
+    text.append(static_cast<char const*>(pbuffer), count);
+    return SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include <reckless/detail/buffer_memory.hpp>
+#include <reckless/detail/utility.hpp>    // get_page_size
+
+#include <new>          // bad_alloc
+#include <cstdio>       // fopen, fgets, sscanf
+#include <cstdlib>      // malloc, free
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+
+std::size_t read_huge_page_size()
+{
+    // Use the common x86 size unless the kernel tells us otherwise.
+    std::size_t size = 2*1024*1024;
+    std::FILE* f = std::fopen("/proc/meminfo", "r");
+    if(not f)
+        return size;
+    char line[128];
+    while(std::fgets(line, sizeof(line), f)) {
+        unsigned long kib;
+        if(1 == std::sscanf(line, "Hugepagesize: %lu kB", &kib)) {
+            size = kib*1024;
+            break;
+        }
+    }
+    std::fclose(f);
+    return size;
+}
+
+std::size_t get_huge_page_size()
+{
+    static std::size_t const size = read_huge_page_size();
+    return size;
+}
+
+std::size_t round_up(std::size_t size, std::size_t granularity)
+{
+    return (size + granularity - 1)/granularity*granularity;
+}
+
+void* map_anonymous(std::size_t size, int extra_flags)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return p == MAP_FAILED? nullptr : p;
+}
+
+}   // anonymous namespace
+
+namespace reckless {
+namespace detail {
+
+buffer_memory allocate_buffer_memory(std::size_t size,
+        buffer_memory_options const& options)
+{
+    buffer_memory memory;
+    if(options.numa_local)
+        memory.numa_node = current_numa_node();
+
+    if(not options.use_mmap()) {
+        memory.p = std::malloc(size);
+        if(not memory.p)
+            throw std::bad_alloc();
+        memory.size = size;
+        return memory;
+    }
+
+#ifdef MAP_HUGETLB
+    if(options.huge_pages == huge_page_policy::hugetlb) {
+        memory.size = round_up(size, get_huge_page_size());
+        memory.p = map_anonymous(memory.size, MAP_HUGETLB);
+    }
+#endif
+    if(not memory.p) {
+        // Fresh pages from mmap aren't backed by anything until someone
+        // touches them, which is what gives us first-touch placement.
+        // Memory from malloc might have been touched already by some other
+        // thread, on some other node.
+        memory.size = round_up(size, get_page_size());
+        memory.p = map_anonymous(memory.size, 0);
+        if(not memory.p)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        // Only a hint, and only has an effect for regions that cover at least
+        // one whole (aligned) huge page.
+        if(options.huge_pages != huge_page_policy::none)
+            madvise(memory.p, memory.size, MADV_HUGEPAGE);
+#endif
+    }
+    memory.mapped = true;
+    return memory;
+}
+
+void prepare_buffer_memory(buffer_memory const& memory,
+        buffer_memory_options const& options)
+{
+    // mlock() faults in the pages, so if it succeeds there is no need to
+    // prefault them.
+    if(options.lock and memory.mapped and 0 == mlock(memory.p, memory.size))
+        return;
+    if(options.prefault)
+        prefault_buffer_memory(memory);
+}
+
+void prefault_buffer_memory(buffer_memory const& memory)
+{
+    // A read would just map the shared zero page, so we need to write.
+    std::size_t const page_size = get_page_size();
+    char volatile* p = static_cast<char volatile*>(memory.p);
+    for(std::size_t offset=0; offset < memory.size; offset += page_size)
+        p[offset] = 0;
+}
+
+void free_buffer_memory(buffer_memory const& memory)
+{
+    // munmap() also takes care of unlocking.
+    if(memory.mapped)
+        munmap(memory.p, memory.size);
+    else
+        std::free(memory.p);
+}
+
+int current_numa_node()
+{
+#ifdef SYS_getcpu
+    unsigned cpu, node;
+    if(0 == syscall(SYS_getcpu, &cpu, &node, nullptr))
+        return static_cast<int>(node);
+#endif
+    return -1;
+}
+
+}   // namespace detail
+}   // namespace reckless
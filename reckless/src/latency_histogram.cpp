@@ -0,0 +1,113 @@
+#include <reckless/latency_histogram.hpp>
+
+#include <algorithm>    // fill
+#include <cmath>        // ceil
+
+reckless::latency_histogram::latency_histogram() :
+    count_(0),
+    sum_(0)
+{
+    std::fill(counts_, counts_ + BUCKET_COUNT, 0);
+}
+
+std::uint64_t reckless::latency_histogram::min() const
+{
+    for(std::size_t i=0; i!=BUCKET_COUNT; ++i) {
+        if(counts_[i] != 0)
+            return bucket_lower_bound(i);
+    }
+    return 0;
+}
+
+std::uint64_t reckless::latency_histogram::max() const
+{
+    for(std::size_t i=BUCKET_COUNT; i!=0; --i) {
+        if(counts_[i-1] != 0)
+            return bucket_upper_bound(i-1);
+    }
+    return 0;
+}
+
+std::uint64_t reckless::latency_histogram::percentile(double percent) const
+{
+    if(count_ == 0)
+        return 0;
+    percent = std::min(std::max(percent, 0.0), 100.0);
+    std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(percent/100.0*count_));
+    rank = std::max(rank, std::uint64_t(1));
+    std::uint64_t seen = 0;
+    for(std::size_t i=0; i!=BUCKET_COUNT; ++i) {
+        seen += counts_[i];
+        if(seen >= rank)
+            return bucket_upper_bound(i);
+    }
+    return max();
+}
+
+reckless::latency_histogram& reckless::latency_histogram::operator-=(
+        latency_histogram const& earlier)
+{
+    for(std::size_t i=0; i!=BUCKET_COUNT; ++i)
+        counts_[i] -= earlier.counts_[i];
+    count_ -= earlier.count_;
+    sum_ -= earlier.sum_;
+    return *this;
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+namespace reckless {
+namespace detail {
+
+void test_latency_histogram_buckets()
+{
+    // Small values are exact, and every value falls within the bounds of its
+    // own bucket.
+    for(std::uint64_t v=0; v!=16; ++v)
+        TEST(latency_histogram::bucket_index(v) == v);
+    std::uint64_t const values[] = {16, 17, 31, 32, 33, 1000, 123456789,
+        (std::uint64_t(1) << 40) + 12345, ~std::uint64_t(0)};
+    for(std::uint64_t v : values) {
+        std::size_t i = latency_histogram::bucket_index(v);
+        TEST(i < latency_histogram::BUCKET_COUNT);
+        TEST(latency_histogram::bucket_lower_bound(i) <= v);
+        TEST(v <= latency_histogram::bucket_upper_bound(i));
+    }
+    // Buckets are contiguous.
+    for(std::size_t i=1; i!=latency_histogram::BUCKET_COUNT; ++i) {
+        TEST(latency_histogram::bucket_lower_bound(i) ==
+                latency_histogram::bucket_upper_bound(i-1) + 1);
+    }
+}
+
+void test_latency_histogram_percentiles()
+{
+    latency_histogram h;
+    TEST(h.percentile(50) == 0);
+    for(std::uint64_t v=1; v<=100; ++v)
+        h.record(v*1000);
+    TEST(h.count() == 100);
+    TEST(h.mean() == 50500.0);
+    // Within the 1/16 resolution of the buckets.
+    std::uint64_t p50 = h.percentile(50);
+    TEST(p50 >= 50000 and p50 <= 50000 + 50000/16);
+    std::uint64_t p100 = h.percentile(100);
+    TEST(p100 >= 100000 and p100 <= 100000 + 100000/16);
+    TEST(h.min() <= 1000 and h.min() >= 1000 - 1000/16);
+
+    latency_histogram earlier = h;
+    h.record(5);
+    h -= earlier;
+    TEST(h.count() == 1);
+    TEST(h.percentile(99) == 5);
+}
+
+unit_test::suite<> latency_histogram_tests = {
+    TESTCASE(test_latency_histogram_buckets),
+    TESTCASE(test_latency_histogram_percentiles)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -0,0 +1,461 @@
+#include <reckless/detail/literal_scan.hpp>
+#include <reckless/output_buffer.hpp>
+
+#include <cstdint>  // uintptr_t
+#include <cstdlib>  // abort
+#include <cstring>  // memcpy
+#include <ciso646>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#ifdef __SSE2__
+#define RECKLESS_HAVE_SSE2_SCAN 1
+#endif
+// The AVX2 scanner is compiled with a target attribute, so it is there even
+// if the rest of the library is built for a plain x86-64. Whether we use it
+// is decided at run time.
+#define RECKLESS_HAVE_AVX2_SCAN 1
+#endif
+
+// The SIMD scanners use aligned loads, which never cross into the next page,
+// so they can read a few bytes beyond the end of the string without risk of
+// faulting. The address sanitizer doesn't know that.
+#if defined(__SANITIZE_ADDRESS__)
+#define RECKLESS_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define RECKLESS_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef RECKLESS_NO_SANITIZE_ADDRESS
+#define RECKLESS_NO_SANITIZE_ADDRESS
+#endif
+
+namespace {
+using reckless::output_buffer;
+using namespace reckless::detail;
+
+//http://www.scs.stanford.edu/histar/src/pkg/uclibc/libc/string/generic/strchrnul.c
+/* Find the first occurrence of C in S or the final NUL byte.  */
+char *generic_strchrnul (const char *s, int c_in)
+{
+  const unsigned char *char_ptr;
+  const unsigned long int *longword_ptr;
+  unsigned long int longword, magic_bits, charmask;
+  unsigned char c;
+
+  c = (unsigned char) c_in;
+
+  /* Handle the first few characters by reading one character at a time.
+     Do this until CHAR_PTR is aligned on a longword boundary.  */
+  for (char_ptr = (const unsigned char *) s;
+       ((size_t) char_ptr & (sizeof (longword) - 1)) != 0;
+       ++char_ptr)
+    if (*char_ptr == c || *char_ptr == '\0')
+      return (char *) char_ptr;
+
+  /* All these elucidatory comments refer to 4-byte longwords,
+     but the theory applies equally well to 8-byte longwords.  */
+
+  longword_ptr = (unsigned long int *) char_ptr;
+
+  /* Bits 31, 24, 16, and 8 of this number are zero.  Call these bits
+     the "holes."  Note that there is a hole just to the left of
+     each byte, with an extra at the end:
+
+     bits:  01111110 11111110 11111110 11111111
+     bytes: AAAAAAAA BBBBBBBB CCCCCCCC DDDDDDDD
+
+     The 1-bits make sure that carries propagate to the next 0-bit.
+     The 0-bits provide holes for carries to fall into.  */
+  switch (sizeof (longword))
+    {
+    case 4: magic_bits = 0x7efefeffL; break;
+    case 8: magic_bits = ((0x7efefefeL << 16) << 16) | 0xfefefeffL; break;
+    default:
+      abort ();
+    }
+
+  /* Set up a longword, each of whose bytes is C.  */
+  charmask = c | (c << 8);
+  charmask |= charmask << 16;
+  if (sizeof (longword) > 4)
+    /* Do the shift in two steps to avoid a warning if long has 32 bits.  */
+    charmask |= (charmask << 16) << 16;
+  if (sizeof (longword) > 8)
+    abort ();
+
+  /* Instead of the traditional loop which tests each character,
+     we will test a longword at a time.  The tricky part is testing
+     if *any of the four* bytes in the longword in question are zero.  */
+  for (;;)
+    {
+      /* We tentatively exit the loop if adding MAGIC_BITS to
+	 LONGWORD fails to change any of the hole bits of LONGWORD.
+
+	 1) Is this safe?  Will it catch all the zero bytes?
+	 Suppose there is a byte with all zeros.  Any carry bits
+	 propagating from its left will fall into the hole at its
+	 least significant bit and stop.  Since there will be no
+	 carry from its most significant bit, the LSB of the
+	 byte to the left will be unchanged, and the zero will be
+	 detected.
+
+	 2) Is this worthwhile?  Will it ignore everything except
+	 zero bytes?  Suppose every byte of LONGWORD has a bit set
+	 somewhere.  There will be a carry into bit 8.  If bit 8
+	 is set, this will carry into bit 16.  If bit 8 is clear,
+	 one of bits 9-15 must be set, so there will be a carry
+	 into bit 16.  Similarly, there will be a carry into bit
+	 24.  If one of bits 24-30 is set, there will be a carry
+	 into bit 31, so all of the hole bits will be changed.
+
+	 The one misfire occurs when bits 24-30 are clear and bit
+	 31 is set; in this case, the hole at bit 31 is not
+	 changed.  If we had access to the processor carry flag,
+	 we could close this loophole by putting the fourth hole
+	 at bit 32!
+
+	 So it ignores everything except 128's, when they're aligned
+	 properly.
+
+	 3) But wait!  Aren't we looking for C as well as zero?
+	 Good point.  So what we do is XOR LONGWORD with a longword,
+	 each of whose bytes is C.  This turns each byte that is C
+	 into a zero.  */
+
+      longword = *longword_ptr++;
+
+      /* Add MAGIC_BITS to LONGWORD.  */
+      if ((((longword + magic_bits)
+
+	    /* Set those bits that were unchanged by the addition.  */
+	    ^ ~longword)
+
+	   /* Look at only the hole bits.  If any of the hole bits
+	      are unchanged, most likely one of the bytes was a
+	      zero.  */
+	   & ~magic_bits) != 0 ||
+
+	  /* That caught zeroes.  Now test for C.  */
+	  ((((longword ^ charmask) + magic_bits) ^ ~(longword ^ charmask))
+	   & ~magic_bits) != 0)
+	{
+	  /* Which of the bytes was C or zero?
+	     If none of them were, it was a misfire; continue the search.  */
+
+	  const unsigned char *cp = (const unsigned char *) (longword_ptr - 1);
+
+	  if (*cp == c || *cp == '\0')
+	    return (char *) cp;
+	  if (*++cp == c || *cp == '\0')
+	    return (char *) cp;
+	  if (*++cp == c || *cp == '\0')
+	    return (char *) cp;
+	  if (*++cp == c || *cp == '\0')
+	    return (char *) cp;
+	  if (sizeof (longword) > 4)
+	    {
+	      if (*++cp == c || *cp == '\0')
+		return (char *) cp;
+	      if (*++cp == c || *cp == '\0')
+		return (char *) cp;
+	      if (*++cp == c || *cp == '\0')
+		return (char *) cp;
+	      if (*++cp == c || *cp == '\0')
+		return (char *) cp;
+	    }
+	}
+    }
+
+  /* This should never happen.  */
+  return NULL;
+}
+
+char const* copy_literal_scalar(output_buffer* pbuffer, char const* pformat)
+{
+    char const* pend = generic_strchrnul(pformat, '%');
+    std::size_t len = pend - pformat;
+    char* p = pbuffer->reserve(len);
+    std::memcpy(p, pformat, len);
+    pbuffer->commit(len);
+    return pend;
+}
+
+#if defined(RECKLESS_HAVE_SSE2_SCAN) || defined(RECKLESS_HAVE_AVX2_SCAN)
+// We reserve this much of the output buffer at a time while copying. Each
+// block is stored whole, even when only part of it belongs to the literal, so
+// there must always be room for one more block than we commit.
+std::size_t const LITERAL_CHUNK_SIZE = 128;
+
+void write_short(output_buffer* pbuffer, char const* s, std::size_t len)
+{
+    char* p = pbuffer->reserve(len);
+    std::memcpy(p, s, len);
+    pbuffer->commit(len);
+}
+#endif
+
+#ifdef RECKLESS_HAVE_SSE2_SCAN
+RECKLESS_NO_SANITIZE_ADDRESS
+char const* copy_literal_sse2(output_buffer* pbuffer, char const* pformat)
+{
+    __m128i const percent = _mm_set1_epi8('%');
+    __m128i const zero = _mm_setzero_si128();
+
+    // The first block starts before pformat so that it is aligned. Ignore
+    // whatever is in front of the string.
+    std::size_t offset = reinterpret_cast<std::uintptr_t>(pformat) & 15u;
+    char const* pblock = pformat - offset;
+    __m128i block = _mm_load_si128(reinterpret_cast<__m128i const*>(pblock));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(block, percent), _mm_cmpeq_epi8(block, zero))));
+    mask >>= offset;
+    if(mask != 0) {
+        std::size_t len = __builtin_ctz(mask);
+        write_short(pbuffer, pformat, len);
+        return pformat + len;
+    }
+
+    char* pstart = pbuffer->reserve(LITERAL_CHUNK_SIZE);
+    char* pout = pstart;
+    std::memcpy(pout, pformat, 16 - offset);
+    pout += 16 - offset;
+    pblock += 16;
+    while(true) {
+        if(pout + 16 > pstart + LITERAL_CHUNK_SIZE) {
+            pbuffer->commit(pout - pstart);
+            pstart = pbuffer->reserve(LITERAL_CHUNK_SIZE);
+            pout = pstart;
+        }
+        block = _mm_load_si128(reinterpret_cast<__m128i const*>(pblock));
+        mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, percent), _mm_cmpeq_epi8(block, zero))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pout), block);
+        if(mask != 0) {
+            std::size_t len = __builtin_ctz(mask);
+            pbuffer->commit(pout - pstart + len);
+            return pblock + len;
+        }
+        pout += 16;
+        pblock += 16;
+    }
+}
+#endif
+
+#ifdef RECKLESS_HAVE_AVX2_SCAN
+// Same as copy_literal_sse2, 32 bytes at a time.
+__attribute__((target("avx2"))) RECKLESS_NO_SANITIZE_ADDRESS
+char const* copy_literal_avx2(output_buffer* pbuffer, char const* pformat)
+{
+    __m256i const percent = _mm256_set1_epi8('%');
+    __m256i const zero = _mm256_setzero_si256();
+
+    std::size_t offset = reinterpret_cast<std::uintptr_t>(pformat) & 31u;
+    char const* pblock = pformat - offset;
+    __m256i block = _mm256_load_si256(reinterpret_cast<__m256i const*>(pblock));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(block, percent), _mm256_cmpeq_epi8(block, zero))));
+    mask >>= offset;
+    if(mask != 0) {
+        std::size_t len = __builtin_ctz(mask);
+        write_short(pbuffer, pformat, len);
+        return pformat + len;
+    }
+
+    char* pstart = pbuffer->reserve(LITERAL_CHUNK_SIZE);
+    char* pout = pstart;
+    std::memcpy(pout, pformat, 32 - offset);
+    pout += 32 - offset;
+    pblock += 32;
+    while(true) {
+        if(pout + 32 > pstart + LITERAL_CHUNK_SIZE) {
+            pbuffer->commit(pout - pstart);
+            pstart = pbuffer->reserve(LITERAL_CHUNK_SIZE);
+            pout = pstart;
+        }
+        block = _mm256_load_si256(reinterpret_cast<__m256i const*>(pblock));
+        mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(block, percent), _mm256_cmpeq_epi8(block, zero))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pout), block);
+        if(mask != 0) {
+            std::size_t len = __builtin_ctz(mask);
+            pbuffer->commit(pout - pstart + len);
+            return pblock + len;
+        }
+        pout += 32;
+        pblock += 32;
+    }
+}
+#endif
+
+format_literal_copier copier_for(format_literal_scanner scanner)
+{
+    switch(scanner) {
+    case FORMAT_SCAN_SCALAR:
+        return &copy_literal_scalar;
+    case FORMAT_SCAN_SSE2:
+#ifdef RECKLESS_HAVE_SSE2_SCAN
+        return &copy_literal_sse2;
+#else
+        break;
+#endif
+    case FORMAT_SCAN_AVX2:
+#ifdef RECKLESS_HAVE_AVX2_SCAN
+        return &copy_literal_avx2;
+#else
+        break;
+#endif
+    }
+    return nullptr;
+}
+
+// g_copy_format_literal starts out pointing here, so that the choice is
+// made the first time it is needed rather than during static initialization,
+// which may be too late for a log that is itself a static object.
+char const* select_and_copy_literal(output_buffer* pbuffer,
+        char const* pformat)
+{
+    format_literal_copier copier = copier_for(best_format_literal_scanner());
+    g_copy_format_literal.store(copier, std::memory_order_relaxed);
+    return copier(pbuffer, pformat);
+}
+}   // anonymous namespace
+
+std::atomic<reckless::detail::format_literal_copier>
+    reckless::detail::g_copy_format_literal(&select_and_copy_literal);
+
+bool reckless::detail::format_literal_scanner_supported(
+        format_literal_scanner scanner)
+{
+    switch(scanner) {
+    case FORMAT_SCAN_SCALAR:
+        return true;
+    case FORMAT_SCAN_SSE2:
+#ifdef RECKLESS_HAVE_SSE2_SCAN
+        return true;
+#else
+        return false;
+#endif
+    case FORMAT_SCAN_AVX2:
+#ifdef RECKLESS_HAVE_AVX2_SCAN
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+reckless::detail::format_literal_scanner
+reckless::detail::best_format_literal_scanner()
+{
+    if(format_literal_scanner_supported(FORMAT_SCAN_AVX2))
+        return FORMAT_SCAN_AVX2;
+    if(format_literal_scanner_supported(FORMAT_SCAN_SSE2))
+        return FORMAT_SCAN_SSE2;
+    return FORMAT_SCAN_SCALAR;
+}
+
+bool reckless::detail::use_format_literal_scanner(
+        format_literal_scanner scanner)
+{
+    if(not format_literal_scanner_supported(scanner))
+        return false;
+    g_copy_format_literal.store(copier_for(scanner), std::memory_order_relaxed);
+    return true;
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <string>
+#include <sys/mman.h>   // mmap, mprotect
+#include <unistd.h>     // sysconf
+
+namespace reckless {
+namespace detail {
+
+namespace {
+format_literal_scanner const ALL_SCANNERS[] = {
+    FORMAT_SCAN_SCALAR, FORMAT_SCAN_SSE2, FORMAT_SCAN_AVX2
+};
+
+// Copies the literal at pformat with the current scanner and checks that we
+// get the text up to the first '%' or NUL, and a pointer to it.
+void check_literal(char const* pformat)
+{
+    unit_test::string_writer w;
+    output_buffer buffer(&w, 4096);
+    // Start somewhere other than the beginning of the buffer, so that a
+    // misplaced store would show.
+    buffer.write("<");
+    char const* pend = copy_format_literal(&buffer, pformat);
+    buffer.write(">");
+    buffer.flush();
+    std::size_t len = std::strcspn(pformat, "%");
+    TEST(pend == pformat + len);
+    TEST(w.str() == "<" + std::string(pformat, len) + ">");
+}
+}
+
+void test_literal_scan_lengths()
+{
+    // Every alignment and length up to several blocks, ending with a
+    // specifier and with the end of the string.
+    alignas(64) char text[512];
+    for(format_literal_scanner scanner : ALL_SCANNERS) {
+        if(not use_format_literal_scanner(scanner))
+            continue;
+        for(unsigned offset=0; offset!=64; ++offset) {
+            for(unsigned len=0; len!=300; ++len) {
+                char* p = text + offset;
+                for(unsigned i=0; i!=len; ++i)
+                    p[i] = static_cast<char>('a' + i%26);
+                p[len] = '%';
+                p[len+1] = 'd';
+                p[len+2] = '\0';
+                check_literal(p);
+                p[len] = '\0';
+                check_literal(p);
+            }
+        }
+        // A character with the high bit set must not be taken for '%'.
+        check_literal("\xa5\xe5\x25\x05 abc");
+    }
+    use_format_literal_scanner(best_format_literal_scanner());
+}
+
+void test_literal_scan_page_end()
+{
+    // A string that ends at the end of a page, with nothing mapped after it.
+    // This only works out because the scanners never read across an aligned
+    // block.
+    std::size_t page_size = sysconf(_SC_PAGESIZE);
+    char* pages = static_cast<char*>(mmap(nullptr, 2*page_size,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    TEST(pages != MAP_FAILED);
+    TEST(mprotect(pages + page_size, page_size, PROT_NONE) == 0);
+    for(format_literal_scanner scanner : ALL_SCANNERS) {
+        if(not use_format_literal_scanner(scanner))
+            continue;
+        for(unsigned len=0; len!=200; ++len) {
+            char* p = pages + page_size - len - 1;
+            std::memset(p, 'x', len);
+            p[len] = '\0';
+            check_literal(p);
+        }
+    }
+    use_format_literal_scanner(best_format_literal_scanner());
+    munmap(pages, 2*page_size);
+}
+
+unit_test::suite<> literal_scan_tests = {
+    TESTCASE(test_literal_scan_lengths),
+    TESTCASE(test_literal_scan_page_end)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -2,14 +2,17 @@
 #include <reckless/writer.hpp>
 #include <reckless/detail/utility.hpp>
 
-#include <cstdlib>      // malloc, free
 //#include <sys/mman.h>   // madvise()
 
 reckless::output_buffer::output_buffer() :
     pwriter_(nullptr),
     pbuffer_(nullptr),
     pcommit_end_(nullptr),
-    pbuffer_end_(nullptr)
+    pbuffer_end_(nullptr),
+    bytes_flushed_(0),
+    write_calls_(0),
+    bytes_written_(0),
+    write_errors_(0)
 {
 }
 
@@ -17,19 +20,30 @@ reckless::output_buffer::output_buffer(writer* pwriter, std::size_t max_capacity
     pwriter_(nullptr),
     pbuffer_(nullptr),
     pcommit_end_(nullptr),
-    pbuffer_end_(nullptr)
+    pbuffer_end_(nullptr),
+    bytes_flushed_(0),
+    write_calls_(0),
+    bytes_written_(0),
+    write_errors_(0)
 {
     reset(pwriter, max_capacity);
 }
 
-reckless::output_buffer::output_buffer(output_buffer&& other)
+reckless::output_buffer::output_buffer(output_buffer&& other) :
+    bytes_flushed_(other.bytes_flushed()),
+    write_calls_(other.write_calls()),
+    bytes_written_(other.bytes_written()),
+    write_errors_(other.write_errors())
 {
     pwriter_ = other.pwriter_;
+    memory_options_ = other.memory_options_;
+    memory_ = other.memory_;
     pbuffer_ = other.pbuffer_;
     pcommit_end_ = other.pcommit_end_;
     pbuffer_end_ = other.pbuffer_end_;
 
     other.pwriter_ = nullptr;
+    other.memory_ = detail::buffer_memory();
     other.pbuffer_ = nullptr;
     other.pcommit_end_ = nullptr;
     other.pbuffer_end_ = nullptr;
@@ -37,38 +51,59 @@ reckless::output_buffer::output_buffer(output_buffer&& other)
 
 reckless::output_buffer& reckless::output_buffer::operator=(output_buffer&& other)
 {
-    std::free(pbuffer_);
+    detail::free_buffer_memory(memory_);
 
     pwriter_ = other.pwriter_;
+    memory_options_ = other.memory_options_;
+    memory_ = other.memory_;
     pbuffer_ = other.pbuffer_;
     pcommit_end_ = other.pcommit_end_;
     pbuffer_end_ = other.pbuffer_end_;
 
     other.pwriter_ = nullptr;
+    other.memory_ = detail::buffer_memory();
     other.pbuffer_ = nullptr;
     other.pcommit_end_ = nullptr;
     other.pbuffer_end_ = nullptr;
 
+    bytes_flushed_.store(other.bytes_flushed(), std::memory_order_relaxed);
+    write_calls_.store(other.write_calls(), std::memory_order_relaxed);
+    bytes_written_.store(other.bytes_written(), std::memory_order_relaxed);
+    write_errors_.store(other.write_errors(), std::memory_order_relaxed);
+
     return *this;
 }
 
-void reckless::output_buffer::reset(writer* pwriter, std::size_t max_capacity)
+void reckless::output_buffer::reset(writer* pwriter, std::size_t max_capacity,
+        detail::buffer_memory_options const& memory_options)
 {
     using namespace detail;
-    std::free(pbuffer_);
+    free_buffer_memory(memory_);
+    memory_ = buffer_memory();
+    pbuffer_ = nullptr;
+    pcommit_end_ = nullptr;
+    pbuffer_end_ = nullptr;
 
     pwriter_ = pwriter;
-    pbuffer_ = static_cast<char*>(std::malloc(max_capacity));
-    // FIXME check return value of malloc here 
+    memory_options_ = memory_options;
+    // We leave prefaulting and locking to prepare_memory(), since we're
+    // usually not on the thread that will be using the buffer.
+    memory_ = allocate_buffer_memory(max_capacity, memory_options);
+    pbuffer_ = static_cast<char*>(memory_.p);
     pcommit_end_ = pbuffer_;
     pbuffer_end_ = pbuffer_ + max_capacity;
    // auto page = detail::get_page_size();
    // madvise(pbuffer_ + page, max_capacity - page, MADV_DONTNEED);
 }
 
+void reckless::output_buffer::prepare_memory()
+{
+    detail::prepare_buffer_memory(memory_, memory_options_);
+}
+
 reckless::output_buffer::~output_buffer()
 {
-    std::free(pbuffer_);
+    detail::free_buffer_memory(memory_);
 }
 
 void reckless::output_buffer::write(void const* buf, std::size_t count)
@@ -113,6 +148,14 @@ void reckless::output_buffer::flush()
     // NOTE if you get a crash here, it could be because your log object has a
     // longer lifetime than the writer (i.e. the writer has been destroyed
     // already).
-    pwriter_->write(pbuffer_, pcommit_end_ - pbuffer_);
+    using detail::single_writer_add;
+    std::uint64_t size = static_cast<std::uint64_t>(pcommit_end_ - pbuffer_);
+    writer::Result result = pwriter_->write(pbuffer_, pcommit_end_ - pbuffer_);
+    single_writer_add(bytes_flushed_, size);
+    single_writer_add(write_calls_, std::uint64_t(1));
+    if(result == writer::SUCCESS)
+        single_writer_add(bytes_written_, size);
+    else
+        single_writer_add(write_errors_, std::uint64_t(1));
     pcommit_end_ = pbuffer_;
 }
@@ -1,3 +1,70 @@
 #include <reckless/policy_log.hpp>
 
 __thread unsigned reckless::scoped_indent::level_ = 0;
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+#include <reckless/severity_log.hpp>
+
+#include <string>
+
+namespace reckless {
+namespace {
+
+log_options elastic_options()
+{
+    log_options options;
+    options.max_thread_input_buffer_size = 64*1024;
+    return options;
+}
+
+// A plain write in the middle of a batch that doesn't fit in the input
+// buffer makes the thread switch to a larger one. The batch must carry on in
+// the new buffer, and its lines must stay in the order they were written.
+void test_batch_interleaved_growth()
+{
+    std::string big(2000, 'x');
+    unit_test::string_writer writer;
+    {
+        policy_log<> log(&writer, 0, 0, 256, elastic_options());
+        policy_log<>::batch b(log);
+        b.write("batch %d", 1);
+        log.write("plain %s", big);
+        // Make sure the output thread is done with the old buffer, so that
+        // it would already be freed if the batch was still writing to it.
+        log.flush();
+        b.write("batch %d", 2);
+        log.write("plain %s", big + big);
+        b.write("batch %d", 3);
+        b.commit();
+        b.write("batch %d", 4);
+    }
+    TEST(writer.str() == "batch 1\nplain " + big + "\nbatch 2\nplain "
+            + big + big + "\nbatch 3\nbatch 4\n");
+}
+
+void test_severity_batch_interleaved_growth()
+{
+    typedef severity_log<no_indent, ' ', severity_field> log_t;
+    std::string big(2000, 'x');
+    unit_test::string_writer writer;
+    {
+        log_t log(&writer, 0, 0, 256, elastic_options());
+        log_t::batch b(log);
+        b.info("batch %d", 1);
+        log.warn("plain %s", big);
+        log.flush();
+        b.error("batch %d", 2);
+    }
+    TEST(writer.str() == "I batch 1\nW plain " + big + "\nE batch 2\n");
+}
+
+}   // anonymous namespace
+
+unit_test::suite<> policy_log_tests = {
+    TESTCASE(test_batch_interleaved_growth),
+    TESTCASE(test_severity_batch_interleaved_growth)
+};
+
+}   // namespace reckless
+#endif  // UNIT_TEST
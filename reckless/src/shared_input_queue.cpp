@@ -0,0 +1,237 @@
+#include <reckless/detail/shared_input_queue.hpp>
+
+#include <algorithm>    // find
+
+reckless::detail::shared_input_queue::shared_input_queue() :
+    policy_(shared_input_queue_policy::boost_lockfree),
+    boost_queue_(0),
+    next_registry_index_(0),
+    closing_(false)
+{
+}
+
+void reckless::detail::shared_input_queue::reset(
+        shared_input_queue_policy policy, std::size_t capacity)
+{
+    policy_ = policy;
+    // boost's lockfree queue has no move constructor and provides no reserve()
+    // function when you use fixed_sized policy. So we'll just explicitly
+    // destroy the current queue and create a new one with the desired size. We
+    // are guaranteed that the queue is empty since close() clears it.
+    std::size_t boost_capacity = 0;
+    std::size_t mpsc_capacity = 0;
+    if(policy == shared_input_queue_policy::boost_lockfree)
+        boost_capacity = capacity;
+    else if(policy == shared_input_queue_policy::mpsc_array)
+        mpsc_capacity = capacity;
+    boost_queue_.~boost_queue_t();
+    // TODO how do we handle an exception here?
+    new (&boost_queue_) boost_queue_t(boost_capacity);
+    mpsc_queue_.reset(mpsc_capacity);
+    closing_.store(false, std::memory_order_relaxed);
+}
+
+bool reckless::detail::shared_input_queue::pop(commit_extent& ce)
+{
+    switch(policy_) {
+    case shared_input_queue_policy::boost_lockfree:
+        return boost_queue_.pop(ce);
+    case shared_input_queue_policy::mpsc_array:
+        return mpsc_queue_.pop(ce);
+    case shared_input_queue_policy::none:
+        return poll_registry(ce);
+    }
+    return false;
+}
+
+bool reckless::detail::shared_input_queue::empty()
+{
+    switch(policy_) {
+    case shared_input_queue_policy::boost_lockfree:
+        // boost's push() swings the tail pointer with a sequentially
+        // consistent CAS, and empty() compares head and tail using sequentially
+        // consistent loads.
+        return boost_queue_.empty();
+    case shared_input_queue_policy::mpsc_array:
+        return mpsc_queue_.empty();
+    case shared_input_queue_policy::none:
+        break;
+    }
+    if(closing_.load(std::memory_order_seq_cst))
+        return false;
+    std::lock_guard<std::mutex> lk(registry_mutex_);
+    for(thread_input_buffer* pbuffer : registry_) {
+        if(pbuffer->commit_end() != pbuffer->input_start())
+            return false;
+    }
+    return true;
+}
+
+void reckless::detail::shared_input_queue::register_input_buffer(
+        thread_input_buffer* pbuffer)
+{
+    std::lock_guard<std::mutex> lk(registry_mutex_);
+    registry_.push_back(pbuffer);
+}
+
+void reckless::detail::shared_input_queue::unregister_input_buffer(
+        thread_input_buffer* pbuffer)
+{
+    std::lock_guard<std::mutex> lk(registry_mutex_);
+    auto it = std::find(registry_.begin(), registry_.end(), pbuffer);
+    if(it != registry_.end())
+        registry_.erase(it);
+}
+
+bool reckless::detail::shared_input_queue::poll_registry(commit_extent& ce)
+{
+    // We need to read the closing flag *before* we look at the buffers. If we
+    // read it afterwards, a thread could commit data and then call close()
+    // right after we passed its buffer, and we'd shut down without writing
+    // that data.
+    bool closing = closing_.load(std::memory_order_acquire);
+
+    // Round-robin over the buffers so that one busy thread can't starve the
+    // others. The lock is only contended when threads are being created or
+    // destroyed.
+    std::lock_guard<std::mutex> lk(registry_mutex_);
+    std::size_t count = registry_.size();
+    for(std::size_t i=0; i!=count; ++i) {
+        std::size_t index = (next_registry_index_ + i) % count;
+        thread_input_buffer* pbuffer = registry_[index];
+        // If the thread has switched to this buffer from an older one, then
+        // the older one has to be emptied first to keep the thread's lines in
+        // order.
+        thread_input_buffer* ppredecessor = pbuffer->predecessor();
+        if(ppredecessor and ppredecessor->input_start() != ppredecessor->input_end())
+            continue;
+        char* pcommit_end = pbuffer->commit_end();
+        if(pcommit_end != pbuffer->input_start()) {
+            ce.pinput_buffer = pbuffer;
+            ce.pcommit_end = pcommit_end;
+            next_registry_index_ = index + 1;
+            return true;
+        }
+    }
+
+    if(closing) {
+        closing_.store(false, std::memory_order_relaxed);
+        ce.pinput_buffer = nullptr;
+        ce.pcommit_end = nullptr;
+        return true;
+    }
+    return false;
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <cstdint>  // uintptr_t
+#include <thread>
+#include <vector>
+
+namespace reckless {
+namespace detail {
+
+void test_mpsc_queue_full()
+{
+    mpsc_queue<int> queue;
+    // The capacity is rounded up to a power of two.
+    queue.reset(3);
+    TEST(queue.empty());
+    for(int i=0; i!=4; ++i)
+        TEST(queue.push(i));
+    TEST(not queue.push(4));
+    int value;
+    TEST(queue.pop(value) and value == 0);
+    TEST(queue.push(4));
+    // Go around the ring a few times to make sure the sequence numbers work
+    // out on later laps.
+    for(int i=1; i!=100; ++i) {
+        TEST(queue.pop(value) and value == i);
+        TEST(queue.push(i+4));
+    }
+    for(int i=100; i!=104; ++i)
+        TEST(queue.pop(value) and value == i);
+    TEST(not queue.pop(value));
+    TEST(queue.empty());
+}
+
+// Several producers push (producer, sequence number) pairs while a single
+// consumer pops them. Nothing may be lost or duplicated, and each producer's
+// values must come out in the order they went in. The queue is small so that
+// producers run into a full queue all the time.
+template <class Queue>
+void push_pop_across_threads(Queue& queue)
+{
+    unsigned const PRODUCERS = 4;
+    std::uintptr_t const COUNT = 100000;
+    std::vector<std::thread> producers;
+    for(unsigned producer=0; producer!=PRODUCERS; ++producer) {
+        producers.emplace_back([&queue, producer, COUNT]()
+        {
+            for(std::uintptr_t i=1; i<=COUNT; ++i) {
+                commit_extent ce;
+                ce.pinput_buffer = reinterpret_cast<thread_input_buffer*>(
+                        std::uintptr_t(producer + 1));
+                ce.pcommit_end = reinterpret_cast<char*>(i);
+                while(not queue.push(ce))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<std::uintptr_t> last(PRODUCERS, 0);
+    bool in_order = true;
+    for(std::uintptr_t received=0; received != PRODUCERS*COUNT;) {
+        commit_extent ce;
+        if(not queue.pop(ce)) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::uintptr_t producer = reinterpret_cast<std::uintptr_t>(
+                ce.pinput_buffer) - 1;
+        std::uintptr_t i = reinterpret_cast<std::uintptr_t>(ce.pcommit_end);
+        if(producer >= PRODUCERS or i != last[producer] + 1)
+            in_order = false;
+        else
+            last[producer] = i;
+        ++received;
+    }
+    for(std::thread& t : producers)
+        t.join();
+    TEST(in_order);
+    for(std::uintptr_t n : last)
+        TEST(n == COUNT);
+    commit_extent ce;
+    TEST(not queue.pop(ce));
+    TEST(queue.empty());
+}
+
+void test_mpsc_queue_threads()
+{
+    mpsc_queue<commit_extent> queue;
+    queue.reset(16);
+    push_pop_across_threads(queue);
+}
+
+void test_shared_input_queue_threads()
+{
+    // With a shared queue, push() only looks at the commit extent itself, so
+    // the buffer pointers don't have to be real.
+    shared_input_queue queue;
+    queue.reset(shared_input_queue_policy::boost_lockfree, 16);
+    push_pop_across_threads(queue);
+    queue.reset(shared_input_queue_policy::mpsc_array, 16);
+    push_pop_across_threads(queue);
+}
+
+unit_test::suite<> shared_input_queue_tests = {
+    TESTCASE(test_mpsc_queue_full),
+    TESTCASE(test_mpsc_queue_threads),
+    TESTCASE(test_shared_input_queue_threads)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
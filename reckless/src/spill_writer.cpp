@@ -0,0 +1,409 @@
+#include <reckless/detail/spill_writer.hpp>
+#include <reckless/detail/utility.hpp>    // get_page_size, signal_eventfd
+
+#include <algorithm>    // min, max
+#include <chrono>
+#include <cstring>      // memcpy
+#include <ciso646>
+#include <system_error>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+// How long to wait before retrying a write that failed with ERROR_TRY_LATER.
+// The wait doubles for each failure in a row.
+unsigned const MIN_RETRY_DELAY_MS = 1;
+unsigned const MAX_RETRY_DELAY_MS = 1000;
+
+std::int64_t steady_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+reckless::detail::spill_writer::spill_writer() :
+    ptarget_(nullptr),
+    fd_(-1),
+    pbuffer_(nullptr),
+    capacity_(0),
+    pflush_notification_fd_(nullptr),
+    write_pos_(0),
+    read_pos_(0),
+    closing_(false),
+    retry_timeout_ms_(0),
+    retry_deadline_ns_(0),
+    has_flush_requests_(false),
+    write_calls_(0),
+    bytes_written_(0),
+    write_errors_(0),
+    lost_writes_(0),
+    lost_writes_reported_(0),
+    peak_backlog_(0),
+    full_stalls_(0)
+{
+}
+
+reckless::detail::spill_writer::~spill_writer()
+{
+    if(is_open())
+        close();
+}
+
+void reckless::detail::spill_writer::open(writer* ptarget,
+        std::string const& path, std::size_t capacity,
+        unsigned retry_timeout_ms,
+        std::atomic<int> const* pflush_notification_fd)
+{
+    std::size_t page_size = get_page_size();
+    capacity = std::max(page_size, (capacity + page_size - 1)/page_size*page_size);
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd_ == -1)
+        throw std::system_error(errno, std::system_category());
+    // The file stays sparse until we actually spill something into it.
+    void* p = MAP_FAILED;
+    if(0 == ftruncate(fd_, static_cast<off_t>(capacity)))
+        p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(p == MAP_FAILED) {
+        int error = errno;
+        ::close(fd_);
+        fd_ = -1;
+        ::unlink(path.c_str());
+        throw std::system_error(error, std::system_category());
+    }
+
+    ptarget_ = ptarget;
+    path_ = path;
+    pbuffer_ = static_cast<char*>(p);
+    capacity_ = capacity;
+    pflush_notification_fd_ = pflush_notification_fd;
+    write_pos_.store(0, std::memory_order_relaxed);
+    read_pos_.store(0, std::memory_order_relaxed);
+    closing_.store(false, std::memory_order_relaxed);
+    retry_timeout_ms_ = retry_timeout_ms;
+    retry_deadline_ns_.store(0, std::memory_order_relaxed);
+    lost_writes_.store(0, std::memory_order_relaxed);
+    lost_writes_reported_ = 0;
+    try {
+        thread_ = std::thread(&spill_writer::run, this);
+    } catch(...) {
+        unmap();
+        throw;
+    }
+}
+
+void reckless::detail::spill_writer::close()
+{
+    limit_retries();
+    closing_.store(true, std::memory_order_release);
+    data_available_event_.signal();
+    thread_.join();
+    unmap();
+}
+
+void reckless::detail::spill_writer::limit_retries()
+{
+    // Only the first call sets the deadline. 0 is reserved for "no deadline",
+    // which steady_clock won't give us in practice.
+    std::int64_t deadline = steady_clock_ns()
+        + static_cast<std::int64_t>(retry_timeout_ms_)*1000000;
+    std::int64_t expected = 0;
+    retry_deadline_ns_.compare_exchange_strong(expected, deadline,
+            std::memory_order_relaxed);
+}
+
+void reckless::detail::spill_writer::unmap()
+{
+    munmap(pbuffer_, capacity_);
+    ::close(fd_);
+    ::unlink(path_.c_str());
+    pbuffer_ = nullptr;
+    capacity_ = 0;
+    fd_ = -1;
+}
+
+auto reckless::detail::spill_writer::write(void const* pbuffer,
+        std::size_t count) -> Result
+{
+    char const* pinput = static_cast<char const*>(pbuffer);
+    std::uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    while(count != 0) {
+        std::uint64_t used = write_pos - read_pos_.load(std::memory_order_acquire);
+        if(used == capacity_) {
+            single_writer_add(full_stalls_, std::uint64_t(1));
+            do {
+                space_available_event_.wait();
+                used = write_pos - read_pos_.load(std::memory_order_acquire);
+            } while(used == capacity_);
+        }
+        std::size_t offset = static_cast<std::size_t>(write_pos % capacity_);
+        std::size_t chunk = std::min(count, static_cast<std::size_t>(capacity_ - used));
+        chunk = std::min(chunk, capacity_ - offset);
+        std::memcpy(pbuffer_ + offset, pinput, chunk);
+        pinput += chunk;
+        count -= chunk;
+        write_pos += chunk;
+        write_pos_.store(write_pos, std::memory_order_release);
+        data_available_event_.signal();
+        if(used + chunk > peak_backlog_.load(std::memory_order_relaxed))
+            peak_backlog_.store(used + chunk, std::memory_order_relaxed);
+    }
+    std::uint64_t lost_writes = lost_writes_.load(std::memory_order_relaxed);
+    if(lost_writes != lost_writes_reported_) {
+        lost_writes_reported_ = lost_writes;
+        return ERROR_GIVE_UP;
+    }
+    return SUCCESS;
+}
+
+void reckless::detail::spill_writer::complete_after_write(
+        std::vector<std::shared_ptr<flush_request>>& requests)
+{
+    std::uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lk(flush_requests_mutex_);
+        for(auto& prequest : requests)
+            flush_requests_.emplace_back(write_pos, std::move(prequest));
+        has_flush_requests_.store(true, std::memory_order_relaxed);
+    }
+    requests.clear();
+    // The thread may be idle if everything has been written already.
+    data_available_event_.signal();
+}
+
+void reckless::detail::spill_writer::wait_until_written()
+{
+    std::uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    while(read_pos_.load(std::memory_order_acquire) != write_pos)
+        written_event_.wait();
+}
+
+void reckless::detail::spill_writer::run()
+{
+    unsigned retry_delay_ms = 0;
+    std::uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+    while(true) {
+        std::uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+        if(read_pos == write_pos) {
+            if(has_flush_requests_.load(std::memory_order_relaxed))
+                complete_flush_requests(read_pos);
+            if(closing_.load(std::memory_order_acquire)) {
+                // close() is called after the last write(), so if there's
+                // nothing new now then there never will be.
+                if(write_pos_.load(std::memory_order_acquire) == read_pos)
+                    return;
+            } else {
+                data_available_event_.wait();
+            }
+            continue;
+        }
+
+        std::size_t offset = static_cast<std::size_t>(read_pos % capacity_);
+        std::size_t count = static_cast<std::size_t>(std::min(write_pos - read_pos,
+                    static_cast<std::uint64_t>(capacity_ - offset)));
+        Result result = ptarget_->write(pbuffer_ + offset, count);
+        single_writer_add(write_calls_, std::uint64_t(1));
+        if(result == SUCCESS) {
+            single_writer_add(bytes_written_, static_cast<std::uint64_t>(count));
+        } else {
+            single_writer_add(write_errors_, std::uint64_t(1));
+            if(result == ERROR_TRY_LATER) {
+                // Keep the data and try again later. Meanwhile the output
+                // thread goes on filling up the file. If the log is shutting
+                // down we only wait until the deadline, e.g. so that a full
+                // disk doesn't keep close() from ever returning.
+                retry_delay_ms = std::min(MAX_RETRY_DELAY_MS,
+                        std::max(MIN_RETRY_DELAY_MS, 2*retry_delay_ms));
+                std::int64_t delay_ns = static_cast<std::int64_t>(retry_delay_ms)*1000000;
+                std::int64_t deadline = retry_deadline_ns_.load(std::memory_order_relaxed);
+                std::int64_t now = 0;
+                if(deadline != 0) {
+                    now = steady_clock_ns();
+                    delay_ns = std::min(delay_ns, deadline - now);
+                }
+                if(deadline == 0 or now < deadline) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(delay_ns));
+                    continue;
+                }
+            }
+            // ERROR_GIVE_UP, or we're past the deadline. Like the output
+            // buffer does without a spill file, we throw the data away, and
+            // the next call to write() reports it.
+            single_writer_add(lost_writes_, std::uint64_t(1));
+        }
+        retry_delay_ms = 0;
+        read_pos += count;
+        read_pos_.store(read_pos, std::memory_order_release);
+        space_available_event_.signal();
+        written_event_.signal();
+        if(has_flush_requests_.load(std::memory_order_relaxed))
+            complete_flush_requests(read_pos);
+    }
+}
+
+void reckless::detail::spill_writer::complete_flush_requests(std::uint64_t read_pos)
+{
+    bool completed = false;
+    {
+        std::lock_guard<std::mutex> lk(flush_requests_mutex_);
+        auto it = flush_requests_.begin();
+        while(it != flush_requests_.end() and it->first <= read_pos) {
+            it->second->complete();
+            ++it;
+        }
+        completed = it != flush_requests_.begin();
+        flush_requests_.erase(flush_requests_.begin(), it);
+        has_flush_requests_.store(not flush_requests_.empty(),
+                std::memory_order_relaxed);
+    }
+    if(completed)
+        signal_eventfd(pflush_notification_fd_->load(std::memory_order_acquire));
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+namespace reckless {
+namespace detail {
+namespace {
+
+// Fails the first `failures` calls with the given error, then succeeds.
+class flaky_writer : public writer {
+public:
+    flaky_writer(Result error, unsigned failures) :
+        error_(error),
+        failures_(failures)
+    {
+    }
+
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if(failures_ != 0) {
+            --failures_;
+            return error_;
+        }
+        text_.append(static_cast<char const*>(pbuffer), count);
+        return SUCCESS;
+    }
+
+    std::string text()
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return text_;
+    }
+
+private:
+    std::mutex mutex_;
+    Result error_;
+    unsigned failures_;
+    std::string text_;
+};
+
+std::string spill_path()
+{
+    return "/tmp/reckless_spill_test_" + std::to_string(getpid());
+}
+
+std::atomic<int> no_flush_notification_fd(-1);
+
+}   // anonymous namespace
+
+void test_spill_try_later_retried()
+{
+    flaky_writer target(writer::ERROR_TRY_LATER, 3);
+    spill_writer spill;
+    spill.open(&target, spill_path(), 4096, 100, &no_flush_notification_fd);
+    TEST(spill.write("hello ", 6) == writer::SUCCESS);
+    TEST(spill.write("world", 5) == writer::SUCCESS);
+    spill.wait_until_written();
+    TEST(target.text() == "hello world");
+    TEST(spill.write_errors() == 3);
+    TEST(spill.bytes_written() == 11);
+    spill.close();
+    TEST(access(spill_path().c_str(), F_OK) != 0);
+}
+
+void test_spill_try_later_forever()
+{
+    typedef std::chrono::steady_clock clock;
+    flaky_writer target(writer::ERROR_TRY_LATER, ~0u);
+    spill_writer spill;
+    spill.open(&target, spill_path(), 4096, 200, &no_flush_notification_fd);
+    TEST(spill.write("lost", 4) == writer::SUCCESS);
+    // Without a deadline we keep retrying.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST(spill.backlog() == 4);
+    auto start = clock::now();
+    spill.close();
+    auto elapsed = clock::now() - start;
+    TEST(elapsed >= std::chrono::milliseconds(150));
+    TEST(elapsed < std::chrono::seconds(3));
+    TEST(target.text().empty());
+    TEST(spill.bytes_written() == 0);
+    TEST(spill.write_errors() != 0);
+}
+
+void test_spill_full_try_later_forever()
+{
+    // Like basic_log::close() with a writer that never recovers: the output
+    // thread is stuck waiting for room in the file until limit_retries() is
+    // called.
+    flaky_writer target(writer::ERROR_TRY_LATER, ~0u);
+    spill_writer spill;
+    spill.open(&target, spill_path(), 4096, 100, &no_flush_notification_fd);
+    std::string data(3*4096, 'x');
+    std::atomic<bool> done(false);
+    std::thread output_thread([&]()
+        {
+            spill.write(data.data(), data.size());
+            done = true;
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST(not done);
+    TEST(spill.full_stalls() != 0);
+    spill.limit_retries();
+    output_thread.join();
+    spill.wait_until_written();
+    TEST(spill.backlog() == 0);
+    spill.close();
+    TEST(target.text().empty());
+}
+
+void test_spill_give_up_reported()
+{
+    // The first write is lost in our thread. The output buffer only finds out
+    // on the next call, whose data is kept nonetheless.
+    flaky_writer target(writer::ERROR_GIVE_UP, 1);
+    spill_writer spill;
+    spill.open(&target, spill_path(), 4096, 100, &no_flush_notification_fd);
+    TEST(spill.write("lost ", 5) == writer::SUCCESS);
+    spill.wait_until_written();
+    TEST(spill.write("kept ", 5) == writer::ERROR_GIVE_UP);
+    TEST(spill.write("too", 3) == writer::SUCCESS);
+    spill.close();
+    TEST(target.text() == "kept too");
+    TEST(spill.write_errors() == 1);
+}
+
+}   // namespace detail
+
+unit_test::suite<> spill_writer_tests = {
+    TESTCASE(detail::test_spill_try_later_retried),
+    TESTCASE(detail::test_spill_try_later_forever),
+    TESTCASE(detail::test_spill_full_try_later_forever),
+    TESTCASE(detail::test_spill_give_up_reported)
+};
+
+}   // namespace reckless
+#endif  // UNIT_TEST
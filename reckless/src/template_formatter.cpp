@@ -1,9 +1,11 @@
 #include <reckless/template_formatter.hpp>
 #include <reckless/ntoa.hpp>
+#include <reckless/detail/literal_scan.hpp>
 
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
+#include <ciso646>
 
 namespace reckless {
 namespace {
@@ -78,41 +80,93 @@ namespace {
     }
         
     template <typename T>
-    char const* generic_format_int(output_buffer* pbuffer, char const* pformat, T v)
+    bool generic_format_int(output_buffer* pbuffer,
+            conversion_specification spec, char f, T v)
     {
-        conversion_specification spec;
-        pformat = parse_conversion_specification(&spec, pformat);
-        char f = *pformat;
         if(f == 'd') {
             itoa_base10(pbuffer, v, spec);
-            return pformat + 1;
+            return true;
         } else if(f == 'x') {
             spec.uppercase = false;
             itoa_base16(pbuffer, v, spec);
-            return pformat + 1;
+            return true;
         } else if(f == 'X') {
             spec.uppercase = true;
             itoa_base16(pbuffer, v, spec);
-            return pformat + 1;
+            return true;
         } else if(f == 'b') {
             // FIXME
-            return nullptr;
+            return false;
         } else {
-            return nullptr;
+            return false;
         }
     }
 
+    template <typename T>
+    char const* generic_format_int(output_buffer* pbuffer, char const* pformat, T v)
+    {
+        conversion_specification spec;
+        pformat = parse_conversion_specification(&spec, pformat);
+        if(generic_format_int(pbuffer, spec, *pformat, v))
+            return pformat + 1;
+        else
+            return nullptr;
+    }
+
+    template <typename T>
+    bool generic_format_float(output_buffer* pbuffer,
+            conversion_specification cs, char f, T v)
+    {
+        cs.uppercase = f == 'F' or f == 'E' or f == 'G';
+        if(f == 'f' or f == 'F')
+            ftoa_base10_f(pbuffer, v, cs);
+        else if(f == 'e' or f == 'E')
+            ftoa_base10_e(pbuffer, v, cs);
+        else if(f == 'g' or f == 'G')
+            ftoa_base10_g(pbuffer, v, cs);
+        else
+            return false;
+        return true;
+    }
+
     template <typename T>
     char const* generic_format_float(output_buffer* pbuffer, char const* pformat, T v)
     {
+        // A bare %s gives the shortest digits that read back as the same
+        // number.
+        if(*pformat == 's') {
+            ftoa_base10_shortest(pbuffer, v, conversion_specification());
+            return pformat + 1;
+        }
         conversion_specification cs;
         pformat = parse_conversion_specification(&cs, pformat);
-        char f = *pformat;
-        if(f != 'f')
+        if(generic_format_float(pbuffer, cs, *pformat, v))
+            return pformat + 1;
+        else
             return nullptr;
-        
-        ftoa_base10_f(pbuffer, v, cs);
-        return pformat + 1;
+    }
+
+    template <typename T>
+    bool generic_format_float(output_buffer* pbuffer,
+            detail::format_specifier const& s, T v)
+    {
+        if(s.conversion == 's' and s.bare()) {
+            ftoa_base10_shortest(pbuffer, v, s.spec);
+            return true;
+        } else {
+            return generic_format_float(pbuffer, s.spec, s.conversion, v);
+        }
+    }
+
+    // A bare %s prints a decimal with all of its decimals, and so does %f
+    // unless it has a precision.
+    bool format_decimal(output_buffer* pbuffer,
+            conversion_specification const& cs, char f, decimal v)
+    {
+        if(f != 'f' and f != 'F')
+            return false;
+        itoa_base10_scaled(pbuffer, v.mantissa(), v.scale(), cs);
+        return true;
     }
 
     template <typename T>
@@ -129,6 +183,109 @@ namespace {
         }
     }
 
+    template <typename T>
+    bool generic_format_char(output_buffer* pbuffer,
+            detail::format_specifier const& s, T v)
+    {
+        if(s.conversion == 's' and s.bare()) {
+            char* p = pbuffer->reserve(1);
+            *p = static_cast<char>(v);
+            pbuffer->commit(1);
+            return true;
+        } else {
+            return generic_format_int(pbuffer, s.spec, s.conversion,
+                    static_cast<int>(v));
+        }
+    }
+
+    void format_string_argument(output_buffer* pbuffer, char const* s,
+            std::size_t len)
+    {
+        char* p = pbuffer->reserve(len);
+        std::memcpy(p, s, len);
+        pbuffer->commit(len);
+    }
+
+    void format_pointer(output_buffer* pbuffer, void const* p)
+    {
+        conversion_specification cs;
+        cs.minimum_field_width = 0;
+        cs.precision = 1;
+        cs.plus_sign = 0;
+        cs.left_justify = false;
+        cs.alternative_form = true;
+        cs.pad_with_zeroes = false;
+        cs.uppercase = false;
+        itoa_base16(pbuffer, reinterpret_cast<std::uintptr_t>(p), cs);
+    }
+
+    // Arrays of integers take the same specifiers as a single integer, and
+    // %d goes through the batch kernel. We look at the specifier before we
+    // write anything, so that a mismatch leaves the output as it was.
+    template <typename T>
+    bool format_elements(output_buffer* pbuffer, conversion_specification cs,
+            char f, bool, frame_elements<T> v, std::true_type)
+    {
+        if(f == 'd') {
+            itoa_base10_array(pbuffer, v.data(), v.size(), v.separator(), cs);
+            return true;
+        } else if(f != 'x' and f != 'X') {
+            return false;
+        }
+        cs.uppercase = f == 'X';
+        std::size_t separator_size = std::strlen(v.separator());
+        for(std::size_t i=0; i!=v.size(); ++i) {
+            if(i != 0)
+                format_string_argument(pbuffer, v.separator(), separator_size);
+            itoa_base16(pbuffer, v[i], cs);
+        }
+        return true;
+    }
+
+    // Floating-point arrays, likewise, including the shortest form for a
+    // bare %s.
+    template <typename T>
+    bool format_elements(output_buffer* pbuffer, conversion_specification cs,
+            char f, bool bare, frame_elements<T> v, std::false_type)
+    {
+        bool shortest = bare and f == 's';
+        if(not shortest and not detail::is_float_conversion(f))
+            return false;
+        std::size_t separator_size = std::strlen(v.separator());
+        for(std::size_t i=0; i!=v.size(); ++i) {
+            if(i != 0)
+                format_string_argument(pbuffer, v.separator(), separator_size);
+            if(shortest)
+                ftoa_base10_shortest(pbuffer, v[i], cs);
+            else
+                generic_format_float(pbuffer, cs, f, v[i]);
+        }
+        return true;
+    }
+
+    template <typename T>
+    char const* format_elements(output_buffer* pbuffer, char const* pformat,
+            frame_elements<T> v)
+    {
+        conversion_specification cs;
+        char const* pconversion = parse_conversion_specification(&cs, pformat);
+        if(format_elements(pbuffer, cs, *pconversion, pconversion == pformat,
+                    v, std::is_integral<T>()))
+        {
+            return pconversion + 1;
+        } else {
+            return nullptr;
+        }
+    }
+
+    template <typename T>
+    bool format_elements(output_buffer* pbuffer,
+            detail::format_specifier const& s, frame_elements<T> v)
+    {
+        return format_elements(pbuffer, s.spec, s.conversion, s.bare(), v,
+                std::is_integral<T>());
+    }
+
 }   // anonymous namespace
 
 char const* format(output_buffer* pbuffer, char const* pformat, char v)
@@ -205,27 +362,29 @@ char const* format(output_buffer* pbuffer, char const* pformat, long double v)
     return generic_format_float(pbuffer, pformat, v);
 }
 
+char const* format(output_buffer* pbuffer, char const* pformat, decimal v)
+{
+    if(*pformat == 's') {
+        format_decimal(pbuffer, conversion_specification(), 'f', v);
+        return pformat + 1;
+    }
+    conversion_specification cs;
+    pformat = parse_conversion_specification(&cs, pformat);
+    if(format_decimal(pbuffer, cs, *pformat, v))
+        return pformat + 1;
+    else
+        return nullptr;
+}
+
 char const* format(output_buffer* pbuffer, char const* pformat, char const* v)
 {
     char c = *pformat;
-    if(c =='s') {
-        auto len = std::strlen(v);
-        char* p = pbuffer->reserve(len);
-        std::memcpy(p, v, len);
-        pbuffer->commit(len);
-    } else if(c == 'p') {
-        conversion_specification cs;
-        cs.minimum_field_width = 0;
-        cs.precision = 1;
-        cs.plus_sign = 0;
-        cs.left_justify = false;
-        cs.alternative_form = true;
-        cs.pad_with_zeroes = false;
-        cs.uppercase = false;
-        itoa_base16(pbuffer, reinterpret_cast<std::uintptr_t>(v), cs);
-    } else {
+    if(c =='s')
+        format_string_argument(pbuffer, v, std::strlen(v));
+    else if(c == 'p')
+        format_pointer(pbuffer, v);
+    else
         return nullptr;
-    }
 
     return pformat + 1;
 }
@@ -234,10 +393,15 @@ char const* format(output_buffer* pbuffer, char const* pformat, std::string cons
 {
     if(*pformat != 's')
         return nullptr;
-    auto len = v.size();
-    char* p = pbuffer->reserve(len);
-    std::memcpy(p, v.data(), len);
-    pbuffer->commit(len);
+    format_string_argument(pbuffer, v.data(), v.size());
+    return pformat + 1;
+}
+
+char const* format(output_buffer* pbuffer, char const* pformat, frame_string v)
+{
+    if(*pformat != 's')
+        return nullptr;
+    format_string_argument(pbuffer, v.data(), v.size());
     return pformat + 1;
 }
 
@@ -247,174 +411,309 @@ char const* format(output_buffer* pbuffer, char const* pformat, void const* p)
     if(c != 'p' && c !='s')
         return nullptr;
     
-    conversion_specification cs;
-    cs.minimum_field_width = 0;
-    cs.precision = 1;
-    cs.plus_sign = 0;
-    cs.left_justify = false;
-    cs.alternative_form = true;
-    cs.pad_with_zeroes = false;
-    cs.uppercase = false;
-    
-    itoa_base16(pbuffer, reinterpret_cast<std::uintptr_t>(p), cs);
+    format_pointer(pbuffer, p);
     return pformat+1;
 }
 
-void template_formatter::append_percent(output_buffer* pbuffer)
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<short> v)
 {
-    auto p = pbuffer->reserve(1u);
-    *p = '%';
-    pbuffer->commit(1u);
+    return format_elements(pbuffer, pformat, v);
+}
+
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned short> v)
+{
+    return format_elements(pbuffer, pformat, v);
 }
 
-//http://www.scs.stanford.edu/histar/src/pkg/uclibc/libc/string/generic/strchrnul.c
-/* Find the first occurrence of C in S or the final NUL byte.  */
-char *strchrnul (const char *s, int c_in)
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<int> v)
 {
-  const unsigned char *char_ptr;
-  const unsigned long int *longword_ptr;
-  unsigned long int longword, magic_bits, charmask;
-  unsigned char c;
+    return format_elements(pbuffer, pformat, v);
+}
 
-  c = (unsigned char) c_in;
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned int> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-  /* Handle the first few characters by reading one character at a time.
-     Do this until CHAR_PTR is aligned on a longword boundary.  */
-  for (char_ptr = (const unsigned char *) s;
-       ((size_t) char_ptr & (sizeof (longword) - 1)) != 0;
-       ++char_ptr)
-    if (*char_ptr == c || *char_ptr == '\0')
-      return (char *) char_ptr;
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-  /* All these elucidatory comments refer to 4-byte longwords,
-     but the theory applies equally well to 8-byte longwords.  */
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned long> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-  longword_ptr = (unsigned long int *) char_ptr;
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long long> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-  /* Bits 31, 24, 16, and 8 of this number are zero.  Call these bits
-     the "holes."  Note that there is a hole just to the left of
-     each byte, with an extra at the end:
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<unsigned long long> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-     bits:  01111110 11111110 11111110 11111111
-     bytes: AAAAAAAA BBBBBBBB CCCCCCCC DDDDDDDD
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<float> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
 
-     The 1-bits make sure that carries propagate to the next 0-bit.
-     The 0-bits provide holes for carries to fall into.  */
-  switch (sizeof (longword))
-    {
-    case 4: magic_bits = 0x7efefeffL; break;
-    case 8: magic_bits = ((0x7efefefeL << 16) << 16) | 0xfefefeffL; break;
-    default:
-      abort ();
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<double> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
+
+char const* format(output_buffer* pbuffer, char const* pformat, frame_elements<long double> v)
+{
+    return format_elements(pbuffer, pformat, v);
+}
+
+namespace detail {
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, char v)
+{
+    return generic_format_char(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, signed char v)
+{
+    return generic_format_char(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned char v)
+{
+    return generic_format_char(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, short v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned short v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, int v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned int v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, long v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned long v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, long long v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, unsigned long long v)
+{
+    return generic_format_int(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, float v)
+{
+    return generic_format_float(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, double v)
+{
+    return generic_format_float(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, long double v)
+{
+    return generic_format_float(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, decimal v)
+{
+    if(s.conversion == 's' and s.bare())
+        return format_decimal(pbuffer, s.spec, 'f', v);
+    else
+        return format_decimal(pbuffer, s.spec, s.conversion, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, char const* v)
+{
+    if(not s.bare())
+        return false;
+    if(s.conversion == 's')
+        format_string_argument(pbuffer, v, std::strlen(v));
+    else if(s.conversion == 'p')
+        format_pointer(pbuffer, v);
+    else
+        return false;
+    return true;
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, std::string const& v)
+{
+    if(not s.bare() or s.conversion != 's')
+        return false;
+    format_string_argument(pbuffer, v.data(), v.size());
+    return true;
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_string v)
+{
+    if(not s.bare() or s.conversion != 's')
+        return false;
+    format_string_argument(pbuffer, v.data(), v.size());
+    return true;
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, void const* v)
+{
+    if(not s.bare() or (s.conversion != 'p' and s.conversion != 's'))
+        return false;
+    format_pointer(pbuffer, v);
+    return true;
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<short> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned short> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<int> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned int> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned long> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long long> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<unsigned long long> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<float> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<double> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+bool format_specified(output_buffer* pbuffer, format_specifier const& s, frame_elements<long double> v)
+{
+    return format_elements(pbuffer, s, v);
+}
+
+format_plan::format_plan(char const* pformat)
+{
+    // The literal text goes into literals_ first, and the segments get their
+    // pointers into it at the end, when it won't be reallocated any more.
+    std::vector<std::size_t> literal_offsets;
+    while(true) {
+        format_segment segment;
+        literal_offsets.push_back(literals_.size());
+        char const* pspecifier;
+        while(true) {
+            pspecifier = std::strchr(pformat, '%');
+            if(not pspecifier)
+                pspecifier = pformat + std::strlen(pformat);
+            literals_.append(pformat, pspecifier);
+            if(*pspecifier == '\0' or pspecifier[1] != '%')
+                break;
+            // "%%"
+            literals_ += '%';
+            pformat = pspecifier + 2;
+        }
+        segment.pliteral = nullptr;
+        segment.literal_size = literals_.size() - literal_offsets.back();
+        segment.has_specifier = *pspecifier != '\0';
+        if(not segment.has_specifier) {
+            segments_.push_back(segment);
+            break;
+        }
+
+        format_specifier& specifier = segment.specifier;
+        specifier.ptext = pspecifier + 1;
+        char const* pconversion = parse_conversion_specification(
+                &specifier.spec, specifier.ptext);
+        specifier.conversion = *pconversion;
+        // A '%' at the very end has no conversion character, and we must not
+        // step past the terminator.
+        specifier.pend = *pconversion? pconversion + 1 : pconversion;
+        segments_.push_back(segment);
+        pformat = specifier.pend;
     }
+    for(std::size_t i=0; i!=segments_.size(); ++i)
+        segments_[i].pliteral = literals_.data() + literal_offsets[i];
+}
 
-  /* Set up a longword, each of whose bytes is C.  */
-  charmask = c | (c << 8);
-  charmask |= charmask << 16;
-  if (sizeof (longword) > 4)
-    /* Do the shift in two steps to avoid a warning if long has 32 bits.  */
-    charmask |= (charmask << 16) << 16;
-  if (sizeof (longword) > 8)
-    abort ();
-
-  /* Instead of the traditional loop which tests each character,
-     we will test a longword at a time.  The tricky part is testing
-     if *any of the four* bytes in the longword in question are zero.  */
-  for (;;)
+format_plan const* format_site::create_plan() const
+{
+    format_plan const* pplan = new format_plan(pformat_);
+    format_plan const* pexpected = nullptr;
+    // Several output threads may get here at once if they log from the same
+    // call site. Only one plan gets to stay.
+    if(not pplan_.compare_exchange_strong(pexpected, pplan,
+                std::memory_order_acq_rel, std::memory_order_acquire))
     {
-      /* We tentatively exit the loop if adding MAGIC_BITS to
-	 LONGWORD fails to change any of the hole bits of LONGWORD.
-
-	 1) Is this safe?  Will it catch all the zero bytes?
-	 Suppose there is a byte with all zeros.  Any carry bits
-	 propagating from its left will fall into the hole at its
-	 least significant bit and stop.  Since there will be no
-	 carry from its most significant bit, the LSB of the
-	 byte to the left will be unchanged, and the zero will be
-	 detected.
-
-	 2) Is this worthwhile?  Will it ignore everything except
-	 zero bytes?  Suppose every byte of LONGWORD has a bit set
-	 somewhere.  There will be a carry into bit 8.  If bit 8
-	 is set, this will carry into bit 16.  If bit 8 is clear,
-	 one of bits 9-15 must be set, so there will be a carry
-	 into bit 16.  Similarly, there will be a carry into bit
-	 24.  If one of bits 24-30 is set, there will be a carry
-	 into bit 31, so all of the hole bits will be changed.
-
-	 The one misfire occurs when bits 24-30 are clear and bit
-	 31 is set; in this case, the hole at bit 31 is not
-	 changed.  If we had access to the processor carry flag,
-	 we could close this loophole by putting the fourth hole
-	 at bit 32!
-
-	 So it ignores everything except 128's, when they're aligned
-	 properly.
-
-	 3) But wait!  Aren't we looking for C as well as zero?
-	 Good point.  So what we do is XOR LONGWORD with a longword,
-	 each of whose bytes is C.  This turns each byte that is C
-	 into a zero.  */
-
-      longword = *longword_ptr++;
-
-      /* Add MAGIC_BITS to LONGWORD.  */
-      if ((((longword + magic_bits)
-
-	    /* Set those bits that were unchanged by the addition.  */
-	    ^ ~longword)
-
-	   /* Look at only the hole bits.  If any of the hole bits
-	      are unchanged, most likely one of the bytes was a
-	      zero.  */
-	   & ~magic_bits) != 0 ||
-
-	  /* That caught zeroes.  Now test for C.  */
-	  ((((longword ^ charmask) + magic_bits) ^ ~(longword ^ charmask))
-	   & ~magic_bits) != 0)
-	{
-	  /* Which of the bytes was C or zero?
-	     If none of them were, it was a misfire; continue the search.  */
-
-	  const unsigned char *cp = (const unsigned char *) (longword_ptr - 1);
-
-	  if (*cp == c || *cp == '\0')
-	    return (char *) cp;
-	  if (*++cp == c || *cp == '\0')
-	    return (char *) cp;
-	  if (*++cp == c || *cp == '\0')
-	    return (char *) cp;
-	  if (*++cp == c || *cp == '\0')
-	    return (char *) cp;
-	  if (sizeof (longword) > 4)
-	    {
-	      if (*++cp == c || *cp == '\0')
-		return (char *) cp;
-	      if (*++cp == c || *cp == '\0')
-		return (char *) cp;
-	      if (*++cp == c || *cp == '\0')
-		return (char *) cp;
-	      if (*++cp == c || *cp == '\0')
-		return (char *) cp;
-	    }
-	}
+        delete pplan;
+        pplan = pexpected;
     }
+    return pplan;
+}
 
-  /* This should never happen.  */
-  return NULL;
+}   // namespace detail
+
+void template_formatter::append_percent(output_buffer* pbuffer)
+{
+    auto p = pbuffer->reserve(1u);
+    *p = '%';
+    pbuffer->commit(1u);
 }
 
 char const* template_formatter::next_specifier(output_buffer* pbuffer,
         char const* pformat)
 {
-//#ifdef _GNU_SOURCE
     while(true) {
-        char const* pspecifier = strchrnul(pformat, '%');
-        
-        auto len = pspecifier - pformat;
-        auto p = pbuffer->reserve(len);
-        std::memcpy(p, pformat, len);
-        pbuffer->commit(len);
+        char const* pspecifier = detail::copy_format_literal(pbuffer, pformat);
         if(*pspecifier == '\0')
             return nullptr;
 
@@ -427,9 +726,18 @@ char const* template_formatter::next_specifier(output_buffer* pbuffer,
         ++pformat;
         append_percent(pbuffer);
     }
-//#else
-//    static_assert(false, "need replacement for strchrnul");
-//endif
+}
+
+void template_formatter::run_plan(output_buffer* pbuffer,
+        detail::format_segment const* psegment)
+{
+    write_literal(pbuffer, psegment);
+    if(psegment->has_specifier) {
+        // We ran out of arguments. Let format() deal with the remaining
+        // specifiers like it does without a plan.
+        append_percent(pbuffer);
+        format(pbuffer, psegment->specifier.ptext);
+    }
 }
 
 void template_formatter::format(output_buffer* pbuffer, char const* pformat)
@@ -443,3 +751,289 @@ void template_formatter::format(output_buffer* pbuffer, char const* pformat)
 }
 
 }   // namespace reckless
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace reckless {
+namespace detail {
+namespace {
+
+// Takes "%{...}" and prints what's inside the braces, so it reads past the
+// end of the specifier as the plan sees it.
+struct braced {
+    int value;
+};
+
+char const* format(output_buffer* pbuffer, char const* pformat, braced v)
+{
+    if(*pformat != '{')
+        return nullptr;
+    char const* pclose = std::strchr(pformat, '}');
+    if(not pclose)
+        return nullptr;
+    pbuffer->write(pformat + 1, pclose - pformat - 1);
+    template_formatter::format(pbuffer, "=%d", v.value);
+    return pclose + 1;
+}
+
+template <typename Format, typename... Args>
+std::string format_to_string(Format fmt, Args... args)
+{
+    unit_test::string_writer writer;
+    output_buffer buffer(&writer, 1024);
+    template_formatter::format(&buffer, fmt, args...);
+    buffer.flush();
+    return writer.str();
+}
+
+template <typename... Args>
+bool same_output(format_string fmt, Args... args)
+{
+    return format_to_string(fmt, args...) == format_to_string(fmt.c_str(), args...);
+}
+
+}   // anonymous namespace
+
+void test_format_plan_literals()
+{
+    TEST(same_output(RECKLESS_FMT("")));
+    TEST(same_output(RECKLESS_FMT("no specifiers")));
+    TEST(same_output(RECKLESS_FMT("100%% sure, %d%%"), 5));
+    TEST(same_output(RECKLESS_FMT("%%%%%d%%"), 5));
+    TEST(same_output(RECKLESS_FMT("trailing %"), 5));
+    TEST(same_output(RECKLESS_FMT("trailing %-"), 5));
+    TEST(format_to_string(RECKLESS_FMT("%d%% of %s"), 50, "all") == "50% of all");
+}
+
+void test_format_plan_specifiers()
+{
+    std::string s("std::string");
+    int x = 0;
+    TEST(same_output(RECKLESS_FMT("%d %x %X %#x %08d %-6d| %+d % d"),
+                -12, 255, 255u, 255L, 42LL, 7ULL, 3, 4));
+    TEST(same_output(RECKLESS_FMT("%.3f %8.2f %-8.1f| %f"), 3.14159, 2.5f,
+                static_cast<long double>(1.25), -0.5));
+    TEST(same_output(RECKLESS_FMT("%e %.2E %g %G %#.3g"), 1234.5, -0.00012f,
+                1e-5, 1e20, static_cast<long double>(2.0)));
+    TEST(format_to_string(RECKLESS_FMT("%s %s %s"), 0.1, 2.5f, 1e21) ==
+            "0.1 2.5 1e+21");
+    TEST(same_output(RECKLESS_FMT("%s %f %.2f %+09.3f %-6.0f|"),
+                decimal(-1250000000, 8), decimal(5, 1), decimal(12345, 3),
+                decimal(7, 0), decimal(25, 1)));
+    TEST(format_to_string(RECKLESS_FMT("%s %.2f %8.1f"), decimal(-1250000000, 8),
+                decimal(12345, 3), decimal(-1, 4)) == "-12.50000000 12.35     -0.0");
+    TEST(same_output(RECKLESS_FMT("%s %s %c %d %s"), "literal", s, 'x', 'y',
+                static_cast<unsigned char>('z')));
+    TEST(same_output(RECKLESS_FMT("%p %p %s"), static_cast<void const*>(&x),
+                "pointer", static_cast<void*>(&x)));
+    TEST(same_output(RECKLESS_FMT("%hd %d"), static_cast<short>(-5),
+                static_cast<unsigned short>(5)));
+}
+
+void test_format_plan_mismatches()
+{
+    std::string s("str");
+    // Too few and too many arguments.
+    TEST(same_output(RECKLESS_FMT("%d and %d and %s"), 1));
+    TEST(same_output(RECKLESS_FMT("%d"), 1, 2, 3));
+    // Arguments that don't fit their specifiers.
+    TEST(same_output(RECKLESS_FMT("%d then %d"), 1.5, 2));
+    TEST(same_output(RECKLESS_FMT("%5s then %d"), 1.5, 2));
+    TEST(same_output(RECKLESS_FMT("%e then %d"), decimal(1, 1), 2));
+    TEST(same_output(RECKLESS_FMT("%5s then %d"), 'c', 2));
+    TEST(same_output(RECKLESS_FMT("%-s then %d"), "str", 2));
+    TEST(same_output(RECKLESS_FMT("%5s then %d"), s, 2));
+    TEST(same_output(RECKLESS_FMT("%5% then %d"), 1, 2));
+    TEST(same_output(RECKLESS_FMT("%d"), true));
+    // Custom format functions, including one that doesn't stop where the
+    // plan expects it to.
+    TEST(same_output(RECKLESS_FMT("a %{x} b %d %s"), braced{1}, 2, "c"));
+    TEST(format_to_string(RECKLESS_FMT("a %{x} b %d"), braced{1}, 2) ==
+            "a x=1 b 2");
+    TEST(same_output(RECKLESS_FMT("a %s b %d"), braced{1}, 2));
+}
+
+void test_format_plan_reuse()
+{
+    // The plan is made once per call site and then reused.
+    format_plan const* pplan = nullptr;
+    for(int i=0; i!=3; ++i) {
+        format_string fmt = RECKLESS_FMT("value %d of %s");
+        TEST(format_to_string(fmt, i, "three") ==
+                format_to_string("value %d of %s", i, "three"));
+        if(pplan) {
+            TEST(fmt.plan() == pplan);
+        }
+        pplan = fmt.plan();
+    }
+}
+
+// Helper for checking a format string on its own with check_format().
+template <typename... Args, std::size_t N>
+constexpr unsigned long check(char const (&fmt)[N])
+{
+    return check_format(fmt, 0, N - 1, format_argument_classes<Args...>::value, 0);
+}
+
+void test_format_checks()
+{
+    static_assert(check<int, double, char const*>("%d %.2f %s") == FORMAT_OK, "");
+    static_assert(check<>("100%% sure") == FORMAT_OK, "");
+    static_assert(check<char, char, std::string, void*, char*>("%s %x %s %p %p")
+            == FORMAT_OK, "");
+    static_assert(check<braced>("%{x}") == FORMAT_OK, "");
+    static_assert(check<bool, unsigned short>("%d %#06X") == FORMAT_OK, "");
+    static_assert(check<double, float, double, long double>("%s %e %G %.3g")
+            == FORMAT_OK, "");
+    static_assert(check<decimal, decimal, decimal>("%s %f %08.2F") == FORMAT_OK, "");
+
+    static_assert(check<int>("%d %d") ==
+            format_check_result(FORMAT_TOO_FEW_ARGUMENTS, 2), "");
+    static_assert(check<>("trailing %") ==
+            format_check_result(FORMAT_TOO_FEW_ARGUMENTS, 1), "");
+    static_assert(check<int, int>("%d%%") ==
+            format_check_result(FORMAT_TOO_MANY_ARGUMENTS, 2), "");
+    static_assert(check<int, double>("%d %d") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 2), "");
+    static_assert(check<int>("%s") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+    static_assert(check<std::string>("%5s") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+    static_assert(check<char>("%c") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+    static_assert(check<float>("%x") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+    static_assert(check<double>("%5s") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+    static_assert(check<int, decimal>("%d %g") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 2), "");
+
+    // A string that passes the check comes out the same as with RECKLESS_FMT.
+    std::string s("str");
+    TEST(format_to_string(RECKLESS_CHECKED_FMT("no arguments")) ==
+            "no arguments");
+    TEST(format_to_string(RECKLESS_CHECKED_FMT("%d%% %.1f %s %s %s %p",
+                    50, 2.5, "c", s, 'x', static_cast<void*>(nullptr))) ==
+            format_to_string(RECKLESS_FMT("%d%% %.1f %s %s %s %p"),
+                    50, 2.5, "c", s, 'x', static_cast<void*>(nullptr)));
+    TEST(format_to_string(RECKLESS_CHECKED_FMT("a %{x} b %d", braced{1}, 2))
+            == "a x=1 b 2");
+}
+
+void test_frame_strings()
+{
+    // Captured strings are laid out back to back after the tuple, each with
+    // a null terminator.
+    char frame[32];
+    char* ptail = frame;
+    std::string s("abc");
+    std::tuple<captured_string, int, captured_string> args{
+        frame_argument<std::string>::capture(ptail, s), 5,
+        frame_argument<transient_string>::capture(ptail, transient("de"))};
+    TEST(ptail == frame + 7);
+    TEST(std::memcmp(frame, "abc\0de\0", 7) == 0);
+    make_index_sequence<3>::type indexes;
+    TEST(captured_size(args, indexes) == 7);
+    TEST(frame_value(std::get<0>(args)).c_str() == frame);
+    TEST(std::string(frame_value(std::get<2>(args))) == "de");
+
+    // Without a tail they go on the heap and take no room in the frame.
+    char* pnull = nullptr;
+    captured_string heap(pnull, "heap", 4);
+    TEST(heap.inline_size() == 0);
+    TEST(std::strcmp(heap.data(), "heap") == 0);
+
+    TEST(format_to_string("[%s] [%s]", frame_string("xyz", 3), frame_string("", 0))
+            == "[xyz] []");
+    TEST(same_output(RECKLESS_FMT("%s %d %5s"), frame_string("xyz", 3), 1,
+                frame_string("w", 1)));
+}
+
+unit_test::suite<> frame_string_tests = {
+    TESTCASE(test_frame_strings)
+};
+
+void test_frame_elements()
+{
+    // Elements are aligned within the tail, which has room for that.
+    alignas(8) char frame[64];
+    char* ptail = frame + 1;
+    std::vector<std::int64_t> v{1, -2, 3};
+    std::tuple<captured_elements<std::int64_t>> args{
+        frame_argument<element_range<std::int64_t>>::capture(ptail,
+                elements(v))};
+    TEST(ptail == frame + 1 + 3*8 + 7);
+    make_index_sequence<1>::type indexes;
+    TEST(captured_size(args, indexes) == 3*8 + 7);
+    frame_elements<std::int64_t> fv = frame_value(std::get<0>(args));
+    TEST(fv.data() == reinterpret_cast<std::int64_t*>(frame + 8));
+    TEST(fv.size() == 3 and fv[1] == -2);
+    v[1] = 7;
+    TEST(fv[1] == -2);
+
+    char* pnull = nullptr;
+    double d[2] = {0.5, 1.5};
+    captured_elements<double> heap(pnull, elements(d));
+    TEST(heap.inline_size() == 0);
+    TEST(heap.value()[1] == 1.5);
+
+    int ints[] = {1, -22, 333, 0, std::numeric_limits<int>::min()};
+    std::vector<std::uint64_t> large{std::numeric_limits<std::uint64_t>::max(),
+        10, 9};
+    unsigned short shorts[] = {65535, 1};
+    TEST(format_to_string("[%d]", frame_elements<int>(ints, 5, ", ")) ==
+            "[1, -22, 333, 0, -2147483648]");
+    TEST(format_to_string("%d", frame_elements<std::uint64_t>(large.data(), 3,
+                    " ")) == "18446744073709551615 10 9");
+    TEST(format_to_string("%d", frame_elements<unsigned short>(shorts, 2,
+                    "")) == "655351");
+    TEST(format_to_string("[%d]", frame_elements<int>(ints, 0, ", ")) == "[]");
+    TEST(format_to_string("%+d|%4d|%x", frame_elements<int>(ints, 3, ","),
+                frame_elements<int>(ints, 2, ","),
+                frame_elements<int>(ints + 2, 1, ",")) ==
+            "+1,-22,+333|   1, -22|14d");
+    // Long separators take the slow path, and many elements take several
+    // blocks.
+    std::vector<long> many(200, -1234567);
+    std::string expected = "-1234567";
+    for(int i=1; i!=200; ++i)
+        expected += " --- separator --- -1234567";
+    TEST(format_to_string("%d", frame_elements<long>(many.data(), 200,
+                    " --- separator --- ")) == expected);
+
+    TEST(format_to_string("%.2f %s %g", frame_elements<double>(d, 2, "/"),
+                frame_elements<double>(d, 2, "/"),
+                frame_elements<float>(nullptr, 0, "/")) == "0.50/1.50 0.5/1.5 ");
+    TEST(same_output(RECKLESS_FMT("%d %.1f %s %e"), frame_elements<int>(ints, 3, ";"),
+                frame_elements<double>(d, 2, ";"), frame_elements<double>(d, 2, ";"),
+                frame_elements<double>(d, 2, ";")));
+    // A mismatch prints nothing from the array, only the specifier itself.
+    TEST(same_output(RECKLESS_FMT("%s then %d"), frame_elements<int>(ints, 3, ","), 2));
+    TEST(same_output(RECKLESS_FMT("%5s then %d"), frame_elements<double>(d, 2, ","), 2));
+    TEST(format_to_string("%s", frame_elements<int>(ints, 3, ",")) == "%s");
+
+    static_assert(check<element_range<int>, element_range<double>>("%d %s")
+            == FORMAT_OK, "");
+    static_assert(check<element_range<int>>("%f") ==
+            format_check_result(FORMAT_ARGUMENT_MISMATCH, 1), "");
+}
+
+unit_test::suite<> frame_elements_tests = {
+    TESTCASE(test_frame_elements)
+};
+
+unit_test::suite<> format_plan_tests = {
+    TESTCASE(test_format_plan_literals),
+    TESTCASE(test_format_plan_specifiers),
+    TESTCASE(test_format_plan_mismatches),
+    TESTCASE(test_format_plan_reuse),
+    TESTCASE(test_format_checks)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -1,34 +1,44 @@
 #include <reckless/detail/thread_input_buffer.hpp>
+#include <reckless/basic_log.hpp>
 #include <reckless/detail/utility.hpp>
+#include <chrono>
 #include <cassert>
+#include <ciso646>
 
-reckless::detail::thread_input_buffer::thread_input_buffer(std::size_t size) :
+reckless::detail::thread_input_buffer::thread_input_buffer(basic_log* powner,
+        std::size_t size, overflow_policy policy, buffer_memory const& memory) :
     input_consumed_flag(false),
+    reported_dropped_count(0),
+    last_swept_input_start(nullptr),
+    memory_(memory),
+    powner_(powner),
+    thread_id_(current_thread_id()),
     size_(size),
+    base_size_(size),
+    overflow_policy_(policy),
+    dropped_count_(0),
+    frames_enqueued_(0),
+    input_buffer_full_stalls_(0),
+    input_buffer_full_stall_ns_(0),
+    shared_queue_full_stalls_(0),
+    shared_queue_full_stall_ns_(0),
+    retired_(false),
+    shrink_requested_(false),
+    ppredecessor_(nullptr),
     pinput_start_(buffer_start()),
-    pinput_end_(buffer_start())
+    pinput_end_(buffer_start()),
+    pcommitted_end_(buffer_start()),
+    pcommit_end_(buffer_start())
 {
 }
 
 reckless::detail::thread_input_buffer::~thread_input_buffer()
 {
-    // FIXME I don't think we are properly waiting until the output
-    // worker has cleared this from touched_input_buffers. Which means
-    // it can call signal_input_consumed on a dangling pointer. We need
-    // to either get rid of touched_input_buffer or make sure we wait
-    // for the right thing here.
-    //
-    // Actually, even if we don't have touched_input_buffers, there is a race
-    // between the call to discard_input_frame() and signal_input_consumed().
-    // If this dtor runs between them, then signal_input_consumed will be
-    // called on a dangling pointer.
- 
-    // Wait for the output thread to consume all the contents of the buffer
-    // before release it.
-    // Both write() and wait_input_consumed should create full memory barriers,
-    // so no need for strict memory ordering in this load.
-    while(pinput_start_.load(std::memory_order_relaxed) != pinput_end_)
-        wait_input_consumed();
+    // Buffers are only destroyed (or recycled) by the output thread once it
+    // has consumed everything in them and is done with touched_input_buffers,
+    // or after the output thread has exited. So nobody can be holding on to a
+    // pointer to this buffer at this point, and there is nothing left to wait
+    // for.
 }
 
 char* reckless::detail::thread_input_buffer::discard_input_frame(std::size_t size)
@@ -81,9 +91,19 @@ char* reckless::detail::thread_input_buffer::advance_frame_pointer(char* p, std:
 // TODO inline this function? Maybe not considering that fixme.
 void reckless::detail::thread_input_buffer::wait_input_consumed()
 {
-    // FIXME we need to think about what to do here, should we signal
-    // g_shared_input_queue_full_event to force the output thread to wake up?
-    // We probably should, or we could sit here for a full second.
+    // If we're in the middle of a batch then the frames written so far haven't
+    // been committed. As long as there is committed data left for the output
+    // thread to consume, it will free up space and we can keep waiting. But
+    // once the output thread has caught up with everything we committed, the
+    // batch itself is what's filling the buffer, and the output thread will
+    // never touch it unless we commit it now. That means a batch that doesn't
+    // fit in the buffer gets split up, but that beats a deadlock.
+    //
+    // Other than that, we don't need to wake up the output thread here, since
+    // committing wakes it up if it is parked (see
+    // basic_log::queue_commit_extent).
+    if(has_uncommitted_input() and input_start() == pcommitted_end_)
+        powner_->commit(this, true);
     input_consumed_event_.wait();
 }
 
@@ -93,6 +113,53 @@ void reckless::detail::thread_input_buffer::signal_input_consumed()
 }
 
 char* reckless::detail::thread_input_buffer::allocate_input_frame(std::size_t size)
+{
+    char* p = try_allocate_input_frame(size);
+    if(likely(p != nullptr))
+        return p;
+
+    // We can't write a frame that is larger than the entire capacity of the
+    // input buffer. If you hit this assert then you either need to write a
+    // smaller log entry, or you need to make the input buffer larger.
+    assert(aligned_frame_size(size) < size_);
+
+    // Not enough room. Wait for the output thread to consume some input.
+    auto start = std::chrono::steady_clock::now();
+    do {
+        wait_input_consumed();
+        p = try_allocate_input_frame(size);
+    } while(p == nullptr);
+    auto stall = std::chrono::steady_clock::now() - start;
+    single_writer_add(input_buffer_full_stalls_, std::uint64_t(1));
+    single_writer_add(input_buffer_full_stall_ns_, static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stall).count()));
+    return p;
+}
+
+reckless::producer_stats reckless::detail::thread_input_buffer::stats() const
+{
+    producer_stats s;
+    s.frames_enqueued = frames_enqueued_.load(std::memory_order_relaxed);
+    s.frames_dropped = dropped_count_.load(std::memory_order_relaxed);
+    s.input_buffer_full_stalls = input_buffer_full_stalls_.load(std::memory_order_relaxed);
+    s.input_buffer_full_stall_ns = input_buffer_full_stall_ns_.load(std::memory_order_relaxed);
+    s.shared_queue_full_stalls = shared_queue_full_stalls_.load(std::memory_order_relaxed);
+    s.shared_queue_full_stall_ns = shared_queue_full_stall_ns_.load(std::memory_order_relaxed);
+    return s;
+}
+
+reckless::thread_stats reckless::detail::thread_input_buffer::thread_totals() const
+{
+    thread_stats s;
+    static_cast<producer_stats&>(s) = inherited_stats_;
+    s += stats();
+    s.thread_id = thread_id_;
+    s.input_buffer_size = size_;
+    return s;
+}
+
+// Returns nullptr if there isn't enough room for the frame right now.
+char* reckless::detail::thread_input_buffer::try_allocate_input_frame(std::size_t size)
 {
     // Conceptually, we have the invariant that
     //   pinput_start_ <= pinput_end_,
@@ -110,78 +177,193 @@ char* reckless::detail::thread_input_buffer::allocate_input_frame(std::size_t si
     //   
     // (This is easier to understand by drawing it on a paper than by reading
     // the comment text).
-    auto mask = frame_alignment_mask();
-    size = (size + mask) & ~mask;
+    size = aligned_frame_size(size);
 
-    // We can't write a frame that is larger than the entire capacity of the
-    // input buffer. If you hit this assert then you either need to write a
-    // smaller log entry, or you need to make the input buffer larger.
-    assert(size < size_);
+    // A frame that is larger than the entire buffer will never fit, however
+    // long we wait. With elastic buffers the caller can switch to a larger
+    // buffer instead (see basic_log::allocate_input_frame_slow), so that's
+    // not an error here.
+    if(unlikely(size >= size_))
+        return nullptr;
  
-    while(true) {
-        auto pinput_end = pinput_end_;
-        // FIXME these asserts should / can be enabled again?
-        assert(static_cast<std::size_t>(pinput_end - buffer_start()) < size_);
-        assert(is_aligned(pinput_end));
-
-        // Even if we get an "old" value for pinput_start_ here, that's OK
-        // because other threads will never cause the amount of available
-        // buffer space to shrink. So either there is enough buffer space and
-        // we're done, or there isn't and we'll wait for an input-consumption
-        // event which creates a full memory barrier and hence gives us an
-        // updated value for pinput_start_. So memory_order_relaxed should be
-        // fine here.
-        auto pinput_start = pinput_start_.load(std::memory_order_relaxed);
-        std::ptrdiff_t free = pinput_start - pinput_end;
-        if(free > 0) {
-            // Free space is contiguous.
-            // Technically, there is enough room if size == free. But the
-            // problem with using the free space in this situation is that when
-            // we increase pinput_end_ by size, we end up with pinput_start_ ==
-            // pinput_end_. Now, given that state, how do we know if the buffer
-            // is completely filled or empty? So, it's easier to just check for
-            // size < free instead of size <= free, and pretend we're out
-            // of space if size == free. Same situation applies in the else
-            // clause below.
-            if(likely(static_cast<std::ptrdiff_t>(size) < free)) {
-                pinput_end_ = advance_frame_pointer(pinput_end, size);
-                return pinput_end;
-            } else {
-                // Not enough room. Wait for the output thread to consume some
-                // input.
-                wait_input_consumed();
-            }
+    auto pinput_end = pinput_end_;
+    // FIXME these asserts should / can be enabled again?
+    assert(static_cast<std::size_t>(pinput_end - buffer_start()) < size_);
+    assert(is_aligned(pinput_end));
+
+    // Even if we get an "old" value for pinput_start_ here, that's OK
+    // because other threads will never cause the amount of available
+    // buffer space to shrink. So either there is enough buffer space and
+    // we're done, or there isn't and we'll wait for an input-consumption
+    // event which creates a full memory barrier and hence gives us an
+    // updated value for pinput_start_. So memory_order_relaxed should be
+    // fine here.
+    auto pinput_start = pinput_start_.load(std::memory_order_relaxed);
+    std::ptrdiff_t free = pinput_start - pinput_end;
+    if(free > 0) {
+        // Free space is contiguous.
+        // Technically, there is enough room if size == free. But the
+        // problem with using the free space in this situation is that when
+        // we increase pinput_end_ by size, we end up with pinput_start_ ==
+        // pinput_end_. Now, given that state, how do we know if the buffer
+        // is completely filled or empty? So, it's easier to just check for
+        // size < free instead of size <= free, and pretend we're out
+        // of space if size == free. Same situation applies in the else
+        // clause below.
+        if(likely(static_cast<std::ptrdiff_t>(size) < free)) {
+            pinput_end_ = advance_frame_pointer(pinput_end, size);
+            return pinput_end;
+        } else {
+            return nullptr;
+        }
+    } else {
+        // Free space is non-contiguous.
+        // TODO should we use an end pointer instead of a size_?
+        std::size_t free1 = size_ - (pinput_end - buffer_start());
+        if(likely(size < free1)) {
+            // There's enough room in the first segment.
+            pinput_end_ = advance_frame_pointer(pinput_end, size);
+            return pinput_end;
         } else {
-            // Free space is non-contiguous.
-            // TODO should we use an end pointer instead of a size_?
-            std::size_t free1 = size_ - (pinput_end - buffer_start());
-            if(likely(size < free1)) {
-                // There's enough room in the first segment.
-                pinput_end_ = advance_frame_pointer(pinput_end, size);
-                return pinput_end;
+            std::size_t free2 = pinput_start - buffer_start();
+            if(likely(size < free2)) {
+                // We don't have enough room for a continuous input frame
+                // in the first segment (at the end of the circular
+                // buffer), but there is enough room in the second segment
+                // (at the beginning of the buffer). To instruct the output
+                // thread to skip ahead to the second segment, we need to
+                // put a marker value at the current position. We're
+                // supposed to be guaranteed enough room for the wraparound
+                // marker because frame alignment is at least the size of
+                // the marker.
+                *reinterpret_cast<formatter_dispatch_function_t**>(pinput_end_) =
+                    WRAPAROUND_MARKER;
+                pinput_end_ = advance_frame_pointer(buffer_start(), size);
+                return buffer_start();
             } else {
-                std::size_t free2 = pinput_start - buffer_start();
-                if(likely(size < free2)) {
-                    // We don't have enough room for a continuous input frame
-                    // in the first segment (at the end of the circular
-                    // buffer), but there is enough room in the second segment
-                    // (at the beginning of the buffer). To instruct the output
-                    // thread to skip ahead to the second segment, we need to
-                    // put a marker value at the current position. We're
-                    // supposed to be guaranteed enough room for the wraparound
-                    // marker because frame alignment is at least the size of
-                    // the marker.
-                    *reinterpret_cast<formatter_dispatch_function_t**>(pinput_end_) =
-                        WRAPAROUND_MARKER;
-                    pinput_end_ = advance_frame_pointer(buffer_start(), size);
-                    return buffer_start();
-                } else {
-                    // Not enough room. Wait for the output thread to consume
-                    // some input.
-                    wait_input_consumed();
-                }
+                return nullptr;
             }
         }
     }
 }
 
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <atomic>
+#include <thread>
+
+namespace reckless {
+namespace detail {
+
+void test_spsc_event_timeout()
+{
+    typedef std::chrono::steady_clock clock;
+    spsc_event event;
+    TEST(not event.wait(0));
+    auto start = clock::now();
+    TEST(not event.wait(30));
+    TEST(clock::now() - start >= std::chrono::milliseconds(30));
+
+    // The event resets itself when a wait consumes the signal, and signals
+    // don't add up.
+    event.signal();
+    event.signal();
+    TEST(event.wait(0));
+    TEST(not event.wait(0));
+    event.signal();
+    TEST(event.wait(30));
+    TEST(not event.wait(1));
+
+    // A signal from another thread ends a timed wait early.
+    std::thread signaler([&event]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        event.signal();
+    });
+    start = clock::now();
+    TEST(event.wait(10000));
+    TEST(clock::now() - start < std::chrono::milliseconds(5000));
+    signaler.join();
+    TEST(not event.wait(0));
+}
+
+// Two threads take turns through a pair of events. A lost wakeup would leave
+// both of them waiting, so every wait has a timeout that is far longer than
+// any turn should take, and we count the waits that time out.
+void test_spsc_event_ping_pong()
+{
+    unsigned const ROUNDS = 100000;
+    spsc_event ping;
+    spsc_event pong;
+    std::atomic<unsigned> timeouts(0);
+    std::thread responder([&]()
+    {
+        for(unsigned i=0; i!=ROUNDS; ++i) {
+            // Alternate between the untimed and timed paths.
+            if(i % 2 == 0)
+                ping.wait();
+            else if(not ping.wait(10000))
+                timeouts.fetch_add(1);
+            pong.signal();
+        }
+    });
+    for(unsigned i=0; i!=ROUNDS; ++i) {
+        ping.signal();
+        if(not pong.wait(10000)) {
+            timeouts.fetch_add(1);
+            break;
+        }
+    }
+    if(timeouts.load() != 0) {
+        // Let the responder finish rather than hang on join().
+        for(unsigned i=0; i!=ROUNDS; ++i)
+            ping.signal();
+    }
+    responder.join();
+    TEST(timeouts.load() == 0);
+}
+
+// The waiter uses timeouts so short that most signals arrive while it is
+// taking back its registration after a timeout. Every signal must still be
+// seen by exactly one wait.
+void test_spsc_event_timeout_race()
+{
+    unsigned const ROUNDS = 20000;
+    spsc_event event;
+    spsc_event ack;
+    std::atomic<unsigned> received(0);
+    std::atomic<bool> done(false);
+    std::thread waiter([&]()
+    {
+        while(not done.load()) {
+            if(event.wait(received.load() % 3)) {
+                received.fetch_add(1);
+                ack.signal();
+            }
+        }
+    });
+    bool lost = false;
+    for(unsigned i=0; i!=ROUNDS; ++i) {
+        event.signal();
+        if(not ack.wait(10000)) {
+            lost = true;
+            break;
+        }
+    }
+    done.store(true);
+    waiter.join();
+    TEST(not lost);
+    TEST(received.load() == ROUNDS);
+}
+
+unit_test::suite<> spsc_event_tests = {
+    TESTCASE(test_spsc_event_timeout),
+    TESTCASE(test_spsc_event_ping_pong),
+    TESTCASE(test_spsc_event_timeout_race)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -0,0 +1,128 @@
+#include <reckless/detail/timestamp_renderer.hpp>
+#include <reckless/detail/branch_hints.hpp> // unlikely
+
+#include <cstring>  // memcpy
+#include <ciso646>
+
+#include <time.h>   // localtime_r, gmtime_r, strftime
+
+namespace {
+// "YYYY-mm-dd HH:MM:SS"
+std::size_t const SECONDS_LENGTH = 19;
+
+std::uint32_t const POWERS_OF_TEN[] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u,
+    1000000000u
+};
+
+struct rendered_second {
+    bool valid;
+    std::int64_t seconds;
+    char text[SECONDS_LENGTH+1];
+};
+
+// One for local time and one for UTC, since a thread may format both.
+__thread rendered_second t_rendered[2];
+
+void render_second(rendered_second& rendered, std::int64_t seconds, bool utc)
+{
+    struct tm tm;
+    time_t time = static_cast<time_t>(seconds);
+    if(utc)
+        gmtime_r(&time, &tm);
+    else
+        localtime_r(&time, &tm);
+    // strftime gives back 0 if the year has more than four digits. We don't
+    // have room for that, so leave it blank rather than write garbage.
+    if(strftime(rendered.text, sizeof(rendered.text), "%Y-%m-%d %H:%M:%S",
+            &tm) != SECONDS_LENGTH)
+    {
+        std::memset(rendered.text, '?', SECONDS_LENGTH);
+    }
+    rendered.seconds = seconds;
+    rendered.valid = true;
+}
+}   // anonymous namespace
+
+char* reckless::detail::render_timestamp(char* p, std::int64_t seconds,
+        std::uint32_t nanoseconds, unsigned digits, bool utc)
+{
+    rendered_second& rendered = t_rendered[utc? 1 : 0];
+    if(unlikely(not rendered.valid or rendered.seconds != seconds))
+        render_second(rendered, seconds, utc);
+    std::memcpy(p, rendered.text, SECONDS_LENGTH);
+    p += SECONDS_LENGTH;
+    if(digits == 0)
+        return p;
+
+    *p = '.';
+    std::uint32_t fraction = nanoseconds/POWERS_OF_TEN[9 - digits];
+    for(unsigned i=digits; i!=0; --i) {
+        p[i] = static_cast<char>('0' + fraction%10);
+        fraction /= 10;
+    }
+    return p + digits + 1;
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+#include <string>
+
+namespace reckless {
+namespace detail {
+
+namespace {
+std::string render(std::int64_t seconds, std::uint32_t nanoseconds,
+        unsigned digits, bool utc)
+{
+    char buffer[MAX_TIMESTAMP_LENGTH];
+    char* end = render_timestamp(buffer, seconds, nanoseconds, digits, utc);
+    return std::string(buffer, end);
+}
+
+std::string reference_local(std::int64_t seconds)
+{
+    struct tm tm;
+    time_t time = static_cast<time_t>(seconds);
+    localtime_r(&time, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    return buffer;
+}
+}
+
+void test_timestamp_precision()
+{
+    TEST(render(1500000000, 123456789, 0, true) == "2017-07-14 02:40:00");
+    TEST(render(1500000000, 123456789, 3, true) == "2017-07-14 02:40:00.123");
+    TEST(render(1500000000, 123456789, 6, true) == "2017-07-14 02:40:00.123456");
+    TEST(render(1500000000, 123456789, 9, true) == "2017-07-14 02:40:00.123456789");
+    TEST(render(1500000000, 42, 9, true) == "2017-07-14 02:40:00.000000042");
+    TEST(render(1500000000, 999999999, 3, true) == "2017-07-14 02:40:00.999");
+    TEST(render(0, 0, 3, true) == "1970-01-01 00:00:00.000");
+}
+
+void test_timestamp_cache()
+{
+    // Going back and forth between seconds, and between UTC and local time,
+    // must not give us the text for the wrong one.
+    std::int64_t const times[] = {1500000000, 1500000001, 1500000001,
+        1500000000, 1500000060, 1500086400, 1500000000};
+    for(std::int64_t t : times) {
+        TEST(render(t, 0, 0, false) == reference_local(t));
+        TEST(render(t, 0, 0, true).size() == 19);
+    }
+    TEST(render(1500000001, 0, 0, true) == "2017-07-14 02:40:01");
+    TEST(render(1500086400, 0, 0, true) == "2017-07-15 02:40:00");
+    TEST(render(1500000060, 0, 0, true) == "2017-07-14 02:41:00");
+}
+
+unit_test::suite<> timestamp_renderer_tests = {
+    TESTCASE(test_timestamp_precision),
+    TESTCASE(test_timestamp_cache)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -0,0 +1,224 @@
+#include <reckless/detail/tsc_clock.hpp>
+#include <reckless/detail/timestamp_renderer.hpp>
+#include <reckless/output_buffer.hpp>
+
+#include <ciso646>
+
+#include <time.h>   // clock_gettime
+#ifdef RECKLESS_HAVE_TSC
+#include <cpuid.h>  // __get_cpuid
+#endif
+
+std::atomic<int> reckless::detail::g_tsc_clock_source(
+        reckless::detail::TSC_CLOCK_UNKNOWN);
+
+namespace {
+using namespace reckless::detail;
+
+std::int64_t const NANOSECONDS_PER_SECOND = 1000000000;
+// How often each thread recalibrates.
+std::int64_t const CALIBRATION_INTERVAL_NS = NANOSECONDS_PER_SECOND;
+// The tick rate is measured over at least this long, so that the error in
+// each clock sample doesn't matter much.
+std::int64_t const MIN_RATE_INTERVAL_NS = 1000000;
+// If the wall clock moves more than this much faster or slower than
+// CLOCK_MONOTONIC_RAW between two calibrations, then someone set the time
+// rather than NTP slewing it, and the wall clock is no good for measuring
+// the tick rate. 1000 ppm is twice the most that NTP will slew.
+double const MAX_REALTIME_SKEW = 0.001;
+
+std::int64_t read_clock(clockid_t id)
+{
+    timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec*NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+int detect_source()
+{
+#ifdef RECKLESS_HAVE_TSC
+    // CPUID leaf 0x80000007, EDX bit 8: invariant TSC.
+    unsigned eax, ebx, ecx, edx;
+    if(__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) and eax >= 0x80000007
+            and __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)
+            and (edx & (1u << 8)) != 0)
+    {
+        return TSC_CLOCK_TSC;
+    }
+#endif
+    return TSC_CLOCK_MONOTONIC_RAW;
+}
+
+// A reading of the tick counter and the system clocks at about the same
+// time.
+struct clock_sample {
+    std::uint64_t ticks;
+    std::int64_t monotonic_ns;  // CLOCK_MONOTONIC_RAW
+    std::int64_t realtime_ns;
+};
+
+clock_sample sample_clocks()
+{
+    // If we're interrupted between reading the tick counter and the system
+    // clocks then the sample is off. So we take a few and keep the one that
+    // took the least time.
+    clock_sample best = {0, 0, 0};
+    std::uint64_t best_window = ~std::uint64_t(0);
+    for(int i=0; i!=5; ++i) {
+        std::uint64_t before = tsc_clock_ticks();
+        std::int64_t monotonic = read_clock(CLOCK_MONOTONIC_RAW);
+        std::int64_t realtime = read_clock(CLOCK_REALTIME);
+        std::uint64_t after = tsc_clock_ticks();
+        if(after - before < best_window) {
+            best_window = after - before;
+            best.ticks = before + (after - before)/2;
+            best.monotonic_ns = monotonic;
+            best.realtime_ns = realtime;
+        }
+    }
+    return best;
+}
+
+// Gives the first calibration in each thread something to measure the tick
+// rate against, so that it usually doesn't have to wait. It is all zeroes if
+// a log is formatted before static initialization gets here.
+clock_sample const g_startup_sample = sample_clocks();
+
+struct calibration {
+    bool valid;
+    clock_sample anchor;
+    double ns_per_tick;
+    std::uint64_t next_calibration_ticks;
+};
+
+__thread calibration t_calibration;
+
+void calibrate(calibration& c)
+{
+    clock_sample reference = c.valid? c.anchor : g_startup_sample;
+    clock_sample now = sample_clocks();
+    if(reference.ticks == 0)
+        reference = now;
+    while(now.monotonic_ns - reference.monotonic_ns < MIN_RATE_INTERVAL_NS)
+        now = sample_clocks();
+
+    double ticks = static_cast<double>(now.ticks - reference.ticks);
+    double monotonic_ns = static_cast<double>(now.monotonic_ns - reference.monotonic_ns);
+    double realtime_ns = static_cast<double>(now.realtime_ns - reference.realtime_ns);
+    // We want to track the wall clock, including any adjustment that NTP is
+    // making to its rate. But if the time was set, the wall clock jumped and
+    // we have to go by the raw clock until the next calibration.
+    if(realtime_ns > monotonic_ns*(1 - MAX_REALTIME_SKEW)
+            and realtime_ns < monotonic_ns*(1 + MAX_REALTIME_SKEW))
+    {
+        c.ns_per_tick = realtime_ns/ticks;
+    } else {
+        c.ns_per_tick = monotonic_ns/ticks;
+    }
+    c.anchor = now;
+    c.next_calibration_ticks = now.ticks + static_cast<std::uint64_t>(
+            CALIBRATION_INTERVAL_NS/c.ns_per_tick);
+    c.valid = true;
+}
+}   // anonymous namespace
+
+std::uint64_t reckless::detail::tsc_clock_ticks_slow()
+{
+    int source = g_tsc_clock_source.load(std::memory_order_relaxed);
+    if(source == TSC_CLOCK_UNKNOWN) {
+        source = detect_source();
+        g_tsc_clock_source.store(source, std::memory_order_relaxed);
+    }
+#ifdef RECKLESS_HAVE_TSC
+    if(source == TSC_CLOCK_TSC)
+        return __rdtsc();
+#endif
+    return static_cast<std::uint64_t>(read_clock(CLOCK_MONOTONIC_RAW));
+}
+
+std::int64_t reckless::detail::tsc_clock_to_realtime(std::uint64_t ticks)
+{
+    calibration& c = t_calibration;
+    if(unlikely(not c.valid or ticks >= c.next_calibration_ticks))
+        calibrate(c);
+    // Entries that were waiting in the queue during the calibration have
+    // ticks from before the anchor, so the difference may be negative.
+    std::int64_t delta = static_cast<std::int64_t>(ticks - c.anchor.ticks);
+    return c.anchor.realtime_ns + static_cast<std::int64_t>(delta*c.ns_per_tick);
+}
+
+void reckless::detail::format_nanosecond_timestamp(output_buffer* pbuffer,
+        std::int64_t ns, unsigned digits, bool utc)
+{
+    std::int64_t seconds = ns/NANOSECONDS_PER_SECOND;
+    std::int64_t fraction = ns%NANOSECONDS_PER_SECOND;
+    if(fraction < 0) {
+        seconds -= 1;
+        fraction += NANOSECONDS_PER_SECOND;
+    }
+    char* p = pbuffer->reserve(MAX_TIMESTAMP_LENGTH);
+    char* end = render_timestamp(p, seconds,
+            static_cast<std::uint32_t>(fraction), digits, utc);
+    pbuffer->commit(end - p);
+}
+
+#ifdef UNIT_TEST
+#include "unit_test.hpp"
+
+namespace reckless {
+namespace detail {
+
+void test_tsc_clock_conversion()
+{
+    // The converted time agrees with the system clock, and keeps up with it
+    // across a recalibration.
+    for(int i=0; i!=3; ++i) {
+        std::int64_t before = read_clock(CLOCK_REALTIME);
+        std::int64_t converted = tsc_clock_to_realtime(tsc_clock_ticks());
+        std::int64_t after = read_clock(CLOCK_REALTIME);
+        TEST(converted > before - 1000000);
+        TEST(converted < after + 1000000);
+        if(i == 0) {
+            t_calibration.next_calibration_ticks = 0;
+        } else {
+            timespec ts = {0, 10000000};
+            nanosleep(&ts, nullptr);
+        }
+    }
+
+    std::uint64_t first = tsc_clock_ticks();
+    std::uint64_t second = tsc_clock_ticks();
+    TEST(second >= first);
+    TEST(tsc_clock_to_realtime(second) >= tsc_clock_to_realtime(first));
+}
+
+void test_nanosecond_timestamp_format()
+{
+    unit_test::string_writer w;
+    output_buffer buffer(&w, 256);
+    // Local time, so we can only check the fraction and the layout.
+    format_nanosecond_timestamp(&buffer, 1500000000*NANOSECONDS_PER_SECOND + 42);
+    format_nanosecond_timestamp(&buffer, -1);
+    buffer.flush();
+    TEST(w.str().size() == 58);
+    TEST(w.str().substr(19, 10) == ".000000042");
+    TEST(w.str().substr(29 + 19, 10) == ".999999999");
+    TEST(w.str()[4] == '-' and w.str()[10] == ' ' and w.str()[13] == ':');
+
+    w.reset();
+    format_nanosecond_timestamp(&buffer, 1500000000*NANOSECONDS_PER_SECOND +
+            123456789, 3, true);
+    format_nanosecond_timestamp(&buffer, 1500000000*NANOSECONDS_PER_SECOND +
+            123456789, 6, true);
+    buffer.flush();
+    TEST(w.str() == "2017-07-14 02:40:00.1232017-07-14 02:40:00.123456");
+}
+
+unit_test::suite<> tsc_clock_tests = {
+    TESTCASE(test_tsc_clock_conversion),
+    TESTCASE(test_nanosecond_timestamp_format)
+};
+
+}   // namespace detail
+}   // namespace reckless
+#endif  // UNIT_TEST
@@ -8,6 +8,8 @@
 #include <stdexcept>    // logic_error
 #include <sstream>  // ostringstream
 
+#include <reckless/writer.hpp>
+
 namespace unit_test {
 
 extern char const* g_current_testcase;
@@ -156,6 +158,31 @@ private:
     unsigned line_;
 };
 
+// Keeps everything that is written to it, so that tests can check the output
+// of an output_buffer or a log.
+class string_writer : public reckless::writer {
+public:
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        auto pc = static_cast<char const*>(pbuffer);
+        buffer_.insert(buffer_.end(), pc, pc + count);
+        return SUCCESS;
+    }
+
+    void reset()
+    {
+        buffer_.clear();
+    }
+
+    std::string const& str() const
+    {
+        return buffer_;
+    }
+
+private:
+    std::string buffer_;
+};
+
 #define UNIT_TEST_MAIN() \
 namespace unit_test { \
 char const* g_current_testcase; \
@@ -2,6 +2,12 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/syscall.h>
+#endif
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>  // uint64_t
 #include <windows.h>
 
 namespace {
@@ -55,6 +61,28 @@ std::size_t get_page_size()
 #endif
 }
 
+long current_thread_id()
+{
+#ifdef _WIN32
+    return static_cast<long>(GetCurrentThreadId());
+#else
+    return syscall(SYS_gettid);
+#endif
+}
+
+void signal_eventfd(int fd)
+{
+#if defined(__linux__)
+    if(fd == -1)
+        return;
+    std::uint64_t one = 1;
+    while(::write(fd, &one, sizeof(one)) < 0 and errno == EINTR)
+        ;
+#else
+    (void)fd;
+#endif
+}
+
 void prefetch(void const* ptr, std::size_t size)
 {
     char const* p = static_cast<char const*>(ptr);
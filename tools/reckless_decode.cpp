@@ -0,0 +1,142 @@
+// Turns a log written by reckless::binary_log into text.
+//
+//     reckless-decode [input [output]]
+//
+// Reads from standard input and writes to standard output if the file names
+// are left out or given as "-". If the input is damaged, the decoder reports
+// where, skips ahead to the next stream header and carries on; the exit
+// status is then 1.
+#include <reckless/binary_decoder.hpp>
+#include <reckless/output_buffer.hpp>
+#include <reckless/writer.hpp>
+
+#include <cstdio>
+#include <cstring>  // strcmp, strerror, memmove
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+std::size_t const INPUT_CHUNK_SIZE = 1024*1024;
+std::size_t const OUTPUT_BUFFER_SIZE = 1024*1024;
+
+class fd_writer : public reckless::writer {
+public:
+    explicit fd_writer(int fd) : fd_(fd)
+    {
+    }
+
+    Result write(void const* pbuffer, std::size_t count) override
+    {
+        char const* p = static_cast<char const*>(pbuffer);
+        while(count != 0) {
+            ssize_t written = ::write(fd_, p, count);
+            if(written == -1) {
+                if(errno == EINTR)
+                    continue;
+                return ERROR_GIVE_UP;
+            }
+            p += written;
+            count -= written;
+        }
+        return SUCCESS;
+    }
+
+private:
+    int fd_;
+};
+
+int open_file(char const* path, int flags)
+{
+    if(path == nullptr or 0 == std::strcmp(path, "-"))
+        return (flags & O_WRONLY)? STDOUT_FILENO : STDIN_FILENO;
+    int fd = open(path, flags | O_CLOEXEC, 0644);
+    if(fd == -1) {
+        std::fprintf(stderr, "reckless-decode: %s: %s\n", path,
+                std::strerror(errno));
+    }
+    return fd;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc > 3) {
+        std::fprintf(stderr, "usage: reckless-decode [input [output]]\n");
+        return 2;
+    }
+    int input_fd = open_file(argc > 1? argv[1] : nullptr, O_RDONLY);
+    if(input_fd == -1)
+        return 2;
+    int output_fd = open_file(argc > 2? argv[2] : nullptr,
+            O_WRONLY | O_CREAT | O_TRUNC);
+    if(output_fd == -1)
+        return 2;
+
+    fd_writer writer(output_fd);
+    reckless::output_buffer output(&writer, OUTPUT_BUFFER_SIZE);
+    reckless::binary_decoder decoder(&output);
+
+    std::vector<char> input(INPUT_CHUNK_SIZE);
+    std::size_t size = 0;
+    // File offset of input[0], for error messages.
+    unsigned long long input_offset = 0;
+    bool damaged = false;
+    bool resyncing = false;
+    while(true) {
+        // A record may be larger than what we have room for.
+        if(size == input.size())
+            input.resize(2*input.size());
+        ssize_t count = read(input_fd, input.data() + size, input.size() - size);
+        if(count == -1) {
+            if(errno == EINTR)
+                continue;
+            std::fprintf(stderr, "reckless-decode: read error: %s\n",
+                    std::strerror(errno));
+            return 2;
+        }
+        if(count == 0)
+            break;
+        size += count;
+
+        std::size_t pos = 0;
+        while(true) {
+            try {
+                std::size_t consumed = decoder.decode(input.data() + pos,
+                        size - pos);
+                pos += consumed;
+                if(consumed != 0)
+                    resyncing = false;
+                break;
+            } catch(reckless::binary_decode_error const& e) {
+                pos += e.offset();
+                if(not resyncing) {
+                    std::fprintf(stderr, "reckless-decode: %s at offset %llu;"
+                            " skipping to the next stream header\n", e.what(),
+                            input_offset + pos);
+                    damaged = true;
+                    resyncing = true;
+                }
+                pos += decoder.find_stream_header(input.data() + pos,
+                        size - pos);
+            }
+        }
+        std::memmove(input.data(), input.data() + pos, size - pos);
+        size -= pos;
+        input_offset += pos;
+    }
+
+    if(size != 0 and not resyncing) {
+        std::fprintf(stderr, "reckless-decode: input ends in the middle of a"
+                " record at offset %llu\n", input_offset);
+        damaged = true;
+    }
+    output.flush();
+    if(output.write_errors() != 0) {
+        std::fprintf(stderr, "reckless-decode: write error\n");
+        return 2;
+    }
+    return damaged? 1 : 0;
+}